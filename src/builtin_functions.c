@@ -2299,6 +2299,33 @@ PMOD_EXPORT void f_string_to_utf8(INT32 args)
     return;
   }
 
+  if (!in->size_shift) {
+    /* 8bit string -- every character is encoded with at most two
+     * bytes, so we can copy the runs of 7bit characters in bulk. */
+    const p_wchar0 *s = STR0(in);
+    len += count_non_ascii(s, in->len);
+    if (len == in->len) {
+      pop_n_elems(args - 1);
+      return;
+    }
+    out = begin_shared_string(len);
+    dst = STR0(out);
+    for (i = 0; i < in->len; i++) {
+      ptrdiff_t n = find_non_ascii(s + i, in->len - i);
+      memcpy(dst, s + i, n);
+      dst += n;
+      i += n;
+      if (i < in->len) {
+	*dst++ = 0xc0 | (s[i] >> 6);
+	*dst++ = 0x80 | (s[i] & 0x3f);
+      }
+    }
+    out = end_shared_string(out);
+    pop_n_elems(args);
+    push_string(out);
+    return;
+  }
+
   for(i=0,src=MKPCHARP_STR(in); i < in->len; INC_PCHARP(src,1),i++) {
     unsigned INT32 c = EXTRACT_PCHARP(src);
     if (c & ~0x7f) {
@@ -2475,6 +2502,13 @@ PMOD_EXPORT void f_utf8_to_string(INT32 args)
 
   for(i=0; i < in->len; i++) {
     unsigned int c = STR0(in)[i];
+    if (!(c & 0x80)) {
+      /* Skip the whole run of 7bit characters. */
+      ptrdiff_t n = find_non_ascii(STR0(in) + i, in->len - i);
+      len += n;
+      i += n - 1;
+      continue;
+    }
     len++;
     if (c & 0x80) {
       int cont = 0;
@@ -2673,11 +2707,24 @@ PMOD_EXPORT void f_utf8_to_string(INT32 args)
 
   out = begin_wide_shared_string(len, shift);
 
+  /* Copy a run of 7bit characters starting at i in bulk.
+   * NB: Not wrapped in do-while, since it breaks the enclosing loop. */
+#define COPY_7BIT_RUN(SHIFT)						\
+  if (!(STR0(in)[i] & 0x80)) {						\
+    ptrdiff_t n = find_non_ascii(STR0(in) + i, in->len - i);		\
+    PIKE_CONCAT(convert_0_to_, SHIFT)(out_str + j, STR0(in) + i, n);	\
+    i += n;								\
+    j += n;								\
+    if (i >= in->len) break;						\
+  }
+
   switch (shift) {
     case 0: {
       p_wchar0 *out_str = STR0 (out);
       for(i=0; i < in->len;) {
-	unsigned int c = STR0(in)[i++];
+	unsigned int c;
+	COPY_7BIT_RUN(0);
+	c = STR0(in)[i++];
 	/* NOTE: No tests here since we've already tested the string above. */
 	if (c & 0x80) {
 	  /* 11bit */
@@ -2693,7 +2740,9 @@ PMOD_EXPORT void f_utf8_to_string(INT32 args)
     case 1: {
       p_wchar1 *out_str = STR1 (out);
       for(i=0; i < in->len;) {
-	unsigned int c = STR0(in)[i++];
+	unsigned int c;
+	COPY_7BIT_RUN(1);
+	c = STR0(in)[i++];
 	/* NOTE: No tests here since we've already tested the string above. */
 	if (c & 0x80) {
 	  if ((c & 0xe0) == 0xc0) {
@@ -2717,7 +2766,9 @@ PMOD_EXPORT void f_utf8_to_string(INT32 args)
     case 2: {
       p_wchar2 *out_str = STR2 (out);
       for(i=0; i < in->len;) {
-	unsigned int c = STR0(in)[i++];
+	unsigned int c;
+	COPY_7BIT_RUN(2);
+	c = STR0(in)[i++];
 	/* NOTE: No tests here since we've already tested the string above. */
 	if (c & 0x80) {
 	  int cont = 0;
@@ -2761,6 +2812,7 @@ PMOD_EXPORT void f_utf8_to_string(INT32 args)
       break;
     }
   }
+#undef COPY_7BIT_RUN
 
 #ifdef PIKE_DEBUG
   if (j != len) {
@@ -2858,6 +2910,8 @@ PMOD_EXPORT void f_validate_utf8(INT32 args)
 
     if (!(c & 0x80)) {
       if (expect_low_surrogate) ret = 0;	/* Expected low surrogate. */
+      /* Skip the rest of the run of 7bit characters. */
+      else i += find_non_ascii(STR0(in) + i, in->len - i) - 1;
       continue;
     }
 
@@ -10516,6 +10570,16 @@ void init_builtin_efuns(void)
 	   tFunc(tStr tOr(tVoid,tObj) tOr3(tVoid, tIntPos, tObj),tMix),
 	   OPT_TRY_OPTIMIZE);
 
+  /* function(object,mixed,void|object:void) */
+  ADD_EFUN("encode_value_to", f_encode_value_to,
+	   tFunc(tObj tMix tOr(tVoid,tObj),tVoid),
+	   OPT_SIDE_EFFECT);
+
+  /* function(object,void|object:mixed) */
+  ADD_EFUN("decode_value_from", f_decode_value_from,
+	   tFunc(tObj tOr(tVoid,tObj),tMix),
+	   OPT_SIDE_EFFECT|OPT_EXTERNAL_DEPEND);
+
   /* function(object,string:int) */
   ADD_EFUN("object_variablep", f_object_variablep,
 	   tFunc(tObj tStr,tInt), OPT_EXTERNAL_DEPEND);
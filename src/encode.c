@@ -210,6 +210,12 @@ struct encode_data
    * to a thing not yet encoded. */
   struct array *delayed;
   struct byte_buffer buf;
+  struct object *sink;		/* Object to flush buf to, or NULL. */
+  int sink_fun;			/* write() or add() in sink. */
+  int sink_is_file;		/* sink_fun is write(). */
+  size_t flushed;		/* Number of bytes flushed to sink. */
+  size_t hold;			/* Offset of the first byte that may
+				 * still be changed. */
 #ifdef ENCODE_DEBUG
   struct string_builder *debug_buf;
   size_t debug_pos;
@@ -228,8 +234,70 @@ static struct object *encoder_codec (struct encode_data *data)
 /* Convert to/from forward reference ID. */
 #define CONVERT_ENTRY_ID(ID) (-((ID) - COUNTER_START) - (-COUNTER_START + 1))
 
+/* Output is flushed to the sink, and input is read from the source,
+ * in chunks of this size when streaming. */
+#define STREAM_CHUNK_SIZE	65536
+
 static void encode_value2(struct svalue *val, struct encode_data *data, int force_encode);
 
+/* Writes a string to the sink of encode_value_to(). */
+static void encode_write(struct encode_data *data, struct pike_string *s)
+{
+  ptrdiff_t written = 0;
+
+  while (written < s->len) {
+    if (written) push_string(string_slice(s, written, s->len - written));
+    else ref_push_string(s);
+    apply_low(data->sink, data->sink_fun, 1);
+    if (!data->sink_is_file) {
+      /* add() in Stdio.Buffer and String.Buffer. */
+      pop_stack();
+      return;
+    }
+    if (TYPEOF(Pike_sp[-1]) != PIKE_T_INT || Pike_sp[-1].u.integer <= 0)
+      Pike_error("Failed to write encoded data.\n");
+    written += Pike_sp[-1].u.integer;
+    pop_stack();
+  }
+}
+
+/* Flushes as much of the buffered output as possible to the sink. */
+static void encode_flush(struct encode_data *data)
+{
+  char *ptr = buffer_ptr(&data->buf);
+  size_t len = buffer_content_length(&data->buf);
+  size_t n = len;
+
+  if (data->hold - data->flushed < n)
+    n = data->hold - data->flushed;
+  if (!n) return;
+
+  push_string(make_shared_binary_string(ptr, n));
+  if (n == len) {
+    buffer_clear(&data->buf);
+  } else {
+    memmove(ptr, ptr + n, len - n);
+    buffer_remove(&data->buf, n);
+  }
+  data->flushed += n;
+  encode_write(data, Pike_sp[-1].u.string);
+  pop_stack();
+}
+
+/* Adds the contents of a large 8-bit string, writing it directly to
+ * the sink when possible. */
+static void encode_add_string(struct encode_data *data,
+			      struct pike_string *s)
+{
+  encode_flush(data);
+  if (buffer_content_length(&data->buf)) {
+    buffer_memcpy(&data->buf, s->str, s->len);
+    return;
+  }
+  data->flushed += s->len;
+  encode_write(data, s);
+}
+
 #ifdef ENCODE_DEBUG
 static void debug_dump_mem(size_t offset, const unsigned char *bytes,
 			   size_t len)
@@ -323,7 +391,10 @@ static void low_addchar(struct byte_buffer *buf, int c, int edb)
     EDB(1, {						\
 	ENCODE_WERR(".string  %ld", __str->len);	\
       });						\
-    addstr((char *)(__str->str),__str->len);            \
+    if (data->sink && __str->len >= STREAM_CHUNK_SIZE)	\
+      encode_add_string(data, (struct pike_string *)__str); \
+    else						\
+      addstr((char *)(__str->str),__str->len);		\
   }                                                     \
   EDB(1, {						\
       ENCODE_FLUSH();					\
@@ -1076,7 +1147,9 @@ static void encode_value2(struct svalue *val, struct encode_data *data, int forc
 	case T_INT:
 	  if(SUBTYPEOF(Pike_sp[-1]) == NUMBER_UNDEFINED)
 	  {
-	    int to_change = buffer_content_length(&data->buf);
+	    size_t to_change =
+	      data->flushed + buffer_content_length(&data->buf);
+	    size_t old_hold = data->hold;
 	    struct svalue tmp = entry_id;
 
 	    EDB(5,fprintf(stderr, "%*s(UNDEFINED)\n", data->depth, ""));
@@ -1107,7 +1180,9 @@ static void encode_value2(struct svalue *val, struct encode_data *data, int forc
 	    push_svalue(val);
 	    f_object_program(1);
 
-	    /* Code the program */
+	    /* Code the program, keeping the entry in the buffer
+	     * since it might be changed below. */
+	    if (to_change < data->hold) data->hold = to_change;
 	    code_entry(TAG_OBJECT, 3,data);
 	    EDB(1, {
 		ENCODE_WERR(".entry   object, 3");
@@ -1131,7 +1206,7 @@ static void encode_value2(struct svalue *val, struct encode_data *data, int forc
 	       * become: code_entry(TAG_OBJECT, 1, data);
 	       * -Hubbe
 	       */
-	      ((char*)buffer_ptr(&data->buf))[to_change] = 99;
+	      ((char*)buffer_ptr(&data->buf))[to_change - data->flushed] = 99;
 
 	      fun = find_identifier("encode_object",
 				    encoder_codec (data)->prog);
@@ -1143,6 +1218,7 @@ static void encode_value2(struct svalue *val, struct encode_data *data, int forc
 	      /* Put value back in cache for future reference -Hubbe */
 	      mapping_insert(data->encoded, val, &tmp);
 	    }
+	    data->hold = old_hold;
 	    break;
 	  }
           /* FALLTHRU */
@@ -2191,6 +2267,10 @@ static void encode_value2(struct svalue *val, struct encode_data *data, int forc
 
 encode_done:;
 
+  if (data->sink &&
+      (buffer_content_length(&data->buf) >= STREAM_CHUNK_SIZE))
+    encode_flush(data);
+
 #ifdef ENCODE_DEBUG
   data->depth -= 2;
 #endif
@@ -2268,6 +2348,9 @@ void f_encode_value(INT32 args)
 
   buffer_init(&data->buf);
   data->canonic = 0;
+  data->sink = NULL;
+  data->flushed = 0;
+  data->hold = (size_t)-1;
   data->encoded=allocate_mapping(128);
   data->encoded->data->flags |= MAPPING_FLAG_NO_SHRINK;
   data->delayed = allocate_array (0);
@@ -2352,6 +2435,100 @@ void f_encode_value(INT32 args)
   push_string(buffer_finish_pike_string(&data->buf));
 }
 
+/*! @decl void encode_value_to(Stdio.Buffer|Stdio.File to, mixed value, @
+ *!                            Codec|void codec)
+ *!
+ *! Code a value like @[encode_value()], but write the result to a
+ *! buffer or file instead of returning it as a string.
+ *!
+ *! The output is written in chunks while it is generated, so the
+ *! encoded form of @[value] is never held in memory all at once.
+ *! Large strings in @[value] are written without being copied.
+ *!
+ *! @param to
+ *!   If @[to] has a @expr{write()@} method, like @[Stdio.File], the
+ *!   output is written with it. Otherwise it is added with
+ *!   @expr{add()@}, which works with @[Stdio.Buffer] and
+ *!   @[String.Buffer].
+ *!
+ *! The written data is the same as @expr{encode_value(value, codec)@}
+ *! would return.
+ *!
+ *! @note
+ *!   If an error is thrown, the part of the output that has already
+ *!   been written is left in @[to].
+ *!
+ *! @seealso
+ *!   @[encode_value()], @[decode_value_from()]
+ */
+void f_encode_value_to(INT32 args)
+{
+  ONERROR tmp;
+  struct encode_data d, *data;
+  struct object *to;
+  int i;
+  data=&d;
+
+  check_all_args(NULL, args,
+		 BIT_OBJECT,
+		 BIT_MIXED,
+		 BIT_VOID | BIT_OBJECT | BIT_ZERO,
+		 0);
+
+  to = Pike_sp[-args].u.object;
+  if (!to->prog)
+    SIMPLE_ARG_TYPE_ERROR("encode_value_to", 1, "Stdio.Buffer|Stdio.File");
+  if ((data->sink_fun = find_identifier("write", to->prog)) >= 0) {
+    data->sink_is_file = 1;
+  } else if ((data->sink_fun = find_identifier("add", to->prog)) >= 0) {
+    data->sink_is_file = 0;
+  } else {
+    SIMPLE_ARG_TYPE_ERROR("encode_value_to", 1, "Stdio.Buffer|Stdio.File");
+  }
+
+  buffer_init(&data->buf);
+  data->canonic = 0;
+  data->sink = to;
+  data->flushed = 0;
+  data->hold = (size_t)-1;
+  data->encoded=allocate_mapping(128);
+  data->encoded->data->flags |= MAPPING_FLAG_NO_SHRINK;
+  data->delayed = allocate_array (0);
+  SET_SVAL(data->counter, T_INT, NUMBER_NUMBER, integer, COUNTER_START);
+
+#ifdef ENCODE_DEBUG
+  data->debug_buf = NULL;
+  data->debug_pos = 0;
+  data->debug = 0;
+  data->depth = -2;
+#endif
+
+  if(args > 2 && TYPEOF(Pike_sp[2-args]) == T_OBJECT)
+  {
+    if (SUBTYPEOF(Pike_sp[2-args]))
+      Pike_error("The codec may not be a subtyped object yet.\n");
+
+    data->codec=Pike_sp[2-args].u.object;
+    add_ref (data->codec);
+  }else{
+    data->codec=NULL;
+  }
+
+  SET_ONERROR(tmp, free_encode_data, data);
+  addstr("\266ke0", 4);
+
+  encode_value2(Pike_sp+1-args, data, 1);
+
+  for (i = 0; i < data->delayed->size; i++)
+    encode_value2 (ITEM(data->delayed) + i, data, 2);
+
+  encode_flush(data);
+
+  CALL_AND_UNSET_ONERROR(tmp);
+
+  pop_n_elems(args);
+}
+
 /*! @decl string encode_value_canonic(mixed value, object|void codec)
  *!
  *! Code a value into a string on canonical form.
@@ -2394,6 +2571,9 @@ void f_encode_value_canonic(INT32 args)
 
   buffer_init(&data->buf);
   data->canonic = 1;
+  data->sink = NULL;
+  data->flushed = 0;
+  data->hold = (size_t)-1;
   data->encoded=allocate_mapping(128);
   data->delayed = allocate_array (0);
   SET_SVAL(data->counter, T_INT, NUMBER_NUMBER, integer, COUNTER_START);
@@ -2497,6 +2677,12 @@ struct decode_data
   unsigned char *data;
   ptrdiff_t len;
   ptrdiff_t ptr;
+  struct object *source;	/* Object to read more data from, or NULL.
+				 * data is then a malloced window of size
+				 * bytes into the stream. */
+  int source_fun;		/* try_read() or read() in source. */
+  int eof;
+  ptrdiff_t size;
   struct mapping *decoded;
   struct unfinished_prog_link *unfinished_programs;
   struct unfinished_obj_link *unfinished_objects;
@@ -2532,9 +2718,85 @@ static struct object *decoder_codec (struct decode_data *data)
 
 static void decode_value2(struct decode_data *data);
 
+/* Returns the function in o used to read data for
+ * decode_value_from(), or -1. */
+static int source_read_fun(struct object *o)
+{
+  int fun;
+  if (!o->prog) return -1;
+  if ((fun = find_identifier("try_read", o->prog)) >= 0) return fun;
+  return find_identifier("read", o->prog);
+}
+
+/* Reads at most len bytes from the source, and pushes them as a
+ * string. */
+static void push_source_data(struct object *source, int fun, ptrdiff_t len)
+{
+  push_int(len);
+  apply_low(source, fun, 1);
+  if (TYPEOF(Pike_sp[-1]) != PIKE_T_STRING ||
+      Pike_sp[-1].u.string->size_shift)
+    Pike_error("Failed to read encoded data.\n");
+}
+
+/* Reads more data from the source into the window, so that at least
+ * need bytes are available. Returns zero at the end of the stream,
+ * or if there is no source.
+ *
+ * The window at most doubles per read, so a corrupt size in the
+ * coded data can't make it grow much beyond the data that is
+ * actually available.
+ */
+static int decode_fill(struct decode_data *data, ptrdiff_t need)
+{
+  ptrdiff_t keep;
+
+  if (data->len - data->ptr >= need) return 1;
+  if (!data->source || data->eof) return 0;
+
+  /* Discard consumed data, except for the last byte since it may be
+   * pushed back. */
+  keep = data->ptr ? data->ptr - 1 : 0;
+  if (keep) {
+    memmove(data->data, data->data + keep, data->len - keep);
+    data->len -= keep;
+    data->ptr -= keep;
+  }
+
+  while (data->len - data->ptr < need) {
+    struct pike_string *s;
+    ptrdiff_t want = need - (data->len - data->ptr);
+    if (want > data->len) want = data->len;
+    if (want < STREAM_CHUNK_SIZE) want = STREAM_CHUNK_SIZE;
+    if (data->len + want > data->size) {
+      data->data = xrealloc(data->data, data->len + want);
+      data->size = data->len + want;
+    }
+    push_source_data(data->source, data->source_fun,
+		     data->size - data->len);
+    s = Pike_sp[-1].u.string;
+    if (!s->len) {
+      pop_stack();
+      data->eof = 1;
+      return 0;
+    }
+    if (s->len > data->size - data->len) {
+      data->data = xrealloc(data->data, data->len + s->len);
+      data->size = data->len + s->len;
+    }
+    memcpy(data->data + data->len, s->str, s->len);
+    data->len += s->len;
+    pop_stack();
+  }
+  return 1;
+}
+
+#define DECODE_AVAIL(data, n)					\
+  (((data)->len - (data)->ptr >= (n)) || decode_fill((data), (n)))
+
 static int my_extract_char(struct decode_data *data)
 {
-  if(data->ptr >= data->len)
+  if(!DECODE_AVAIL(data, 1))
     Pike_error("Not enough data in string.\n");
 
 #ifdef ENCODE_DEBUG
@@ -2650,7 +2912,7 @@ static DECLSPEC(noreturn) void decode_error (
     sz = (ptrdiff_t) num << what;					\
     if (sz < 0)								\
       decode_error (data, NULL, "Illegal negative size %td.\n", sz);	\
-    if (sz > data->len - data->ptr)					\
+    if (!DECODE_AVAIL(data, sz))					\
       decode_error (data, NULL, "Too large size %td (max is %td).\n",	\
 		    sz, data->len - data->ptr);				\
     STR=begin_wide_shared_string(num, what);				\
@@ -2666,7 +2928,7 @@ static DECLSPEC(noreturn) void decode_error (
     ptrdiff_t sz = (LEN);						\
     if (sz < 0)								\
       decode_error (data, NULL, "Illegal negative size %td.\n", sz);	\
-    if (sz > data->len - data->ptr)					\
+    if (!DECODE_AVAIL(data, sz))					\
       decode_error (data, NULL, "Too large size %td (max is %td).\n",	\
 		    sz, data->len - data->ptr);				\
     EDB(1, {								\
@@ -2790,7 +3052,7 @@ static void low_decode_type(struct decode_data *data)
     case T_INT:
       {
 	INT32 min=0, max=0;
-	if(data->ptr + 8 > data->len)
+	if(!DECODE_AVAIL(data, 8))
           decode_error(data, NULL, "Not enough data.\n");
 	EDB(6, debug_dump_mem(data->ptr, data->data + data->ptr, 8));
 	min = get_unaligned_be32(data->data + data->ptr);
@@ -3365,7 +3627,7 @@ static void decode_value2(struct decode_data *data)
 		     "Failed to decode array (array size is negative).\n");
 
       /* Heruetical */
-      if(num > data->len - data->ptr)
+      if(!DECODE_AVAIL(data, num))
 	decode_error(data, NULL, "Failed to decode array (not enough data).\n");
 
       EDB(2,fprintf(stderr, "%*sDecoding array of size %ld to <%ld>\n",
@@ -3397,7 +3659,7 @@ static void decode_value2(struct decode_data *data)
 		     "(mapping size is negative).\n");
 
       /* Heuristical */
-      if(num > data->len - data->ptr)
+      if(!DECODE_AVAIL(data, num))
 	decode_error(data, NULL, "Failed to decode mapping "
 		     "(not enough data).\n");
 
@@ -3431,7 +3693,7 @@ static void decode_value2(struct decode_data *data)
 		     "(multiset size is negative).\n");
 
       /* Heruetical */
-      if(num > data->len - data->ptr)
+      if(!DECODE_AVAIL(data, num))
 	decode_error(data, NULL, "Failed to decode multiset "
 		     "(not enough data).\n");
 
@@ -4745,6 +5007,12 @@ static void decode_value2(struct decode_data *data)
 	  data->depth-=2;
 #endif
 
+	  /* A delayed decode starts over from the beginning, which
+	   * isn't possible when reading from a stream. */
+	  if (data->source && c->supporter.depends_on)
+	    decode_error(data, NULL, "Cannot decode programs with "
+			 "unresolved dependencies from a stream.\n");
+
 	  int delay = unlink_current_supporter(& c->supporter);
 	  UNSET_ONERROR(err);
 
@@ -5006,6 +5274,10 @@ static void free_decode_data (struct decode_data *data, int delay,
     }
   }
 #endif
+  if (data->source) {
+    free(data->data);
+    free_object(data->source);
+  }
   free_string(data->data_str);
   free_mapping(data->decoded);
   free( (char *) data);
@@ -5017,7 +5289,7 @@ static void low_do_decode (struct decode_data *data)
 
   decode_value2(data);
 
-  while (data->ptr < data->len) {
+  while (DECODE_AVAIL(data, 1)) {
     decode_value2 (data);
     pop_stack();
   }
@@ -5042,6 +5314,7 @@ static void error_debug_free_decode_data (struct decode_data *data)
 #endif
 
 static INT32 my_decode(struct pike_string *tmp,
+		       struct object *source,
 		       struct object *codec
 #ifdef ENCODE_DEBUG
 		       , int debug, struct string_builder *debug_buf
@@ -5056,7 +5329,7 @@ static INT32 my_decode(struct pike_string *tmp,
 
   /* FIXME: Why not use CYCLIC? */
   /* Attempt to avoid infinite recursion on circular structures. */
-  for (data = current_decode; data; data=data->next) {
+  for (data = source ? NULL : current_decode; data; data=data->next) {
     if (data->raw == tmp &&
 	(codec ? data->codec == codec : !data->explicit_codec)
 #ifdef PIKE_THREADS
@@ -5080,6 +5353,16 @@ static INT32 my_decode(struct pike_string *tmp,
   data->data=(unsigned char *)tmp->str;
   data->len=tmp->len;
   data->ptr=0;
+  data->source = source;
+  data->eof = 0;
+  data->size = 0;
+  if (source) {
+    /* tmp is the first part of the stream. */
+    data->source_fun = source_read_fun(source);
+    data->size = MAXIMUM(tmp->len, STREAM_CHUNK_SIZE);
+    data->data = xalloc(data->size);
+    memcpy(data->data, tmp->str, tmp->len);
+  }
   data->codec=codec;
   data->explicit_codec = codec ? 1 : 0;
   data->pickyness=0;
@@ -5090,7 +5373,7 @@ static INT32 my_decode(struct pike_string *tmp,
   data->delay_counter = 0;
   data->support_delay_counter = 0;
   data->support_compilation = NULL;
-  data->raw = tmp;
+  data->raw = source ? NULL : tmp;
   data->next = current_decode;
 #ifdef PIKE_THREADS
   data->thread_state = Pike_interpreter.thread_state;
@@ -5114,6 +5397,7 @@ static INT32 my_decode(struct pike_string *tmp,
       GETC() != 'e' ||
       GETC() != '0')
   {
+    if (source) free(data->data);
     free( (char *) data);
     return 0;
   }
@@ -5132,6 +5416,7 @@ static INT32 my_decode(struct pike_string *tmp,
   data->decoded=allocate_mapping(128);
 
   add_ref (data->data_str);
+  if (data->source) add_ref (data->source);
   if (data->codec) add_ref (data->codec);
 #ifdef PIKE_THREADS
   add_ref (data->thread_obj);
@@ -5530,7 +5815,7 @@ void f_decode_value(INT32 args)
 	codec = NULL;
   }
 
-  if(!my_decode(s, codec
+  if(!my_decode(s, NULL, codec
 #ifdef ENCODE_DEBUG
 		, debug, debug_buf
 #endif
@@ -5550,3 +5835,70 @@ void f_decode_value(INT32 args)
   assign_svalue(Pike_sp-args-1, Pike_sp-1);
   pop_n_elems(args);
 }
+
+/*! @decl mixed decode_value_from(Stdio.Buffer|Stdio.File from, @
+ *!                               void|Codec codec)
+ *!
+ *! Decode a value like @[decode_value()], but read the coded value
+ *! from a buffer or file.
+ *!
+ *! The data is read in chunks as it is needed, so the coded value is
+ *! never held in memory all at once. Strings are decoded from a
+ *! window that holds the unread data, so a large string is held
+ *! twice while it is decoded.
+ *!
+ *! @param from
+ *!   If @[from] has a @expr{try_read()@} method, like
+ *!   @[Stdio.Buffer], it is used to read the data. Otherwise
+ *!   @expr{read()@} is used, which works with @[Stdio.File]. All
+ *!   remaining data in @[from] is consumed, and must be a single
+ *!   value coded with @[encode_value()], @[encode_value_canonic()]
+ *!   or @[encode_value_to()].
+ *!
+ *! @note
+ *!   Programs that depend on other programs that are being decoded
+ *!   at the same time can't be decoded this way, since that requires
+ *!   that the data is decoded twice.
+ *!
+ *! @seealso
+ *!   @[decode_value()], @[encode_value_to()]
+ */
+void f_decode_value_from(INT32 args)
+{
+  struct object *source;
+  struct object *codec = NULL;
+  int fun;
+
+  check_all_args(NULL, args,
+		 BIT_OBJECT,
+		 BIT_VOID | BIT_OBJECT | BIT_ZERO,
+		 0);
+
+  source = Pike_sp[-args].u.object;
+  if ((fun = source_read_fun(source)) < 0)
+    SIMPLE_ARG_TYPE_ERROR("decode_value_from", 1, "Stdio.Buffer|Stdio.File");
+
+  if (args > 1 && TYPEOF(Pike_sp[1-args]) == T_OBJECT) {
+    if (SUBTYPEOF(Pike_sp[1-args]))
+      Pike_error("The codec may not be a subtyped object yet.\n");
+    codec = Pike_sp[1-args].u.object;
+  } else if (!get_master()) {
+    /* The codec used for decoding the master program. */
+    push_object (clone_object (MasterCodec_program, 0));
+    args++;
+    codec = Pike_sp[-1].u.object;
+  }
+
+  push_source_data(source, fun, STREAM_CHUNK_SIZE);
+  args++;
+
+  if(!my_decode(Pike_sp[-1].u.string, source, codec
+#ifdef ENCODE_DEBUG
+		, 0, NULL
+#endif
+	       ))
+    Pike_error("Data is not in encode_value() format.\n");
+
+  assign_svalue(Pike_sp-args-1, Pike_sp-1);
+  pop_n_elems(args);
+}
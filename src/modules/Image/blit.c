@@ -375,23 +375,33 @@ void image_paste_alpha(INT32 args)
 /* trda hr nndag.. Ok /Per */
 
    {
-     rgb_group *source = img->img;
      struct image *this = THIS;
-     int xs = this->xsize, ix, mx=img->xsize, my=img->ysize, x;
-     int ys = this->ysize, iy, y;
+     INT32 xs = this->xsize, mx = img->xsize;
+     INT32 ix0 = MAXIMUM(0, -x1), ix1 = MINIMUM(mx, xs - x1);
+     INT32 iy0 = MAXIMUM(0, -y1), iy1 = MINIMUM(img->ysize, this->ysize - y1);
+     int alpha = this->alpha;
+     INT32 iy;
 
      THREADS_ALLOW();
-     for (iy=0; iy<my; iy++)
-       for (ix=0; ix<mx; ix++)
+     if (ix0 < ix1)
+       for (iy = iy0; iy < iy1; iy++)
        {
-	 x = ix + x1; y = iy + y1;
-	 if(x>=0 && y>=0 && x<xs && y<ys) {
-	   if(this->alpha)
-	     set_rgb_group_alpha(this->img[x+y*xs],*(source),this->alpha);
-	   else
-	     this->img[x+y*xs]=*(source);
+	 rgb_group *source = img->img + ix0 + iy*mx;
+	 rgb_group *dest = this->img + ix0 + x1 + (iy + y1)*xs;
+	 INT32 n = ix1 - ix0;
+
+	 if (alpha)
+	 {
+	   INT32 done = IMAGE_SIMD(blend, (dest, dest, source, n, alpha));
+	   dest += done; source += done; n -= done;
+	   while (n--)
+	   {
+	     set_rgb_group_alpha(*dest, *source, alpha);
+	     dest++; source++;
+	   }
 	 }
-	 source++;
+	 else
+	   memmove(dest, source, n*sizeof(rgb_group));
        }
      THREADS_DISALLOW();
    }
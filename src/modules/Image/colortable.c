@@ -41,6 +41,7 @@
 #include "pike_types.h"
 #include "constants.h"
 #include "sprintf.h"
+#include "threads.h"
 
 #include "image.h"
 #include "colortable.h"
@@ -74,6 +75,8 @@
 #define RIGID_DEFAULT_G 16
 #define RIGID_DEFAULT_B 16
 
+#define KDTREE_LEAF_SIZE 8
+
 #define SQ(x) ((x)*(x))
 static inline ptrdiff_t sq(ptrdiff_t x) { return x*x; }
 static inline int sq_int(int x) { return x*x; }
@@ -108,7 +111,21 @@ static void colortable_free_lookup_stuff(struct neo_colortable *nct)
 	 nct->lu.rigid.index=NULL;
 	 break;
       case NCT_FULL:
-         break;
+	 if (nct->lu.full.planes)
+	 {
+	    free(nct->lu.full.planes);
+	    free(nct->lu.full.pos);
+	 }
+	 nct->lu.full.planes=NULL;
+	 break;
+      case NCT_KDTREE:
+	 if (nct->lu.kdtree.nodes)
+	 {
+	    free(nct->lu.kdtree.nodes);
+	    free(nct->lu.kdtree.colors);
+	 }
+	 nct->lu.kdtree.nodes=NULL;
+	 break;
    }
 }
 
@@ -220,7 +237,8 @@ static void _img_copy_colortable(struct neo_colortable *dest,
    {
       case NCT_CUBICLES: dest->lu.cubicles.cubicles=NULL; break;
       case NCT_RIGID:    dest->lu.rigid.index=NULL; break;
-      case NCT_FULL:     break;
+      case NCT_FULL:     dest->lu.full.planes=NULL; break;
+      case NCT_KDTREE:   dest->lu.kdtree.nodes=NULL; break;
    }
 
    /* copy dither info */
@@ -2794,9 +2812,14 @@ void image_colortable_cast(INT32 args)
 **!     algorithm time: O[n*m], where n is numbers of colors
 **!	and m is number of pixels
 **!
+**!	The distances are computed with SSE2 or AVX2 when
+**!	available, see <ref>Image.simd_type</ref>. Maps without
+**!	dither are split between several threads, see
+**!	<ref>Image.set_num_threads</ref>.
+**!
 **! returns the object being called
 **!
-**! see also: cubicles, map
+**! see also: cubicles, kdtree, map
 **! note
 **!     Not applicable to colorcube types of colortable.
 **/
@@ -2807,6 +2830,48 @@ void image_colortable_full(INT32 args)
    {
       colortable_free_lookup_stuff(THIS);
       THIS->lookup_mode=NCT_FULL;
+      THIS->lu.full.planes=NULL;
+   }
+   pop_n_elems(args);
+   ref_push_object(THISOBJ);
+}
+
+/*
+**! method object kdtree()
+**!	Set the colortable to use a k-d tree to lookup the
+**!	closest color.
+**!
+**!	The colors are sorted into a binary tree that splits
+**!	the colorspace at the median color along the red, green
+**!	or blue axis, and the lookup only compares with the
+**!	colors in the parts of the tree that are close enough.
+**!	The result is exactly the same as with <ref>full</ref>,
+**!	but it is much faster for large colortables.
+**!
+**!	example: <tt>colors=Image.Colortable(img,256)->kdtree();</tt>
+**!
+**!     algorithm time: about O[m*log(n)], where n is numbers
+**!	of colors and m is number of pixels
+**!
+**!	The tree is built at the first use of the colortable,
+**!	which takes about O[n*log(n)*log(n)] time. Maps without
+**!	dither are split between several threads, see
+**!	<ref>Image.set_num_threads</ref>.
+**!
+**! returns the object being called
+**!
+**! see also: cubicles, full, map
+**! note
+**!     Not applicable to colorcube types of colortable.
+**/
+
+void image_colortable_kdtree(INT32 args)
+{
+   if (THIS->lookup_mode!=NCT_KDTREE)
+   {
+      colortable_free_lookup_stuff(THIS);
+      THIS->lookup_mode=NCT_KDTREE;
+      THIS->lu.kdtree.nodes=NULL;
    }
    pop_n_elems(args);
    ref_push_object(THISOBJ);
@@ -3269,6 +3334,302 @@ void build_rigid(struct neo_colortable *nct)
    free(dist);
 }
 
+/***************** exact lookups *******************************/
+
+/* Builds the color planes for image_simd->nearest, if it is
+ * available. */
+static void build_full(struct neo_colortable *nct)
+{
+   struct nct_flat_entry *fe=nct->u.flat.entries;
+   ptrdiff_t i,m=0;
+   INT32 n;
+   INT16 *planes;
+   int *pos;
+
+   if (!image_simd) return;
+
+   for (i=0; i<nct->u.flat.numentries; i++)
+      if (fe[i].no!=-1) m++;
+   if (!m) return;
+
+   n=(INT32)((m+IMAGE_SIMD_NEAREST_PAD-1)/IMAGE_SIMD_NEAREST_PAD*
+	     IMAGE_SIMD_NEAREST_PAD);
+   planes=xalloc(sizeof(INT16)*3*n);
+   pos=malloc(sizeof(int)*n);
+   if (!pos)
+   {
+      free(planes);
+      out_of_memory_error(NULL, -1, sizeof(int)*n);
+   }
+
+   for (i=0,m=0; i<nct->u.flat.numentries; i++)
+      if (fe[i].no!=-1)
+      {
+	 planes[m]=fe[i].color.r;
+	 planes[n+m]=fe[i].color.g;
+	 planes[2*n+m]=fe[i].color.b;
+	 pos[m++]=(int)i;
+      }
+   /* pad with copies of the first color, which never win over it */
+   for (; m<n; m++)
+   {
+      planes[m]=planes[0];
+      planes[n+m]=planes[n];
+      planes[2*n+m]=planes[2*n];
+      pos[m]=pos[0];
+   }
+
+   nct->lu.full.n=n;
+   nct->lu.full.pos=pos;
+   nct->lu.full.planes=planes;
+}
+
+/* Returns the position in the flat table of the closest color. Of
+ * equally close colors the first is picked. */
+static int _nct_scan_full(struct neo_colortable *nct,int r,int g,int b)
+{
+   rgbl_group sf=nct->spacefactor;
+   struct nct_flat_entry *fe=nct->u.flat.entries;
+   ptrdiff_t i,n=nct->u.flat.numentries;
+   int mindist=0x7fffffff;
+   int best=0;
+
+   for (i=0; i<n; i++)
+      if (fe[i].no!=-1)
+      {
+	 int dist=
+	    sf.r*SQ(fe[i].color.r-r)+
+	    sf.g*SQ(fe[i].color.g-g)+
+	    sf.b*SQ(fe[i].color.b-b);
+
+	 if (dist<mindist)
+	 {
+	    mindist=dist;
+	    best=(int)i;
+	 }
+      }
+
+   return best;
+}
+
+/* The same as _nct_scan_full, with the planes from build_full when
+ * the factors are small enough for them. */
+static inline int _nct_lookup_full(struct neo_colortable *nct,
+				   int r,int g,int b)
+{
+   rgbl_group sf=nct->spacefactor;
+
+   if (nct->lu.full.planes &&
+       sf.r>=-128 && sf.r<=128 &&
+       sf.g>=-128 && sf.g<=128 &&
+       sf.b>=-128 && sf.b<=128)
+   {
+      INT16 *p=nct->lu.full.planes;
+      INT32 n=nct->lu.full.n;
+      INT16 col[6];
+      INT32 dist;
+
+      col[0]=r; col[1]=g; col[2]=b;
+      col[3]=sf.r; col[4]=sf.g; col[5]=sf.b;
+
+      return nct->lu.full.pos[image_simd->nearest(p,p+n,p+2*n,n,col,&dist)];
+   }
+
+   return _nct_scan_full(nct,r,g,b);
+}
+
+static int kdcolor_cmp_r(const void *a,const void *b)
+{
+   const struct nct_kdcolor *x=a, *y=b;
+   if (x->c[0]!=y->c[0]) return x->c[0]-y->c[0];
+   return x->pos-y->pos;
+}
+
+static int kdcolor_cmp_g(const void *a,const void *b)
+{
+   const struct nct_kdcolor *x=a, *y=b;
+   if (x->c[1]!=y->c[1]) return x->c[1]-y->c[1];
+   return x->pos-y->pos;
+}
+
+static int kdcolor_cmp_b(const void *a,const void *b)
+{
+   const struct nct_kdcolor *x=a, *y=b;
+   if (x->c[2]!=y->c[2]) return x->c[2]-y->c[2];
+   return x->pos-y->pos;
+}
+
+static int kdcolor_cmp_pos(const void *a,const void *b)
+{
+   return ((const struct nct_kdcolor *)a)->pos-
+      ((const struct nct_kdcolor *)b)->pos;
+}
+
+/* Builds the subtree of the colors lo..hi-1, returns the node. */
+static int _build_kdtree_node(struct nct_kdnode *nodes,int *nnodes,
+			      struct nct_kdcolor *colors,int lo,int hi,
+			      rgbl_group sf)
+{
+   static int (* const cmp[3])(const void *,const void *)=
+      { kdcolor_cmp_r, kdcolor_cmp_g, kdcolor_cmp_b };
+   int node=(*nnodes)++;
+   INT64 spread[3];
+   int min[3],max[3];
+   int i,j,axis,mid;
+
+   if (hi-lo<=KDTREE_LEAF_SIZE)
+   {
+      /* the leaf is scanned in table order, for the same result as
+	 the full scan when colors are equally close */
+      qsort(colors+lo,hi-lo,sizeof(struct nct_kdcolor),kdcolor_cmp_pos);
+      nodes[node].axis=-1;
+      nodes[node].split=0;
+      nodes[node].a=lo;
+      nodes[node].b=hi-lo;
+      return node;
+   }
+
+   /* split along the axis where the colors are the most spread out */
+   for (j=0; j<3; j++) min[j]=max[j]=colors[lo].c[j];
+   for (i=lo+1; i<hi; i++)
+      for (j=0; j<3; j++)
+	 if (colors[i].c[j]<min[j]) min[j]=colors[i].c[j];
+	 else if (colors[i].c[j]>max[j]) max[j]=colors[i].c[j];
+
+   spread[0]=(INT64)SQ(max[0]-min[0])*(sf.r<0?-sf.r:sf.r);
+   spread[1]=(INT64)SQ(max[1]-min[1])*(sf.g<0?-sf.g:sf.g);
+   spread[2]=(INT64)SQ(max[2]-min[2])*(sf.b<0?-sf.b:sf.b);
+   axis=0;
+   if (spread[1]>spread[axis]) axis=1;
+   if (spread[2]>spread[axis]) axis=2;
+
+   qsort(colors+lo,hi-lo,sizeof(struct nct_kdcolor),cmp[axis]);
+   mid=(lo+hi)/2;
+
+   nodes[node].axis=axis;
+   nodes[node].split=colors[mid].c[axis];
+   nodes[node].a=_build_kdtree_node(nodes,nnodes,colors,lo,mid,sf);
+   nodes[node].b=_build_kdtree_node(nodes,nnodes,colors,mid,hi,sf);
+   return node;
+}
+
+static void build_kdtree(struct neo_colortable *nct)
+{
+   struct nct_flat_entry *fe=nct->u.flat.entries;
+   struct nct_kdcolor *colors;
+   struct nct_kdnode *nodes;
+   ptrdiff_t i;
+   int m=0,nnodes=0;
+
+   for (i=0; i<nct->u.flat.numentries; i++)
+      if (fe[i].no!=-1) m++;
+
+   colors=xalloc(sizeof(struct nct_kdcolor)*(m+1));
+   /* at most one leaf per KDTREE_LEAF_SIZE/2 colors */
+   nodes=malloc(sizeof(struct nct_kdnode)*(4*m/KDTREE_LEAF_SIZE+2));
+   if (!nodes)
+   {
+      free(colors);
+      out_of_memory_error(NULL, -1,
+			  sizeof(struct nct_kdnode)*(4*m/KDTREE_LEAF_SIZE+2));
+   }
+
+   for (i=0,m=0; i<nct->u.flat.numentries; i++)
+      if (fe[i].no!=-1)
+      {
+	 colors[m].c[0]=fe[i].color.r;
+	 colors[m].c[1]=fe[i].color.g;
+	 colors[m].c[2]=fe[i].color.b;
+	 colors[m++].pos=(int)i;
+      }
+
+   _build_kdtree_node(nodes,&nnodes,colors,0,m,nct->spacefactor);
+
+   nct->lu.kdtree.colors=colors;
+   nct->lu.kdtree.nodes=nodes;
+}
+
+static void _nct_kdtree_search(const struct nct_kdnode *nodes,
+			       const struct nct_kdcolor *colors,
+			       int node,const int *c,const int *sf,
+			       int *mindist,int *best)
+{
+   for (;;)
+   {
+      const struct nct_kdnode *nd=nodes+node;
+      int diff;
+
+      if (nd->axis<0)
+      {
+	 const struct nct_kdcolor *kc=colors+nd->a;
+	 int n=nd->b;
+	 while (n--)
+	 {
+	    int dist=
+	       sf[0]*SQ(kc->c[0]-c[0])+
+	       sf[1]*SQ(kc->c[1]-c[1])+
+	       sf[2]*SQ(kc->c[2]-c[2]);
+	    if (dist<*mindist || (dist==*mindist && kc->pos<*best))
+	    {
+	       *mindist=dist;
+	       *best=kc->pos;
+	    }
+	    kc++;
+	 }
+	 return;
+      }
+
+      /* search the near side first, and the far side only if it can
+	 have a color at least as close (ties are broken by position) */
+      diff=c[nd->axis]-nd->split;
+      if (diff<0)
+      {
+	 _nct_kdtree_search(nodes,colors,nd->a,c,sf,mindist,best);
+	 if (sf[nd->axis]*SQ(diff)>*mindist) return;
+	 node=nd->b;
+      }
+      else
+      {
+	 _nct_kdtree_search(nodes,colors,nd->b,c,sf,mindist,best);
+	 if (sf[nd->axis]*SQ(diff)>*mindist) return;
+	 node=nd->a;
+      }
+   }
+}
+
+/* Returns the position in the flat table of the closest color, the
+ * same as _nct_scan_full. */
+static inline int _nct_lookup_kdtree(struct neo_colortable *nct,
+				     int r,int g,int b)
+{
+   int c[3],sf[3];
+   int mindist=0x7fffffff,best=0x7fffffff;
+
+   c[0]=r; c[1]=g; c[2]=b;
+   sf[0]=nct->spacefactor.r;
+   sf[1]=nct->spacefactor.g;
+   sf[2]=nct->spacefactor.b;
+
+   /* the tree can't be pruned with negative factors */
+   if (sf[0]<0 || sf[1]<0 || sf[2]<0)
+      return _nct_scan_full(nct,r,g,b);
+
+   _nct_kdtree_search(nct->lu.kdtree.nodes,nct->lu.kdtree.colors,0,c,sf,
+		      &mindist,&best);
+
+   return best==0x7fffffff?0:best;
+}
+
+/* A part of an image mapped by several threads */
+struct nct_band
+{
+   struct neo_colortable *nct;
+   rgb_group *s;
+   void *d;
+   ptrdiff_t len;
+   int rowlen;
+};
+
 /*
 **! method object map(object image)
 **! method object `*(object image)
@@ -3342,6 +3703,8 @@ void build_rigid(struct neo_colortable *nct)
 #define NCTLU_FLAT_FULL_NAME _img_nct_map_to_flat_full
 #define NCTLU_CUBE_NAME _img_nct_map_to_cube
 #define NCTLU_FLAT_RIGID_NAME _img_nct_map_to_flat_rigid
+#define NCTLU_FLAT_KDTREE_NAME _img_nct_map_to_flat_kdtree
+#define NCTLU_FLAT_BAND_NAME _img_nct_map_to_flat_band
 #define NCTLU_LINE_ARGS (dith,&rowpos,&s,&d,NULL,NULL,NULL,&cd)
 #define NCTLU_RIGID_WRITE (d[0]=feprim[i].color)
 #define NCTLU_DITHER_RIGID_GOT (*d)
@@ -3369,6 +3732,8 @@ void build_rigid(struct neo_colortable *nct)
 #undef NCTLU_CUBE_FAST_WRITE_DITHER_GOT
 #undef NCTLU_RIGID_WRITE
 #undef NCTLU_FLAT_RIGID_NAME
+#undef NCTLU_FLAT_KDTREE_NAME
+#undef NCTLU_FLAT_BAND_NAME
 #undef NCTLU_DITHER_RIGID_GOT
 #undef NCTLU_SELECT_FUNCTION
 #undef NCTLU_EXECUTE_FUNCTION
@@ -3382,6 +3747,8 @@ void build_rigid(struct neo_colortable *nct)
 #define NCTLU_FLAT_FULL_NAME _img_nct_index_8bit_flat_full
 #define NCTLU_CUBE_NAME _img_nct_index_8bit_cube
 #define NCTLU_FLAT_RIGID_NAME _img_nct_index_8bit_flat_rigid
+#define NCTLU_FLAT_KDTREE_NAME _img_nct_index_8bit_flat_kdtree
+#define NCTLU_FLAT_BAND_NAME _img_nct_index_8bit_flat_band
 #define NCTLU_LINE_ARGS (dith,&rowpos,&s,NULL,&d,NULL,NULL,&cd)
 #define NCTLU_RIGID_WRITE (d[0] = (unsigned char)feprim[i].no)
 #define NCTLU_DITHER_RIGID_GOT (feprim[i].color)
@@ -3417,6 +3784,8 @@ void build_rigid(struct neo_colortable *nct)
 #undef NCTLU_CUBE_FAST_WRITE_DITHER_GOT
 #undef NCTLU_RIGID_WRITE
 #undef NCTLU_FLAT_RIGID_NAME
+#undef NCTLU_FLAT_KDTREE_NAME
+#undef NCTLU_FLAT_BAND_NAME
 #undef NCTLU_DITHER_RIGID_GOT
 #undef NCTLU_SELECT_FUNCTION
 #undef NCTLU_EXECUTE_FUNCTION
@@ -3430,6 +3799,8 @@ void build_rigid(struct neo_colortable *nct)
 #define NCTLU_FLAT_FULL_NAME _img_nct_index_16bit_flat_full
 #define NCTLU_CUBE_NAME _img_nct_index_16bit_cube
 #define NCTLU_FLAT_RIGID_NAME _img_nct_index_16bit_flat_rigid
+#define NCTLU_FLAT_KDTREE_NAME _img_nct_index_16bit_flat_kdtree
+#define NCTLU_FLAT_BAND_NAME _img_nct_index_16bit_flat_band
 #define NCTLU_LINE_ARGS (dith,&rowpos,&s,NULL,NULL,&d,NULL,&cd)
 #define NCTLU_RIGID_WRITE (d[0] = (unsigned short)feprim[i].no)
 #define NCTLU_DITHER_RIGID_GOT (feprim[i].color)
@@ -3465,6 +3836,8 @@ void build_rigid(struct neo_colortable *nct)
 #undef NCTLU_CUBE_FAST_WRITE_DITHER_GOT
 #undef NCTLU_RIGID_WRITE
 #undef NCTLU_FLAT_RIGID_NAME
+#undef NCTLU_FLAT_KDTREE_NAME
+#undef NCTLU_FLAT_BAND_NAME
 #undef NCTLU_DITHER_RIGID_GOT
 #undef NCTLU_SELECT_FUNCTION
 #undef NCTLU_EXECUTE_FUNCTION
@@ -3478,6 +3851,8 @@ void build_rigid(struct neo_colortable *nct)
 #define NCTLU_FLAT_FULL_NAME _img_nct_index_32bit_flat_full
 #define NCTLU_CUBE_NAME _img_nct_index_32bit_cube
 #define NCTLU_FLAT_RIGID_NAME _img_nct_index_32bit_flat_rigid
+#define NCTLU_FLAT_KDTREE_NAME _img_nct_index_32bit_flat_kdtree
+#define NCTLU_FLAT_BAND_NAME _img_nct_index_32bit_flat_band
 #define NCTLU_LINE_ARGS (dith,&rowpos,&s,NULL,NULL,NULL,&d,&cd)
 #define NCTLU_RIGID_WRITE (d[0] = (unsigned INT32)feprim[i].no)
 #define NCTLU_DITHER_RIGID_GOT (feprim[i].color)
@@ -3513,6 +3888,8 @@ void build_rigid(struct neo_colortable *nct)
 #undef NCTLU_CUBE_FAST_WRITE_DITHER_GOT
 #undef NCTLU_RIGID_WRITE
 #undef NCTLU_FLAT_RIGID_NAME
+#undef NCTLU_FLAT_KDTREE_NAME
+#undef NCTLU_FLAT_BAND_NAME
 #undef NCTLU_DITHER_RIGID_GOT
 #undef NCTLU_SELECT_FUNCTION
 #undef NCTLU_EXECUTE_FUNCTION
@@ -4524,6 +4901,7 @@ void init_image_colortable(void)
    ADD_FUNCTION("cubicles",image_colortable_cubicles,tOr(tFunc(tNone,tObj),tFunc(tInt tInt tInt tOr(tVoid,tInt),tObj)),0);
    ADD_FUNCTION("rigid",image_colortable_rigid,tOr(tFunc(tNone,tObj),tFunc(tInt tInt tInt,tObj)),0);
    ADD_FUNCTION("full",image_colortable_full,tFunc(tNone,tObj),0);
+   ADD_FUNCTION("kdtree",image_colortable_kdtree,tFunc(tNone,tObj),0);
 
    /* map image */
    /* function(object:object)|function(string,int,int) */
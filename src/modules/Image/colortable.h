@@ -32,6 +32,19 @@ struct nct_flat_entry /* flat colorentry */
    INT32 no;
 };
 
+struct nct_kdnode /* node in the kdtree lookup */
+{
+   int axis;  /* 0, 1 or 2 for red, green or blue; -1 for a leaf */
+   int split; /* left colors are <= split on the axis, right >= */
+   int a,b;   /* left and right child, or first color and number of colors */
+};
+
+struct nct_kdcolor /* color in a kdtree leaf */
+{
+   int c[3];
+   int pos; /* position in the flat table */
+};
+
 struct nct_scale
 {
    struct nct_scale *next;
@@ -56,7 +69,8 @@ struct neo_colortable
    {
       NCT_CUBICLES, /* cubicle lookup */
       NCT_RIGID, /* rigid lookup */
-      NCT_FULL /* scan all values */
+      NCT_FULL, /* scan all values */
+      NCT_KDTREE /* kd tree lookup */
    } lookup_mode;
 
    union
@@ -103,6 +117,17 @@ struct neo_colortable
 	 int r,g,b; /* size */
 	 int *index;
       } rigid;
+      struct nctlu_full
+      {
+	 INT32 n; /* number of colors, padded for image_simd->nearest */
+	 INT16 *planes; /* red, green and blue planes; NULL if not initiated */
+	 int *pos; /* position in the flat table */
+      } full;
+      struct nctlu_kdtree
+      {
+	 struct nct_kdnode *nodes; /* NULL if not initiated, root is 0 */
+	 struct nct_kdcolor *colors;
+      } kdtree;
    } lu;
 
    enum nct_dither_type
@@ -155,10 +155,6 @@ void NCTLU_FLAT_FULL_NAME(rgb_group *s,
 			  struct nct_dither *dith,
 			  int rowlen)
 {
-   /* no need to build any data, we're using full scan */
-
-   rgbl_group sf=nct->spacefactor;
-   ptrdiff_t mprim=nct->u.flat.numentries;
    struct nct_flat_entry *feprim=nct->u.flat.entries;
 
    nct_dither_encode_function *dither_encode=dith->encode;
@@ -166,6 +162,12 @@ void NCTLU_FLAT_FULL_NAME(rgb_group *s,
    nct_dither_line_function *dither_newline=dith->newline;
    int rowpos=0,cd=1,rowcount=0;
 
+   if (!nct->lu.full.planes)
+   {
+      CHRONO("init flat/full map");
+      build_full(nct);
+   }
+
    CHRONO("begin flat/full map");
 
    if (dith->firstline)
@@ -174,9 +176,7 @@ void NCTLU_FLAT_FULL_NAME(rgb_group *s,
    while (n--)
    {
       int rgbr,rgbg,rgbb;
-      int mindist;
-      ptrdiff_t m;
-      struct nct_flat_entry *fe;
+      int i;
       struct lookupcache *lc;
 
       if (dither_encode)
@@ -207,30 +207,10 @@ void NCTLU_FLAT_FULL_NAME(rgb_group *s,
 
       lc->src=*s;
 
-      mindist=256*256*100; /* max dist is 256^2*3 */
-
-      fe=feprim;
-      m=mprim;
-
-      while (m--)
-	 if (fe->no!=-1)
-	 {
-	    int dist=
-	       sf.r*SQ(fe->color.r-rgbr)+
-	       sf.g*SQ(fe->color.g-rgbg)+
-	       sf.b*SQ(fe->color.b-rgbb);
-
-	    if (dist<mindist)
-	    {
-	       lc->dest=fe->color;
-	       mindist=dist;
-               lc->index = (int)fe->no;
-	       NCTLU_CACHE_HIT_WRITE;
-	    }
-
-	    fe++;
-	 }
-	 else fe++;
+      i=_nct_lookup_full(nct,rgbr,rgbg,rgbb);
+      lc->dest=feprim[i].color;
+      lc->index=(int)feprim[i].no;
+      NCTLU_CACHE_HIT_WRITE;
 
 done_pixel:
       if (dither_encode)
@@ -330,6 +310,126 @@ void NCTLU_FLAT_RIGID_NAME(rgb_group *s,
    CHRONO("end flat/rigid map");
 }
 
+void NCTLU_FLAT_KDTREE_NAME(rgb_group *s,
+			    NCTLU_DESTINATION *d,
+			    int n,
+			    struct neo_colortable *nct,
+			    struct nct_dither *dith,
+			    int rowlen)
+{
+   struct nct_flat_entry *feprim=nct->u.flat.entries;
+
+   nct_dither_encode_function *dither_encode=dith->encode;
+   nct_dither_got_function *dither_got=dith->got;
+   nct_dither_line_function *dither_newline=dith->newline;
+   int rowpos=0,cd=1,rowcount=0;
+
+   if (!nct->lu.kdtree.nodes)
+   {
+      CHRONO("init flat/kdtree map");
+      build_kdtree(nct);
+   }
+
+   CHRONO("begin flat/kdtree map");
+
+   if (dith->firstline)
+      (dith->firstline)NCTLU_LINE_ARGS;
+
+   while (n--)
+   {
+      rgbl_group val;
+      int i;
+      struct lookupcache *lc;
+
+      if (dither_encode)
+      {
+	 val=dither_encode(dith,rowpos,*s);
+      }
+      else
+      {
+	 val.r=s->r;
+	 val.g=s->g;
+	 val.b=s->b;
+      }
+
+      /* cached? */
+      lc=nct->lookupcachehash+COLORLOOKUPCACHEHASHVALUE(val.r,val.g,val.b);
+      if (lc->index!=-1 &&
+	  lc->src.r==val.r &&
+	  lc->src.g==val.g &&
+	  lc->src.b==val.b)
+      {
+	 NCTLU_CACHE_HIT_WRITE;
+	 goto done_pixel;
+      }
+
+      lc->src=*s;
+
+      i=_nct_lookup_kdtree(nct,val.r,val.g,val.b);
+      lc->dest=feprim[i].color;
+      lc->index=(int)feprim[i].no;
+      NCTLU_CACHE_HIT_WRITE;
+
+done_pixel:
+      if (dither_encode)
+      {
+         if (dither_got)
+	   dither_got(dith,rowpos,*s,NCTLU_DITHER_GOT);
+	 s+=cd; d+=cd; rowpos+=cd;
+	 if (++rowcount==rowlen)
+	 {
+	    rowcount=0;
+	    if (dither_newline)
+	       (dither_newline)NCTLU_LINE_ARGS;
+	 }
+      }
+      else
+      {
+	 d++;
+	 s++;
+      }
+   }
+
+   CHRONO("end flat/kdtree map");
+}
+
+/* Maps the rows start..end-1 of a struct nct_band without dither or
+ * the lookup cache, for image_parallel_rows. */
+static void NCTLU_FLAT_BAND_NAME(void *data,INT32 start,INT32 end)
+{
+   struct nct_band *band=data;
+   struct neo_colortable *nct=band->nct;
+   struct nct_flat_entry *feprim=nct->u.flat.entries;
+   ptrdiff_t x0=(ptrdiff_t)start*band->rowlen;
+   ptrdiff_t x1=MINIMUM((ptrdiff_t)end*band->rowlen,band->len);
+   rgb_group *s=band->s+x0;
+   NCTLU_DESTINATION *d=(NCTLU_DESTINATION *)band->d+x0;
+   int kdtree=(nct->lookup_mode==NCT_KDTREE);
+   rgb_group last;
+   int i=0;
+
+   if (x0>=x1) return;
+
+   /* neighbouring pixels are often the same */
+   last=*s;
+   last.r^=1;
+
+   while (x0++<x1)
+   {
+      if (s->r!=last.r || s->g!=last.g || s->b!=last.b)
+      {
+	 last=*s;
+	 if (kdtree)
+	    i=_nct_lookup_kdtree(nct,s->r,s->g,s->b);
+	 else
+	    i=_nct_lookup_full(nct,s->r,s->g,s->b);
+      }
+      NCTLU_RIGID_WRITE;
+      d++;
+      s++;
+   }
+}
+
 void NCTLU_CUBE_NAME(rgb_group *s,
 		     NCTLU_DESTINATION *d,
 		     int n,
@@ -557,6 +657,14 @@ void (*NCTLU_SELECT_FUNCTION(struct neo_colortable *nct))
 		      DEFINETOSTR(NCTLU_FLAT_CUBICLES_NAME) "\n");
 #endif /* COLORTABLE_DEBUG */
 	       return &NCTLU_FLAT_CUBICLES_NAME;
+	    case NCT_KDTREE:
+#ifdef COLORTABLE_DEBUG
+	      fprintf(stderr,
+		      "COLORTABLE " DEFINETOSTR(NCTLU_SELECT_FUNCTION) ":"
+		      DEFINETOSTR(NCTLU_DESTINATION) " => "
+		      DEFINETOSTR(NCTLU_FLAT_KDTREE_NAME) "\n");
+#endif /* COLORTABLE_DEBUG */
+	       return &NCTLU_FLAT_KDTREE_NAME;
 	 }
 	 /* FALLTHRU */
 
@@ -577,6 +685,36 @@ int NCTLU_EXECUTE_FUNCTION(struct neo_colortable *nct,
 
    if (nct->type==NCT_NONE) return 0;
 
+   /* The exact lookups without dither don't depend on earlier
+      pixels, so the image can be split between threads. */
+   if (nct->type==NCT_FLAT && nct->dither_type==NCTD_NONE &&
+       (nct->lookup_mode==NCT_FULL || nct->lookup_mode==NCT_KDTREE) &&
+       rowlen>0 &&
+       image_parallel_bands((len+rowlen-1)/rowlen,len)>1)
+   {
+      struct nct_band band;
+
+      if (nct->lookup_mode==NCT_KDTREE)
+      {
+	 if (!nct->lu.kdtree.nodes) build_kdtree(nct);
+      }
+      else if (!nct->lu.full.planes)
+	 build_full(nct);
+
+      band.nct=nct;
+      band.s=s;
+      band.d=d;
+      band.len=len;
+      band.rowlen=rowlen;
+
+      THREADS_ALLOW();
+      image_parallel_rows(NCTLU_FLAT_BAND_NAME,&band,
+			  (len+rowlen-1)/rowlen,len);
+      THREADS_DISALLOW();
+
+      return 1;
+   }
+
    image_colortable_initiate_dither(nct,&dith,rowlen);
    (NCTLU_SELECT_FUNCTION(nct))(s,d,len,nct,&dith,rowlen);
    image_colortable_free_dither(&dith);
@@ -59,6 +59,9 @@ static struct pike_string *param_background;
 static struct pike_string *param_zlevel;
 static struct pike_string *param_zstrategy;
 
+static struct program *png_decoder_program;
+static struct program *png_encoder_program;
+
 /*! @module Image
  */
 
@@ -1927,6 +1930,1006 @@ static void image_png_decode_alpha(INT32 args)
    free_svalue(&s);
 }
 
+/*** streaming decoder and encoder ***************************************/
+
+/* As in zlib.h */
+#define PNG_Z_NO_FLUSH 0
+#define PNG_Z_FINISH   4
+
+/* Largest piece of compressed data handed to inflate at a time. */
+#define PNG_INFLATE_PIECE 65536
+
+/* Size at which compressed data is written out as an IDAT chunk. */
+#define PNG_IDAT_SIZE 65536
+
+static inline int png_paeth(int a,int b,int c)
+{
+   int p=a+b-c;
+   int pa=abs(p-a), pb=abs(p-b), pc=abs(p-c);
+   if (pa<=pb && pa<=pc) return a;
+   if (pb<=pc) return b;
+   return c;
+}
+
+/* Unfilters one row of len bytes from s into d. prev is the previous
+ * unfiltered row, all zero for the first row of an image or pass. */
+static void _png_unfilter_row(unsigned char *d,const unsigned char *s,
+			      const unsigned char *prev,size_t len,
+			      int sbb,int filter)
+{
+   size_t i;
+
+   switch (filter)
+   {
+      case 0: /* no filter */
+	 memcpy(d,s,len);
+	 break;
+      case 1: /* sub left */
+	 for (i=0; i<len; i++)
+	    d[i]=s[i]+(i>=(size_t)sbb?d[i-sbb]:0);
+	 break;
+      case 2: /* sub up */
+	 for (i=0; i<len; i++)
+	    d[i]=s[i]+prev[i];
+	 break;
+      case 3: /* average */
+	 for (i=0; i<len; i++)
+	    d[i]=s[i]+(((i>=(size_t)sbb?d[i-sbb]:0)+prev[i])>>1);
+	 break;
+      case 4: /* paeth */
+	 for (i=0; i<len; i++)
+	    if (i>=(size_t)sbb)
+	       d[i]=s[i]+png_paeth(d[i-sbb],prev[i],prev[i-sbb]);
+	    else
+	       d[i]=s[i]+prev[i];
+	 break;
+      default:
+	 Pike_error("Unsupported subfilter %d.\n",filter);
+   }
+}
+
+/* Filters one row of len bytes from s into d, the inverse of
+ * _png_unfilter_row. */
+static void _png_filter_row(unsigned char *d,const unsigned char *s,
+			    const unsigned char *prev,size_t len,
+			    int sbb,int filter)
+{
+   size_t i;
+
+   switch (filter)
+   {
+      case 0:
+	 memcpy(d,s,len);
+	 break;
+      case 1:
+	 for (i=0; i<len; i++)
+	    d[i]=s[i]-(i>=(size_t)sbb?s[i-sbb]:0);
+	 break;
+      case 2:
+	 for (i=0; i<len; i++)
+	    d[i]=s[i]-prev[i];
+	 break;
+      case 3:
+	 for (i=0; i<len; i++)
+	    d[i]=s[i]-(((i>=(size_t)sbb?s[i-sbb]:0)+prev[i])>>1);
+	 break;
+      case 4:
+	 for (i=0; i<len; i++)
+	    if (i>=(size_t)sbb)
+	       d[i]=s[i]-png_paeth(s[i-sbb],prev[i],prev[i-sbb]);
+	    else
+	       d[i]=s[i]-prev[i];
+	 break;
+   }
+}
+
+static void png_buffer_chunk(struct byte_buffer *b,const char *type,
+			     const unsigned char *data,size_t len)
+{
+   unsigned INT32 crc;
+
+   crc=crc32(0,(unsigned char*)type,4);
+   if (len) crc=crc32(crc,(unsigned char*)data,(unsigned INT32)len);
+
+   buffer_add_be32(b,(unsigned INT32)len);
+   buffer_memcpy(b,type,4);
+   if (len) buffer_memcpy(b,data,len);
+   buffer_add_be32(b,crc);
+}
+
+/* Clones Gz.inflate or Gz.deflate with the nargs arguments a and b. */
+static struct object *png_zlib_object(const char *name,int nargs,
+				      INT_TYPE a,INT_TYPE b)
+{
+   struct object *o;
+
+   push_text(name);
+   SAFE_APPLY_MASTER("resolv",1);
+   if (TYPEOF(sp[-1]) != T_PROGRAM)
+      Pike_error("Failed to resolve %s.\n",name);
+   if (nargs>0) push_int(a);
+   if (nargs>1) push_int(b);
+   apply_svalue(sp-1-nargs,nargs);
+   if (TYPEOF(sp[-1]) != T_OBJECT)
+      Pike_error("Failed to create %s object.\n",name);
+   add_ref(o=sp[-1].u.object);
+   pop_n_elems(2+nargs);
+   return o;
+}
+
+/*! @class Decoder
+ *!   Incremental PNG decoder.
+ *!
+ *!   The PNG data is given to @[feed] in pieces of any size, and the
+ *!   rows that have been decoded so far are fetched with @[read].
+ *!   Neither the compressed nor the decompressed image is kept in
+ *!   memory as a whole, only the rows that haven't been read yet.
+ *!
+ *!   Interlaced images can't be decoded row by row. For them all
+ *!   rows become available at once, when the last pass has been
+ *!   decoded.
+ *!
+ *! @example
+ *! @code
+ *!   Image.PNG.Decoder dec = Image.PNG.Decoder();
+ *!   while (string data = f->read(65536)) {
+ *!     dec->feed(data);
+ *!     while (mapping band = dec->read())
+ *!       out->paste(band->image, 0, band->y);
+ *!   }
+ *! @endcode
+ *!
+ *! @seealso
+ *!   @[decode], @[Encoder]
+ */
+
+enum png_decoder_state
+{
+   PNG_DEC_SIGNATURE,
+   PNG_DEC_HEADER,	/* chunk length and type */
+   PNG_DEC_CHUNK,	/* data and crc of a chunk other than IDAT */
+   PNG_DEC_IDAT,	/* data of an IDAT chunk */
+   PNG_DEC_CRC,		/* crc of an IDAT chunk */
+   PNG_DEC_END,
+   PNG_DEC_FAILED
+};
+
+struct png_decoder
+{
+   enum png_decoder_state state;
+   unsigned INT32 chunk_type;
+   size_t chunk_left;
+   unsigned INT32 crc;		/* of the current chunk so far */
+
+   struct byte_buffer in;	/* input not yet parsed */
+   struct byte_buffer raw;	/* inflated data not yet unfiltered */
+   struct byte_buffer rows;	/* decoded rows not yet read */
+   struct byte_buffer arows;	/* and their alpha */
+
+   struct IHDR ihdr;
+   int got_ihdr, got_alpha, channels;
+   struct object *inflate;
+   struct object *palette;
+   struct pike_string *trns;
+
+   int pass;			/* adam7 pass, or 0 if not interlaced */
+   unsigned INT32 pass_y, pass_width, pass_height;
+   size_t row_bytes;
+   unsigned char *prev, *cur;	/* unfiltered rows */
+   rgb_group *row, *arow;	/* the current row as rgb */
+   rgb_group *full, *afull;	/* the image, if interlaced */
+
+   INT32 y;			/* rows decoded */
+   INT32 y_read;		/* rows read */
+};
+
+#define THIS_DEC ((struct png_decoder *)(Pike_fp->current_storage))
+
+static void init_png_decoder(struct object *UNUSED(o))
+{
+   struct png_decoder *this=THIS_DEC;
+   memset(this,0,sizeof(*this));
+   buffer_init(&this->in);
+   buffer_init(&this->raw);
+   buffer_init(&this->rows);
+   buffer_init(&this->arows);
+}
+
+static void exit_png_decoder(struct object *UNUSED(o))
+{
+   struct png_decoder *this=THIS_DEC;
+   buffer_free(&this->in);
+   buffer_free(&this->raw);
+   buffer_free(&this->rows);
+   buffer_free(&this->arows);
+   if (this->inflate) free_object(this->inflate);
+   if (this->palette) free_object(this->palette);
+   if (this->trns) free_string(this->trns);
+   free_and_clear((void**)&this->prev);
+   free_and_clear((void**)&this->cur);
+   free_and_clear((void**)&this->row);
+   free_and_clear((void**)&this->arow);
+   free_and_clear((void**)&this->full);
+   free_and_clear((void**)&this->afull);
+}
+
+/* Sets up the row geometry of the current pass, skipping empty
+ * passes. Returns 0 when there are no passes left. */
+static int png_decoder_start_pass(struct png_decoder *this)
+{
+   for (;;)
+   {
+      if (this->ihdr.interlace)
+      {
+	 const struct png_interlace *il;
+	 if (this->pass>=7) return 0;
+	 il=adam7+this->pass;
+	 this->pass_width=(this->ihdr.width+il->xd-1-il->x0)/il->xd;
+	 this->pass_height=(this->ihdr.height+il->yd-1-il->y0)/il->yd;
+      }
+      else
+      {
+	 if (this->pass) return 0;
+	 this->pass_width=this->ihdr.width;
+	 this->pass_height=this->ihdr.height;
+      }
+      this->pass_y=0;
+      if (this->pass_width && this->pass_height) break;
+      this->pass++;
+   }
+
+   this->row_bytes=((size_t)this->pass_width*this->ihdr.bpp*
+		    this->channels+7)>>3;
+   memset(this->prev,0,this->row_bytes);
+   return 1;
+}
+
+static void png_decoder_start_idat(struct png_decoder *this)
+{
+   struct IHDR *ihdr=&this->ihdr;
+   size_t row_bytes,npixels;
+
+   switch (ihdr->type)
+   {
+      case 0: this->channels=1; this->got_alpha=this->trns && this->trns->len==2;
+	 break;
+      case 2: this->channels=3; this->got_alpha=this->trns && this->trns->len==6;
+	 break;
+      case 3: this->channels=1; this->got_alpha=!!this->trns;
+	 if (!this->palette)
+	    Pike_error("Image.PNG.Decoder: Missing palette (PLTE chunk).\n");
+	 break;
+      case 4: this->channels=2; this->got_alpha=1; break;
+      case 6: this->channels=4; this->got_alpha=1; break;
+   }
+
+   row_bytes=((size_t)ihdr->width*ihdr->bpp*this->channels+7)>>3;
+   this->prev=xalloc(row_bytes+1);
+   this->cur=xalloc(row_bytes+1);
+   this->row=xalloc(sizeof(rgb_group)*ihdr->width+RGB_VEC_PAD);
+   if (this->got_alpha)
+      this->arow=xalloc(sizeof(rgb_group)*ihdr->width+RGB_VEC_PAD);
+
+   if (ihdr->interlace)
+   {
+      if (INT32_MUL_OVERFLOW(ihdr->width, ihdr->height) ||
+	  ihdr->width*ihdr->height > (0x7fffffff - RGB_VEC_PAD)/sizeof(rgb_group))
+	 Pike_error("Image.PNG.Decoder: Image too large (%d * %d)\n",
+		    ihdr->width, ihdr->height);
+      npixels=(size_t)ihdr->width*ihdr->height;
+      this->full=xalloc(sizeof(rgb_group)*npixels+RGB_VEC_PAD);
+      if (this->got_alpha)
+	 this->afull=xalloc(sizeof(rgb_group)*npixels+RGB_VEC_PAD);
+   }
+
+   this->inflate=png_zlib_object("Gz.inflate",0,0,0);
+   this->pass=0;
+   png_decoder_start_pass(this);
+}
+
+/* Unfilters and converts the complete rows in the raw buffer. */
+static void png_decoder_rows(struct png_decoder *this)
+{
+   struct neo_colortable *ct=NULL;
+   unsigned char *s=buffer_ptr(&this->raw);
+   size_t len=buffer_content_length(&this->raw);
+   int sbb=(this->ihdr.bpp*this->channels+7)>>3;
+
+   if (this->palette)
+      ct=get_storage(this->palette,image_colortable_program);
+
+   while (this->pass_height && len>this->row_bytes)
+   {
+      unsigned char *t;
+      rgb_group *d=this->row, *da=this->arow;
+
+      _png_unfilter_row(this->cur,s+1,this->prev,this->row_bytes,sbb,*s);
+      s+=this->row_bytes+1;
+      len-=this->row_bytes+1;
+
+      _png_write_rgb(d,da,this->ihdr.type,this->ihdr.bpp,
+		     this->cur,this->row_bytes,
+		     this->pass_width,this->pass_width,ct,this->trns);
+
+      if (!this->ihdr.interlace)
+      {
+	 buffer_memcpy(&this->rows,d,sizeof(rgb_group)*this->pass_width);
+	 if (da)
+	    buffer_memcpy(&this->arows,da,sizeof(rgb_group)*this->pass_width);
+	 this->y++;
+      }
+      else
+      {
+	 const struct png_interlace *il=adam7+this->pass;
+	 size_t x, n=this->pass_width;
+	 size_t o=(il->y0+(size_t)this->pass_y*il->yd)*this->ihdr.width+il->x0;
+	 for (x=0; x<n; x++, o+=il->xd)
+	 {
+	    this->full[o]=d[x];
+	    if (da) this->afull[o]=da[x];
+	 }
+      }
+
+      t=this->prev; this->prev=this->cur; this->cur=t;
+
+      if (++this->pass_y==this->pass_height)
+      {
+	 this->pass++;
+	 if (!png_decoder_start_pass(this))
+	 {
+	    this->pass_height=0;
+	    if (this->ihdr.interlace)
+	    {
+	       size_t n=sizeof(rgb_group)*this->ihdr.width*this->ihdr.height;
+	       buffer_memcpy(&this->rows,this->full,n);
+	       free_and_clear((void**)&this->full);
+	       if (this->afull)
+	       {
+		  buffer_memcpy(&this->arows,this->afull,n);
+		  free_and_clear((void**)&this->afull);
+	       }
+	       this->y=this->ihdr.height;
+	    }
+	 }
+      }
+   }
+
+   /* Keep the incomplete row, but drop anything after the last. */
+   if (!this->pass_height) len=0;
+   memmove(buffer_ptr(&this->raw),s,len);
+   buffer_clear(&this->raw);
+   buffer_advance(&this->raw,len);
+}
+
+static void png_decoder_inflate(struct png_decoder *this,
+				const unsigned char *data,size_t len)
+{
+   while (len)
+   {
+      size_t n=MINIMUM(len,PNG_INFLATE_PIECE);
+      push_string(make_shared_binary_string((const char*)data,n));
+      apply(this->inflate,"inflate",1);
+      if (TYPEOF(sp[-1]) == T_STRING)
+	 buffer_memcpy(&this->raw,sp[-1].u.string->str,sp[-1].u.string->len);
+      pop_stack();
+      png_decoder_rows(this);
+      data+=n;
+      len-=n;
+   }
+}
+
+static void png_decoder_chunk(struct png_decoder *this,
+			      const unsigned char *data,size_t len)
+{
+   switch (this->chunk_type)
+   {
+      case 0x49484452: /* IHDR */
+	 if (this->got_ihdr || len!=13)
+	    Pike_error("Image.PNG.Decoder: Illegal header (IHDR chunk).\n");
+	 this->ihdr.width=int_from_32bit(data+0);
+	 this->ihdr.height=int_from_32bit(data+4);
+	 this->ihdr.bpp=data[8];
+	 this->ihdr.type=data[9];
+	 this->ihdr.compression=data[10];
+	 this->ihdr.filter=data[11];
+	 this->ihdr.interlace=data[12];
+	 if (!this->ihdr.width || !this->ihdr.height ||
+	     this->ihdr.width>0x7fffffff || this->ihdr.height>0x7fffffff)
+	    Pike_error("Image.PNG.Decoder: Invalid dimensions in IHDR chunk.\n");
+	 switch (this->ihdr.type*32+this->ihdr.bpp)
+	 {
+	    case 0*32+1: case 0*32+2: case 0*32+4: case 0*32+8: case 0*32+16:
+	    case 2*32+8: case 2*32+16:
+	    case 3*32+1: case 3*32+2: case 3*32+4: case 3*32+8:
+	    case 4*32+8: case 4*32+16:
+	    case 6*32+8: case 6*32+16:
+	       break;
+	    default:
+	       Pike_error("Image.PNG.Decoder: Unsupported color type/bit "
+			  "depth %d/%d bit.\n",this->ihdr.type,this->ihdr.bpp);
+	 }
+	 if (this->ihdr.compression)
+	    Pike_error("Image.PNG.Decoder: Illegal compression style %d.\n",
+		       this->ihdr.compression);
+	 if (this->ihdr.filter)
+	    Pike_error("Image.PNG.Decoder: Unknown filter type %d.\n",
+		       this->ihdr.filter);
+	 if (this->ihdr.interlace>1)
+	    Pike_error("Image.PNG.Decoder: Unknown interlace type %d.\n",
+		       this->ihdr.interlace);
+	 this->got_ihdr=1;
+	 break;
+
+      case 0x504c5445: /* PLTE */
+	 if (this->palette || this->ihdr.type!=3) break;
+	 push_string(make_shared_binary_string((const char*)data,len));
+	 push_object(clone_object(image_colortable_program,1));
+	 add_ref(this->palette=sp[-1].u.object);
+	 pop_stack();
+	 if (!((struct neo_colortable *)
+	       get_storage(this->palette,image_colortable_program))
+	     ->u.flat.numentries)
+	    Pike_error("Image.PNG.Decoder: Palette is zero entries long;"
+		       " need at least one color.\n");
+	 break;
+
+      case 0x74524e53: /* tRNS */
+	 if (this->trns || this->inflate) break;
+	 this->trns=make_shared_binary_string((const char*)data,len);
+	 break;
+
+      case 0x49454e44: /* IEND */
+	 this->state=PNG_DEC_END;
+	 break;
+   }
+}
+
+static void png_decoder_parse(struct png_decoder *this)
+{
+   unsigned char *p=buffer_ptr(&this->in);
+   size_t len=buffer_content_length(&this->in), pos=0;
+
+   while (this->state!=PNG_DEC_END)
+   {
+      size_t left=len-pos;
+
+      switch (this->state)
+      {
+	 case PNG_DEC_SIGNATURE:
+	    if (left<8) goto done;
+	    if (memcmp(p+pos,"\211PNG\r\n\032\n",8))
+	       Pike_error("Image.PNG.Decoder: Not PNG data.\n");
+	    pos+=8;
+	    this->state=PNG_DEC_HEADER;
+	    break;
+
+	 case PNG_DEC_HEADER:
+	    if (left<8) goto done;
+	    this->chunk_left=int_from_32bit(p+pos);
+	    this->chunk_type=int_from_32bit(p+pos+4);
+	    this->crc=crc32(crc32(0,NULL,0),p+pos+4,4);
+	    pos+=8;
+	    if (this->chunk_left>0x7fffffff)
+	       Pike_error("Image.PNG.Decoder: Illegal chunk length.\n");
+	    if (!this->got_ihdr && this->chunk_type!=0x49484452)
+	       Pike_error("Image.PNG.Decoder: First chunk isn't IHDR.\n");
+	    if (this->chunk_type==0x49444154) /* IDAT */
+	    {
+	       if (!this->inflate) png_decoder_start_idat(this);
+	       this->state=PNG_DEC_IDAT;
+	    }
+	    else
+	       this->state=PNG_DEC_CHUNK;
+	    break;
+
+	 case PNG_DEC_CHUNK:
+	    if (left<this->chunk_left+4) goto done;
+	    if (crc32(this->crc,p+pos,(unsigned INT32)this->chunk_left)!=
+		int_from_32bit(p+pos+this->chunk_left))
+	       Pike_error("Image.PNG.Decoder: Checksum mismatch.\n");
+	    this->state=PNG_DEC_HEADER;
+	    png_decoder_chunk(this,p+pos,this->chunk_left);
+	    pos+=this->chunk_left+4;
+	    break;
+
+	 case PNG_DEC_IDAT:
+	 {
+	    size_t n=MINIMUM(left,this->chunk_left);
+	    if (n)
+	    {
+	       this->crc=crc32(this->crc,p+pos,(unsigned INT32)n);
+	       png_decoder_inflate(this,p+pos,n);
+	    }
+	    pos+=n;
+	    this->chunk_left-=n;
+	    if (this->chunk_left) goto done;
+	    this->state=PNG_DEC_CRC;
+	    break;
+	 }
+
+	 case PNG_DEC_CRC:
+	    if (left<4) goto done;
+	    if (this->crc!=int_from_32bit(p+pos))
+	       Pike_error("Image.PNG.Decoder: Checksum mismatch.\n");
+	    pos+=4;
+	    this->state=PNG_DEC_HEADER;
+	    break;
+
+	 default:
+	    goto done;
+      }
+   }
+   /* Anything after IEND is ignored. */
+   pos=len;
+
+done:
+   memmove(p,p+pos,len-pos);
+   buffer_remove(&this->in,pos);
+}
+
+static void png_decoder_fail(struct png_decoder *this)
+{
+   this->state=PNG_DEC_FAILED;
+}
+
+/*! @decl void feed(string(8bit)|Stdio.Buffer data)
+ *!   Decodes the next part of the PNG data. If @[data] is a
+ *!   @[Stdio.Buffer] all its contents are consumed.
+ *!
+ *!   The decoded rows can then be fetched with @[read].
+ *!
+ *! @throws
+ *!   Throws an error if the data isn't valid PNG data. The decoder
+ *!   can't be used after an error.
+ */
+static void image_png_decoder_feed(INT32 args)
+{
+   struct png_decoder *this=THIS_DEC;
+   struct pike_string *str;
+
+   if (args!=1)
+      SIMPLE_WRONG_NUM_ARGS_ERROR("feed",1);
+   if (TYPEOF(sp[-1]) == T_OBJECT)
+   {
+      apply(sp[-1].u.object,"read",0);
+      stack_swap();
+      pop_stack();
+   }
+   if (TYPEOF(sp[-1]) != T_STRING || sp[-1].u.string->size_shift)
+      SIMPLE_ARG_TYPE_ERROR("feed",1,"string(8bit)|Stdio.Buffer");
+
+   if (this->state==PNG_DEC_FAILED)
+      Pike_error("Image.PNG.Decoder: Decoder failed earlier.\n");
+
+   str=sp[-1].u.string;
+   if (this->state!=PNG_DEC_END)
+   {
+      ONERROR err;
+      buffer_memcpy(&this->in,str->str,str->len);
+      SET_ONERROR(err,png_decoder_fail,this);
+      png_decoder_parse(this);
+      UNSET_ONERROR(err);
+   }
+
+   pop_stack();
+}
+
+/*! @decl mapping(string:int|Image.Image) read()
+ *!   Returns the rows decoded since the last call, or @expr{0@}
+ *!   (zero) if there are none.
+ *!
+ *! @returns
+ *!   @mapping
+ *!     @member int "y"
+ *!       The row in the whole image of the first row.
+ *!     @member Image.Image "image"
+ *!       The rows.
+ *!     @member Image.Image "alpha"
+ *!       The alpha channel of the rows, if the image has one.
+ *!   @endmapping
+ */
+static void image_png_decoder_read(INT32 args)
+{
+   struct png_decoder *this=THIS_DEC;
+   struct image *img;
+   INT32 n;
+
+   pop_n_elems(args);
+
+   n=this->y-this->y_read;
+   if (!n)
+   {
+      push_undefined();
+      return;
+   }
+
+   push_static_text("y");
+   push_int(this->y_read);
+
+   ref_push_string(param_image);
+   push_object(clone_object(image_program,0));
+   img=get_storage(sp[-1].u.object,image_program);
+   buffer_ensure_space(&this->rows,RGB_VEC_PAD);
+   if (img->img) free(img->img);
+   img->xsize=this->ihdr.width;
+   img->ysize=n;
+   img->img=buffer_ptr(&this->rows);
+   buffer_init(&this->rows);
+
+   if (this->got_alpha)
+   {
+      ref_push_string(param_alpha);
+      push_object(clone_object(image_program,0));
+      img=get_storage(sp[-1].u.object,image_program);
+      buffer_ensure_space(&this->arows,RGB_VEC_PAD);
+      if (img->img) free(img->img);
+      img->xsize=this->ihdr.width;
+      img->ysize=n;
+      img->img=buffer_ptr(&this->arows);
+      buffer_init(&this->arows);
+   }
+
+   this->y_read=this->y;
+   f_aggregate_mapping(this->got_alpha?6:4);
+}
+
+/*! @decl mapping(string:int) header()
+ *!   Returns the header of the image, or @expr{0@} (zero) if the
+ *!   header hasn't been decoded yet.
+ *!
+ *! @returns
+ *!   @mapping
+ *!     @member int "xsize"
+ *!     @member int "ysize"
+ *!       Image dimensions.
+ *!     @member int "type"
+ *!       Image color type, as for @[_decode].
+ *!     @member int "bpp"
+ *!       Number of bitplanes.
+ *!     @member int(0..1) "interlace"
+ *!       1 if the image is interlaced.
+ *!   @endmapping
+ */
+static void image_png_decoder_header(INT32 args)
+{
+   struct png_decoder *this=THIS_DEC;
+
+   pop_n_elems(args);
+   if (!this->got_ihdr)
+   {
+      push_undefined();
+      return;
+   }
+   push_static_text("xsize");
+   push_int(this->ihdr.width);
+   push_static_text("ysize");
+   push_int(this->ihdr.height);
+   ref_push_string(literal_type_string);
+   push_int(this->ihdr.type);
+   ref_push_string(param_bpp);
+   push_int(this->ihdr.bpp);
+   push_static_text("interlace");
+   push_int(this->ihdr.interlace);
+   f_aggregate_mapping(10);
+}
+
+/*! @decl int(0..1) finished()
+ *!   Returns 1 when the end of the PNG data has been reached and
+ *!   all rows have been decoded.
+ */
+static void image_png_decoder_finished(INT32 args)
+{
+   struct png_decoder *this=THIS_DEC;
+   pop_n_elems(args);
+   push_int(this->state==PNG_DEC_END && this->got_ihdr &&
+	    this->y==(INT32)this->ihdr.height);
+}
+
+/*! @endclass
+ */
+
+/*! @class Encoder
+ *!   Incremental PNG encoder.
+ *!
+ *!   The image is given to @[encode_rows] in bands of rows from the
+ *!   top down. Every row is filtered and compressed as it arrives,
+ *!   and the encoded data is returned as soon as it's available, so
+ *!   the whole image never has to be in memory.
+ *!
+ *! @example
+ *! @code
+ *!   Image.PNG.Encoder enc = Image.PNG.Encoder(xsize, ysize);
+ *!   for (int y = 0; y < ysize; y += 64)
+ *!     f->write(enc->encode_rows(get_band(y, 64)));
+ *!   f->write(enc->finish());
+ *! @endcode
+ *!
+ *! @seealso
+ *!   @[encode], @[Decoder]
+ */
+
+struct png_encoder
+{
+   struct object *deflate;
+   struct byte_buffer out;	/* encoded data not yet returned */
+   struct byte_buffer idat;	/* compressed data not yet in a chunk */
+   INT32 xsize, ysize, y;
+   int alpha;
+   int filter;			/* -1 for adaptive */
+   size_t row_bytes;
+   unsigned char *prev, *cur, *best, *trial;
+};
+
+#define THIS_ENC ((struct png_encoder *)(Pike_fp->current_storage))
+
+static void init_png_encoder(struct object *UNUSED(o))
+{
+   struct png_encoder *this=THIS_ENC;
+   memset(this,0,sizeof(*this));
+   buffer_init(&this->out);
+   buffer_init(&this->idat);
+}
+
+static void exit_png_encoder(struct object *UNUSED(o))
+{
+   struct png_encoder *this=THIS_ENC;
+   if (this->deflate) free_object(this->deflate);
+   buffer_free(&this->out);
+   buffer_free(&this->idat);
+   free_and_clear((void**)&this->prev);
+   free_and_clear((void**)&this->cur);
+   free_and_clear((void**)&this->best);
+   free_and_clear((void**)&this->trial);
+}
+
+/*! @decl void create(int(1..) xsize, int(1..) ysize, @
+ *!                   void|mapping(string:int) options)
+ *!   Starts encoding an image of @[xsize] x @[ysize] pixels.
+ *!
+ *! @param options
+ *!   @mapping
+ *!     @member int(0..1) "alpha"
+ *!       Write an alpha channel, given to @[encode_rows].
+ *!     @member int(0..9) "zlevel"
+ *!       The level of z-compression to be applied. Default is 9.
+ *!     @member int "zstrategy"
+ *!       The type of LZ77 strategy to be used, as for @[encode].
+ *!       Default is @[Gz.DEFAULT_STRATEGY].
+ *!     @member int(-1..4) "filter"
+ *!       The PNG filter used for every row, or -1 to pick the
+ *!       filter that looks best for each row. Default is -1.
+ *!   @endmapping
+ */
+static void image_png_encoder_create(INT32 args)
+{
+   struct png_encoder *this=THIS_ENC;
+   INT_TYPE xsize,ysize;
+   struct mapping *opts=NULL;
+   int zlevel=9, zstrategy=0;
+   unsigned char hdr[13];
+
+   get_all_args(NULL,args,"%+%+.%G",&xsize,&ysize,&opts);
+   if (!xsize || !ysize || xsize>0x7fffffff || ysize>0x7fffffff)
+      SIMPLE_ARG_ERROR("create",1,"Illegal image size.");
+   if (this->deflate)
+      Pike_error("Image.PNG.Encoder: Already initialized.\n");
+
+   this->filter=-1;
+   if (opts)
+   {
+      struct svalue *s;
+      if ((s=low_mapping_string_lookup(opts,param_alpha)))
+	 this->alpha=!UNSAFE_IS_ZERO(s);
+      if ((s=low_mapping_string_lookup(opts,param_zlevel)) &&
+	  TYPEOF(*s) == T_INT)
+	 zlevel=s->u.integer;
+      if ((s=low_mapping_string_lookup(opts,param_zstrategy)) &&
+	  TYPEOF(*s) == T_INT)
+	 zstrategy=s->u.integer;
+      push_static_text("filter");
+      if ((s=low_mapping_lookup(opts,sp-1)) && TYPEOF(*s) == T_INT)
+      {
+	 if (s->u.integer<-1 || s->u.integer>4)
+	    SIMPLE_ARG_ERROR("create",3,"Illegal filter.");
+	 this->filter=s->u.integer;
+      }
+      pop_stack();
+   }
+
+   this->xsize=xsize;
+   this->ysize=ysize;
+   this->row_bytes=(size_t)xsize*(this->alpha?4:3);
+   this->prev=xalloc(this->row_bytes);
+   this->cur=xalloc(this->row_bytes);
+   this->best=xalloc(this->row_bytes+1);
+   this->trial=xalloc(this->row_bytes+1);
+   memset(this->prev,0,this->row_bytes);
+
+   this->deflate=png_zlib_object("Gz.deflate",2,zlevel,zstrategy);
+
+   buffer_memcpy(&this->out,"\211PNG\r\n\032\n",8);
+   hdr[0]=(unsigned char)(xsize>>24); hdr[1]=(unsigned char)(xsize>>16);
+   hdr[2]=(unsigned char)(xsize>>8);  hdr[3]=(unsigned char)xsize;
+   hdr[4]=(unsigned char)(ysize>>24); hdr[5]=(unsigned char)(ysize>>16);
+   hdr[6]=(unsigned char)(ysize>>8);  hdr[7]=(unsigned char)ysize;
+   hdr[8]=8;			/* bpp */
+   hdr[9]=this->alpha?6:2;	/* type */
+   hdr[10]=0;			/* compression */
+   hdr[11]=0;			/* filter */
+   hdr[12]=0;			/* interlace */
+   png_buffer_chunk(&this->out,"IHDR",hdr,13);
+
+   pop_n_elems(args);
+}
+
+/* Filters the rows in rows x alpha, rows is the number of rows. */
+static void png_encoder_filter(struct png_encoder *this,
+			       struct byte_buffer *dst,
+			       rgb_group *s,rgb_group *sa,INT32 rows)
+{
+   int sbb=this->alpha?4:3;
+   size_t len=this->row_bytes;
+
+   while (rows--)
+   {
+      unsigned char *d=this->cur, *t;
+      INT32 x;
+
+      if (sa)
+	 for (x=0; x<this->xsize; x++, s++, sa++)
+	 {
+	    *(d++)=s->r;
+	    *(d++)=s->g;
+	    *(d++)=s->b;
+	    *(d++)=(sa->r+sa->g*2+sa->b)>>2;
+	 }
+      else
+	 for (x=0; x<this->xsize; x++, s++)
+	 {
+	    *(d++)=s->r;
+	    *(d++)=s->g;
+	    *(d++)=s->b;
+	 }
+
+      if (this->filter>=0)
+      {
+	 this->best[0]=this->filter;
+	 _png_filter_row(this->best+1,this->cur,this->prev,len,sbb,
+			 this->filter);
+      }
+      else
+      {
+	 /* Pick the filter with the smallest sum of absolute
+	  * differences, the heuristic suggested by the PNG spec. */
+	 UINT64 best_sum=~(UINT64)0;
+	 int f;
+	 for (f=0; f<5; f++)
+	 {
+	    UINT64 sum=0;
+	    size_t i;
+	    _png_filter_row(this->trial+1,this->cur,this->prev,len,sbb,f);
+	    for (i=1; i<=len; i++)
+	       sum+=abs((signed char)this->trial[i]);
+	    if (sum<best_sum)
+	    {
+	       best_sum=sum;
+	       this->trial[0]=f;
+	       t=this->best; this->best=this->trial; this->trial=t;
+	    }
+	 }
+      }
+
+      memcpy(buffer_dst(dst),this->best,len+1);
+      buffer_advance(dst,len+1);
+
+      t=this->prev; this->prev=this->cur; this->cur=t;
+   }
+}
+
+/* Wraps the compressed data in IDAT chunks. */
+static void png_encoder_idat(struct png_encoder *this,int all)
+{
+   size_t len=buffer_content_length(&this->idat);
+   if (len && (all || len>=PNG_IDAT_SIZE))
+   {
+      png_buffer_chunk(&this->out,"IDAT",buffer_ptr(&this->idat),len);
+      buffer_clear(&this->idat);
+   }
+}
+
+static void png_encoder_deflate(struct png_encoder *this,
+				struct pike_string *data,int flush)
+{
+   push_string(data);
+   push_int(flush);
+   apply(this->deflate,"deflate",2);
+   if (TYPEOF(sp[-1]) == T_STRING)
+      buffer_memcpy(&this->idat,sp[-1].u.string->str,sp[-1].u.string->len);
+   pop_stack();
+}
+
+/*! @decl string(8bit) encode_rows(Image.Image rows, @
+ *!                                void|Image.Image alpha)
+ *!   Encodes the next rows of the image. @[rows] must be as wide as
+ *!   the image, and @[alpha], which is required if the encoder was
+ *!   created with an alpha channel, must be as large as @[rows].
+ *!
+ *! @returns
+ *!   Returns the encoded data that is ready, which may be an empty
+ *!   string. The first call also returns the PNG header.
+ */
+static void image_png_encoder_encode_rows(INT32 args)
+{
+   struct png_encoder *this=THIS_ENC;
+   struct object *o, *ao=NULL;
+   struct image *img, *alpha=NULL;
+   struct byte_buffer buf;
+   ONERROR err;
+
+   get_all_args(NULL,args,"%o.%O",&o,&ao);
+   if (!(img=get_storage(o,image_program)) || !img->img)
+      SIMPLE_ARG_TYPE_ERROR("encode_rows",1,"Image.Image");
+   if (ao && (!(alpha=get_storage(ao,image_program)) || !alpha->img))
+      SIMPLE_ARG_TYPE_ERROR("encode_rows",2,"Image.Image");
+   if (!this->deflate)
+      Pike_error("Image.PNG.Encoder: Not initialized.\n");
+   if (img->xsize!=this->xsize)
+      Pike_error("Image.PNG.Encoder: The rows must be %d pixels wide.\n",
+		 this->xsize);
+   if (img->ysize>this->ysize-this->y)
+      Pike_error("Image.PNG.Encoder: Too many rows.\n");
+   if (this->alpha && !alpha)
+      Pike_error("Image.PNG.Encoder: An alpha channel is required.\n");
+   if (alpha && (alpha->xsize!=img->xsize || alpha->ysize!=img->ysize))
+      Pike_error("Image.PNG.Encoder: The alpha channel differs in size.\n");
+
+   buffer_init(&buf);
+   SET_ONERROR(err,buffer_free,&buf);
+   buffer_ensure_space(&buf,(this->row_bytes+1)*img->ysize);
+   THREADS_ALLOW();
+   png_encoder_filter(this,&buf,img->img,this->alpha?alpha->img:NULL,
+		      img->ysize);
+   THREADS_DISALLOW();
+   UNSET_ONERROR(err);
+   this->y+=img->ysize;
+
+   png_encoder_deflate(this,buffer_finish_pike_string(&buf),PNG_Z_NO_FLUSH);
+   png_encoder_idat(this,0);
+
+   pop_n_elems(args);
+   push_string(buffer_finish_pike_string(&this->out));
+   buffer_init(&this->out);
+}
+
+/*! @decl string(8bit) finish()
+ *!   Returns the rest of the encoded image. All rows must have been
+ *!   given to @[encode_rows].
+ */
+static void image_png_encoder_finish(INT32 args)
+{
+   struct png_encoder *this=THIS_ENC;
+
+   pop_n_elems(args);
+   if (!this->deflate)
+      Pike_error("Image.PNG.Encoder: Not initialized.\n");
+   if (this->y!=this->ysize)
+      Pike_error("Image.PNG.Encoder: Only %d of %d rows encoded.\n",
+		 this->y,this->ysize);
+
+   png_encoder_deflate(this,empty_pike_string,PNG_Z_FINISH);
+   png_encoder_idat(this,1);
+   png_buffer_chunk(&this->out,"IEND",NULL,0);
+
+   free_object(this->deflate);
+   this->deflate=NULL;
+
+   push_string(buffer_finish_pike_string(&this->out));
+   buffer_init(&this->out);
+}
+
+/*! @endclass
+ */
+
 /*! @endmodule
  */
 
@@ -1945,6 +2948,9 @@ void exit_image_png(void)
    free_string(param_background);
    free_string(param_zlevel);
    free_string(param_zstrategy);
+
+   if (png_decoder_program) free_program(png_decoder_program);
+   if (png_encoder_program) free_program(png_encoder_program);
 }
 
 void init_image_png(void)
@@ -1986,6 +2992,34 @@ void init_image_png(void)
      ADD_FUNCTION2("encode",image_png_encode,
 		   tFunc(tObj tOr(tVoid,tMap(tStr,tMix)),tStr),0,
 		   OPT_TRY_OPTIMIZE);
+
+     start_new_program();
+     ADD_STORAGE(struct png_decoder);
+     ADD_FUNCTION("feed",image_png_decoder_feed,
+		  tFunc(tOr(tStr8,tObj),tVoid),0);
+     ADD_FUNCTION("read",image_png_decoder_read,
+		  tFunc(tNone,tMap(tStr,tOr(tInt,tObj))),0);
+     ADD_FUNCTION("header",image_png_decoder_header,
+		  tFunc(tNone,tMap(tStr,tInt)),0);
+     ADD_FUNCTION("finished",image_png_decoder_finished,
+		  tFunc(tNone,tInt01),0);
+     set_init_callback(init_png_decoder);
+     set_exit_callback(exit_png_decoder);
+     png_decoder_program=end_program();
+     add_program_constant("Decoder",png_decoder_program,0);
+
+     start_new_program();
+     ADD_STORAGE(struct png_encoder);
+     ADD_FUNCTION("create",image_png_encoder_create,
+		  tFunc(tIntPos tIntPos tOr(tVoid,tMap(tStr,tInt)),tVoid),
+		  ID_PROTECTED);
+     ADD_FUNCTION("encode_rows",image_png_encoder_encode_rows,
+		  tFunc(tObj tOr(tVoid,tObj),tStr8),0);
+     ADD_FUNCTION("finish",image_png_encoder_finish,tFunc(tNone,tStr8),0);
+     set_init_callback(init_png_encoder);
+     set_exit_callback(exit_png_encoder);
+     png_encoder_program=end_program();
+     add_program_constant("Encoder",png_encoder_program,0);
    }
 
    param_palette=make_shared_string("palette");
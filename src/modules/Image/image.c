@@ -378,49 +378,37 @@ static inline rgb_group _pixel_apply_matrix(struct image *img,
 }
 
 
-static void img_apply_matrix(struct image *dest,
-			     struct image *img,
-			     int width,int height,
-			     rgbd_group *matrix,
-			     double div,
-			     rgb_group default_rgb)
+struct apply_matrix_job
 {
-   rgb_group *d,*ip,*dp;
-   rgbd_group *mp;
-   int i,x,y,bx,by,ex,ey,yp;
-   int widthheight;
-   double sumr,sumg,sumb;
+   struct image *img;
+   rgb_group *d;
+   int width,height;
+   rgbd_group *matrix;
+   double div;
+   rgb_group default_rgb;
    double qr,qg,qb;
-   double r=0,g=0,b=0;
-
-THREADS_ALLOW();
+};
 
-   widthheight=width*height;
-   sumr=sumg=sumb=0;
-   for (i=0; i<widthheight;)
-     {
-       sumr+=matrix[i].r;
-       sumg+=matrix[i].g;
-       sumb+=matrix[i++].b;
-     }
-
-   if (!sumr) {sumr=1;} sumr*=div; qr=1.0/sumr;
-   if (!sumg) {sumg=1;} sumg*=div; qg=1.0/sumg;
-   if (!sumb) {sumb=1;} sumb*=div; qb=1.0/sumb;
+/* Applies the matrix to the lines start..end-1. */
+static void apply_matrix_band(void *data,INT32 start,INT32 end)
+{
+   struct apply_matrix_job *job=data;
+   struct image *img=job->img;
+   rgb_group *d=job->d,*ip,*dp;
+   rgbd_group *matrix=job->matrix,*mp;
+   int width=job->width,height=job->height;
+   rgb_group default_rgb=job->default_rgb;
+   double div=job->div;
+   double qr=job->qr,qg=job->qg,qb=job->qb;
+   int i,x,y,bx,by,ex,ey,yp;
+   double r=0,g=0,b=0;
 
    bx=width/2;
    by=height/2;
    ex=width-bx;
    ey=height-by;
 
-THREADS_DISALLOW();
-
-   d=xalloc(sizeof(rgb_group)*img->xsize*img->ysize + RGB_VEC_PAD);
-
-THREADS_ALLOW();
-CHRONO("apply_matrix, one");
-
-   for (y=by; y<img->ysize-ey; y++)
+   for (y=MAXIMUM(start,by); y<MINIMUM(end,img->ysize-ey); y++)
    {
       dp=d+y*img->xsize+bx;
       for (x=bx; x<img->xsize-ex; x++)
@@ -464,27 +452,70 @@ j++;
       }
    }
 
-CHRONO("apply_matrix, two");
-
-   for (y=0; y<img->ysize; y++)
+   /* The edges. */
+   for (y=start; y<end; y++)
    {
+      if (y<by || y>=img->ysize-ey)
+      {
+	 for (x=0; x<img->xsize; x++)
+	    d[x+y*img->xsize]=_pixel_apply_matrix(img,x,y,width,height,
+						  matrix,default_rgb,div);
+	 continue;
+      }
       for (x=0; x<bx; x++)
 	 d[x+y*img->xsize]=_pixel_apply_matrix(img,x,y,width,height,
 					       matrix,default_rgb,div);
-      for (x=img->xsize-ex; x<img->xsize; x++)
+      for (x=MAXIMUM(img->xsize-ex,0); x<img->xsize; x++)
 	 d[x+y*img->xsize]=_pixel_apply_matrix(img,x,y,width,height,
 					       matrix,default_rgb,div);
    }
+}
 
-   for (x=0; x<img->xsize; x++)
-   {
-      for (y=0; y<by; y++)
-	 d[x+y*img->xsize]=_pixel_apply_matrix(img,x,y,width,height,
-					       matrix,default_rgb,div);
-      for (y=img->ysize-ey; y<img->ysize; y++)
-	 d[x+y*img->xsize]=_pixel_apply_matrix(img,x,y,width,height,
-					       matrix,default_rgb,div);
-   }
+static void img_apply_matrix(struct image *dest,
+			     struct image *img,
+			     int width,int height,
+			     rgbd_group *matrix,
+			     double div,
+			     rgb_group default_rgb)
+{
+   rgb_group *d;
+   int i;
+   int widthheight;
+   double sumr,sumg,sumb;
+   struct apply_matrix_job job;
+
+THREADS_ALLOW();
+
+   widthheight=width*height;
+   sumr=sumg=sumb=0;
+   for (i=0; i<widthheight;)
+     {
+       sumr+=matrix[i].r;
+       sumg+=matrix[i].g;
+       sumb+=matrix[i++].b;
+     }
+
+   if (!sumr) {sumr=1;} sumr*=div; job.qr=1.0/sumr;
+   if (!sumg) {sumg=1;} sumg*=div; job.qg=1.0/sumg;
+   if (!sumb) {sumb=1;} sumb*=div; job.qb=1.0/sumb;
+
+THREADS_DISALLOW();
+
+   d=xalloc(sizeof(rgb_group)*img->xsize*img->ysize + RGB_VEC_PAD);
+
+THREADS_ALLOW();
+CHRONO("apply_matrix, one");
+
+   job.img=img;
+   job.d=d;
+   job.width=width;
+   job.height=height;
+   job.matrix=matrix;
+   job.div=div;
+   job.default_rgb=default_rgb;
+
+   image_parallel_rows(apply_matrix_band,&job,img->ysize,
+		       img->xsize*img->ysize*widthheight);
 
 CHRONO("apply_matrix, three");
 
@@ -2448,6 +2479,12 @@ void image_invert(INT32 args)
    s = (char *)THIS->img;
 
    THREADS_ALLOW();
+   {
+     size_t n = sizeof(rgb_group) *
+       IMAGE_SIMD(invert, ((rgb_group *)d, (rgb_group *)s,
+			   THIS->xsize * THIS->ysize));
+     d += n; s += n; sz -= n;
+   }
    if (sz >= sizeof(INT_TYPE))
    {
      INT_TYPE *dd = (INT_TYPE *)d;
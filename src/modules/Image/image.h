@@ -230,6 +230,60 @@ void image_tobitmap(INT32 args);
 
 void image_polyfill(INT32 args);
 
+/* parallel.c */
+
+int image_parallel_bands(INT32 rows, size_t work);
+void image_parallel_rows(void (*fun)(void *data, INT32 start, INT32 end),
+			 void *data, INT32 rows, size_t work);
+void init_image_parallel(void);
+
+/* simd.c */
+
+/* Vectorised pixel functions. They handle a multiple of some number
+ * of pixels, and return the number of pixels handled. */
+struct image_simd_ops
+{
+   const char *name;
+   INT32 (*add)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		INT32 npixels);
+   INT32 (*sub)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		INT32 npixels);
+   INT32 (*invsub)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		   INT32 npixels);
+   INT32 (*absdiff)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		    INT32 npixels);
+   INT32 (*mult)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		 INT32 npixels);
+   INT32 (*imult)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		  INT32 npixels);
+   INT32 (*max)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		INT32 npixels);
+   INT32 (*min)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		INT32 npixels);
+   INT32 (*bit_and)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		    INT32 npixels);
+   INT32 (*bit_or)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		   INT32 npixels);
+   INT32 (*bit_xor)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		    INT32 npixels);
+   INT32 (*invert)(rgb_group *d, const rgb_group *s, INT32 npixels);
+   INT32 (*blend)(rgb_group *d, const rgb_group *s1, const rgb_group *s2,
+		  INT32 npixels, int alpha);
+   INT32 (*nearest)(const INT16 *pr, const INT16 *pg, const INT16 *pb,
+		    INT32 n, const INT16 *col, INT32 *dist);
+};
+
+/* The color planes given to nearest must be padded to a multiple of
+ * this number of colors. */
+#define IMAGE_SIMD_NEAREST_PAD 16
+
+/* NULL if there are no vectorised versions. */
+extern const struct image_simd_ops *image_simd;
+
+#define IMAGE_SIMD(OP, ARGS) (image_simd ? image_simd->OP ARGS : 0)
+
+void init_image_simd(void);
+
 /* orient.c */
 
 void image_orient(INT32 args);
@@ -243,6 +243,9 @@ PIKE_MODULE_INIT
      init_cpuidflags( );
 #endif
 
+   init_image_parallel();
+   init_image_simd();
+
    for (i=0; i<(int)NELEM(initclass); i++)
    {
       start_new_program();
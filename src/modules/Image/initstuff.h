@@ -57,3 +57,10 @@ IMAGE_FUNCTION("lay",image_lay,
 	       tOr(tFunc(tArr(tOr(tObj,tLayerMap)),tObj),
 		   tFunc(tArr(tOr(tObj,tLayerMap))
 			 tInt tInt tInt tInt,tObj)),0)
+
+IMAGE_FUNCTION("set_num_threads",image_set_num_threads,
+	       tFunc(tIntPos,tVoid),0)
+IMAGE_FUNCTION("get_num_threads",image_get_num_threads,
+	       tFunc(tNone,tIntPos),0)
+IMAGE_FUNCTION("simd_type",image_simd_type,
+	       tFunc(tNone,tOr(tStr,tZero)),0)
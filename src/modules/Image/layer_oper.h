@@ -29,6 +29,12 @@ static void LM_FUNC(rgb_group *s,rgb_group *l,rgb_group *d,
 #endif
       if (!la)  /* no layer alpha => full opaque */
       {
+#if defined(L_SIMD_OPER) && defined(L_COPY_ALPHA)
+	 {
+	    INT32 n = IMAGE_SIMD(L_SIMD_OPER, (d, s, l, len));
+	    s += n; l += n; d += n; sa += n; len -= n;
+	 }
+#endif
 #ifdef L_MMX_OPER
 #ifdef TRY_USE_MMX
 /* Intentionally left here.
@@ -1567,7 +1567,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define L_TRUNC(X) MINIMUM(255,(X))
 #define L_OPER(A,B) ((A)+(int)(B))
 #define L_MMX_OPER(A,MMXR) paddusb_m2r(A,MMXR)
+#define L_SIMD_OPER add
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef L_MMX_OPER
 #undef LM_FUNC
 #undef L_TRUNC
@@ -1589,7 +1591,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define L_TRUNC(X) MAXIMUM(0,(X))
 #define L_OPER(A,B) ((A)-(int)(B))
 #define L_MMX_OPER(A,MMXR) psubusb_m2r(A,MMXR)
+#define L_SIMD_OPER sub
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef L_MMX_OPER
 #undef LM_FUNC
 #undef L_TRUNC
@@ -1598,7 +1602,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_multiply
 #define L_TRUNC(X) (X)
 #define L_OPER(A,B) CCUT((A)*(int)(B))
+#define L_SIMD_OPER mult
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1633,7 +1639,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_invsubtract
 #define L_TRUNC(X) MAXIMUM(0,(X))
 #define L_OPER(A,B) ((B)-(int)(A))
+#define L_SIMD_OPER invsub
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1665,7 +1673,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_imultiply
 #define L_TRUNC(X) (X)
 #define L_OPER(A,B) CCUT((A)*(COLORMAX-(int)(B)))
+#define L_SIMD_OPER imult
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1683,7 +1693,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_difference
 #define L_TRUNC(X) ((COLORTYPE)(X))
 #define L_OPER(A,B) abs((A)-(B))
+#define L_SIMD_OPER absdiff
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1691,7 +1703,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_max
 #define L_TRUNC(X) ((COLORTYPE)(X))
 #define L_OPER(A,B) MAXIMUM((A),(B))
+#define L_SIMD_OPER max
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1699,7 +1713,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_min
 #define L_TRUNC(X) ((COLORTYPE)(X))
 #define L_OPER(A,B) MINIMUM((A),(B))
+#define L_SIMD_OPER min
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1707,7 +1723,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_bitwise_and
 #define L_TRUNC(X) ((COLORTYPE)(X))
 #define L_OPER(A,B) ((A)&(B))
+#define L_SIMD_OPER bit_and
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1715,7 +1733,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_bitwise_or
 #define L_TRUNC(X) ((COLORTYPE)(X))
 #define L_OPER(A,B) ((A)|(B))
+#define L_SIMD_OPER bit_or
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
@@ -1723,7 +1743,9 @@ static void lm_normal(rgb_group *s,rgb_group *l,rgb_group *d,
 #define LM_FUNC lm_bitwise_xor
 #define L_TRUNC(X) ((COLORTYPE)(X))
 #define L_OPER(A,B) ((A)^(B))
+#define L_SIMD_OPER bit_xor
 #include "layer_oper.h"
+#undef L_SIMD_OPER
 #undef LM_FUNC
 #undef L_TRUNC
 #undef L_OPER
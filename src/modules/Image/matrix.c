@@ -133,46 +133,49 @@ static inline void scale_add_line(double py,double dx,
    }
 }
 
-void img_scale(struct image *dest,
-	       struct image *source,
-	       INT32 newx,INT32 newy)
+struct scale_job
 {
-   rgbd_group *new,*s;
+   rgbd_group *new;
    rgb_group *d;
-   INT32 y,yd;
-   double yn,dx,dy;
-
-CHRONO("scale begin");
-
-   if (dest->img) { free(dest->img); dest->img=NULL; }
-
-   if (!THIS->img) return; /* no way */
-   if (newx<1) newx=1;
-   if (newy<1) newy=1;
-
-   new=xalloc(newx*newy*sizeof(rgbd_group)+1);
+   struct image *source;
+   INT32 newx;
+   double dx,dy;
+};
+
+/* Scales the source lines that cover the new lines start..end-1.
+ * All bands step through the source lines in the same way, so that
+ * the result is the same for any number of bands.
+ */
+static void scale_band(void *data,INT32 start,INT32 end)
+{
+   struct scale_job *job=data;
+   struct image *source=job->source;
+   rgbd_group *new=job->new,*s;
+   rgb_group *d;
+   INT32 newx=job->newx;
+   INT32 y,yd,yt;
+   double yn,dx=job->dx,dy=job->dy;
 
-   THREADS_ALLOW();
+#define IN_BAND(Y) ((Y)>=start && (Y)<end)
 
-   for (y=0; y<newx*newy; y++)
+   for (y=start*newx; y<end*newx; y++)
       new[y].r=new[y].g=new[y].b=0.0;
 
-   dx=((double)newx-0.000001)/source->xsize;
-   dy=((double)newy-0.000001)/source->ysize;
-
-   for (y=0,yn=0; y<source->ysize; y++,yn+=dy)
+   for (y=0,yn=0; y<source->ysize && (int)yn<end; y++,yn+=dy)
    {
+     if ((int)(yn+dy)<start) continue;
      if ((int)yn<(int)(yn+dy))
       {
-	 if (1.0-decimals(yn))
+	 if ((1.0-decimals(yn)) && IN_BAND((int)yn))
 	    scale_add_line((1.0-decimals(yn)),dx,
                            new, (int)yn, newx,
 			   source->img, y, source->xsize);
          if ((yd = (int)(yn+dy) - (int)yn)>1)
             while (--yd)
-              scale_add_line(1.0, dx, new, (int)(yn+yd), newx,
-			      source->img, y, source->xsize);
-	 if (decimals(yn+dy))
+              if (IN_BAND(yt=(int)(yn+yd)))
+                scale_add_line(1.0, dx, new, yt, newx,
+                               source->img, y, source->xsize);
+	 if (decimals(yn+dy) && IN_BAND((int)(yn+dy)))
            scale_add_line((decimals(yn+dy)), dx, new, (int)(yn+dy),
 			   newx, source->img, y, source->xsize);
       }
@@ -181,21 +184,52 @@ CHRONO("scale begin");
                        source->img, y, source->xsize);
    }
 
+#undef IN_BAND
+
+   s=new+start*newx;
+   d=job->d+start*newx;
+   y=(end-start)*newx;
+   while (y--)
+   {
+     d->r = MINIMUM((int)(s->r+0.5),255);
+     d->g = MINIMUM((int)(s->g+0.5),255);
+     d->b = MINIMUM((int)(s->b+0.5),255);
+     d++; s++;
+   }
+}
+
+void img_scale(struct image *dest,
+	       struct image *source,
+	       INT32 newx,INT32 newy)
+{
+   rgbd_group *new;
+   rgb_group *d;
+   struct scale_job job;
+
+CHRONO("scale begin");
+
+   if (dest->img) { free(dest->img); dest->img=NULL; }
+
+   if (!THIS->img) return; /* no way */
+   if (newx<1) newx=1;
+   if (newy<1) newy=1;
+
+   new=xalloc(newx*newy*sizeof(rgbd_group)+1);
+
+   THREADS_ALLOW();
+
    dest->img=d=malloc(newx*newy*sizeof(rgb_group)+RGB_VEC_PAD);
    if (d)
    {
+     job.new=new;
+     job.d=d;
+     job.source=source;
+     job.newx=newx;
+     job.dx=((double)newx-0.000001)/source->xsize;
+     job.dy=((double)newy-0.000001)/source->ysize;
 
-CHRONO("transfer begin");
-
-     s=new;
-     y=newx*newy;
-     while (y--)
-     {
-       d->r = MINIMUM((int)(s->r+0.5),255);
-       d->g = MINIMUM((int)(s->g+0.5),255);
-       d->b = MINIMUM((int)(s->b+0.5),255);
-       d++; s++;
-     }
+     image_parallel_rows(scale_band,&job,newy,
+			 source->xsize*source->ysize+(size_t)newx*newy);
 
      dest->xsize=newx;
      dest->ysize=newy;
@@ -660,40 +694,31 @@ void image_mirrory(INT32 args)
 
 #define ROUND(X) ((COLORTYPE)((X)+0.5))
 
-static void img_skewx(struct image *src,
-		      struct image *dest,
-		      double diff,
-		      int xpn) /* expand pixel for use with alpha instead */
+struct skew_job
 {
-   double x0,xmod,xm,x0f;
-   INT32 y,len,x0i;
-   rgb_group *s,*d;
-   rgb_group rgb;
-
-   if (dest->img) free(dest->img);
-   if (diff<0)
-      dest->xsize = (int)(ceil(-diff)) + src->xsize, x0 = -diff;
-   else
-      dest->xsize = (int)(ceil(diff)) + src->xsize, x0=0;
-   dest->ysize=src->ysize;
-   len=src->xsize;
-
-   if (!src->xsize) dest->xsize=0;
-   d=dest->img=malloc(sizeof(rgb_group)*dest->xsize*dest->ysize+RGB_VEC_PAD);
-   if (!d) return;
-   s=src->img;
+   struct image *src,*dest;
+   double x0,xmod;
+   int xpn;
+};
 
-   if (!src->xsize || !src->ysize) {
-     return;
-   }
+/* Skews the lines start..end-1. */
+static void skewx_band(void *data,INT32 start,INT32 end)
+{
+   struct skew_job *job=data;
+   struct image *src=job->src,*dest=job->dest;
+   double x0=job->x0,xmod=job->xmod,xm,x0f;
+   INT32 y,len=src->xsize,x0i;
+   rgb_group *s,*d;
+   rgb_group rgb=dest->rgb;
+   int xpn=job->xpn;
 
-   THREADS_ALLOW();
-   xmod=diff/src->ysize;
-   rgb=dest->rgb;
+   /* Step x0 just like a single band would, to get the same result. */
+   for (y=0; y<start; y++) x0+=xmod;
 
-   CHRONO("skewx begin\n");
+   s=src->img+start*src->xsize;
+   d=dest->img+start*dest->xsize;
 
-   y=src->ysize;
+   y=end-start;
    while (y--)
    {
       int j;
@@ -731,7 +756,6 @@ static void img_skewx(struct image *src,
 	    d->b=ROUND(rgb.b*xn+s->b*xm);
 	 d++;
 	 s++;
-	 debug_malloc_touch(dest->img);
 	 j = dest->xsize - x0i - len - 1;
       }
       if (xpn) rgb=s[-1];
@@ -739,49 +763,67 @@ static void img_skewx(struct image *src,
 	while (j--) *(d++)=rgb;
       else
 	d += j;
-      debug_malloc_touch(dest->img);
       x0+=xmod;
    }
-   THREADS_DISALLOW();
-   debug_malloc_touch(dest->img);
-
-   CHRONO("skewx end\n");
 }
 
-static void img_skewy(struct image *src,
+static void img_skewx(struct image *src,
 		      struct image *dest,
 		      double diff,
 		      int xpn) /* expand pixel for use with alpha instead */
 {
-   double y0,ymod,ym,y0f;
-   INT32 x,len,xsz,y0i;
-   rgb_group *s,*d;
-   rgb_group rgb;
+   struct skew_job job;
 
    if (dest->img) free(dest->img);
    if (diff<0)
-      dest->ysize = (int)(ceil(-diff)) + src->ysize, y0 = -diff;
+      dest->xsize = (int)(ceil(-diff)) + src->xsize, job.x0 = -diff;
    else
-      dest->ysize = (int)(ceil(diff)) + src->ysize, y0 = 0;
-   xsz=dest->xsize=src->xsize;
-   len=src->ysize;
+      dest->xsize = (int)(ceil(diff)) + src->xsize, job.x0 = 0;
+   dest->ysize=src->ysize;
 
-   if (!src->ysize) dest->ysize=0;
-   d=dest->img=malloc(sizeof(rgb_group)*dest->ysize*dest->xsize+RGB_VEC_PAD);
-   if (!d) return;
-   s=src->img;
+   if (!src->xsize) dest->xsize=0;
+   dest->img=malloc(sizeof(rgb_group)*dest->xsize*dest->ysize+RGB_VEC_PAD);
+   if (!dest->img) return;
 
    if (!src->xsize || !src->ysize) {
      return;
    }
 
    THREADS_ALLOW();
-   ymod=diff/src->xsize;
-   rgb=dest->rgb;
+   job.src=src;
+   job.dest=dest;
+   job.xmod=diff/src->ysize;
+   job.xpn=xpn;
 
-CHRONO("skewy begin\n");
+   CHRONO("skewx begin\n");
+
+   image_parallel_rows(skewx_band,&job,src->ysize,
+		       dest->xsize*dest->ysize);
+
+   THREADS_DISALLOW();
+   debug_malloc_touch(dest->img);
+
+   CHRONO("skewx end\n");
+}
+
+/* Skews the columns start..end-1. */
+static void skewy_band(void *data,INT32 start,INT32 end)
+{
+   struct skew_job *job=data;
+   struct image *src=job->src,*dest=job->dest;
+   double y0=job->x0,ymod=job->xmod,ym,y0f;
+   INT32 x,len=src->ysize,xsz=dest->xsize,y0i;
+   rgb_group *s,*d;
+   rgb_group rgb=dest->rgb;
+   int xpn=job->xpn;
+
+   /* Step y0 just like a single band would, to get the same result. */
+   for (x=0; x<start; x++) y0+=ymod;
+
+   s=src->img+start;
+   d=dest->img+start;
 
-   x=src->xsize;
+   x=end-start;
    while (x--)
    {
       int j;
@@ -830,6 +872,42 @@ CHRONO("skewy begin\n");
       d-=dest->ysize*xsz-1;
       y0+=ymod;
    }
+}
+
+static void img_skewy(struct image *src,
+		      struct image *dest,
+		      double diff,
+		      int xpn) /* expand pixel for use with alpha instead */
+{
+   struct skew_job job;
+
+   if (dest->img) free(dest->img);
+   if (diff<0)
+      dest->ysize = (int)(ceil(-diff)) + src->ysize, job.x0 = -diff;
+   else
+      dest->ysize = (int)(ceil(diff)) + src->ysize, job.x0 = 0;
+   dest->xsize=src->xsize;
+
+   if (!src->ysize) dest->ysize=0;
+   dest->img=malloc(sizeof(rgb_group)*dest->ysize*dest->xsize+RGB_VEC_PAD);
+   if (!dest->img) return;
+
+   if (!src->xsize || !src->ysize) {
+     return;
+   }
+
+   THREADS_ALLOW();
+   job.src=src;
+   job.dest=dest;
+   job.xmod=diff/src->xsize;
+   job.xpn=xpn;
+
+CHRONO("skewy begin\n");
+
+   /* NB: The bands are columns here. */
+   image_parallel_rows(skewy_band,&job,src->xsize,
+		       dest->xsize*dest->ysize);
+
    THREADS_DISALLOW();
 
 CHRONO("skewy end\n");
@@ -119,12 +119,16 @@ extern struct program *image_program;
 void image_operator_minus(INT32 args)
 {
 STANDARD_OPERATOR_HEADER("`-")
-   while (i--)
    {
-      d->r=absdiff(s1->r,s2->r);
-      d->g=absdiff(s1->g,s2->g);
-      d->b=absdiff(s1->b,s2->b);
-      s1++; s2++; d++;
+     INT32 n = IMAGE_SIMD(absdiff, (d, s1, s2, i));
+     d += n; s1 += n; s2 += n; i -= n;
+     while (i--)
+     {
+       d->r=absdiff(s1->r,s2->r);
+       d->g=absdiff(s1->g,s2->g);
+       d->b=absdiff(s1->b,s2->b);
+       s1++; s2++; d++;
+     }
    }
    else
    while (i--)
@@ -172,12 +176,16 @@ STANDARD_OPERATOR_HEADER("`+")
                              ((unsigned char *)s2)[i * 3 - nleft]), 255 );
      } else
 #endif
-     while (i--)
      {
-       d->r=MINIMUM(s1->r+s2->r,255);
-       d->g=MINIMUM(s1->g+s2->g,255);
-       d->b=MINIMUM(s1->b+s2->b,255);
-       s1++; s2++; d++;
+       INT32 n = IMAGE_SIMD(add, (d, s1, s2, i));
+       d += n; s1 += n; s2 += n; i -= n;
+       while (i--)
+       {
+	 d->r=MINIMUM(s1->r+s2->r,255);
+	 d->g=MINIMUM(s1->g+s2->g,255);
+	 d->b=MINIMUM(s1->b+s2->b,255);
+	 s1++; s2++; d++;
+       }
      }
    }
    else
@@ -262,6 +270,10 @@ STANDARD_OPERATOR_HEADER("`*")
      } else
 #endif
 #endif
+     {
+       INT32 n = IMAGE_SIMD(mult, (d, s1, s2, i));
+       d += n; s1 += n; s2 += n; i -= n;
+     }
      while (i--)
      {
         d->r=(s1->r * s2->r) / 255;
@@ -430,12 +442,16 @@ void image_operator_divide(INT32 args)
 void image_operator_maximum(INT32 args)
 {
 STANDARD_OPERATOR_HEADER("`| 'maximum'")
-   while (i--)
    {
-      d->r=MAXIMUM(s1->r,s2->r);
-      d->g=MAXIMUM(s1->g,s2->g);
-      d->b=MAXIMUM(s1->b,s2->b);
-      s1++; s2++; d++;
+     INT32 n = IMAGE_SIMD(max, (d, s1, s2, i));
+     d += n; s1 += n; s2 += n; i -= n;
+     while (i--)
+     {
+       d->r=MAXIMUM(s1->r,s2->r);
+       d->g=MAXIMUM(s1->g,s2->g);
+       d->b=MAXIMUM(s1->b,s2->b);
+       s1++; s2++; d++;
+     }
    }
    else
    while (i--)
@@ -472,12 +488,16 @@ STANDARD_OPERATOR_HEADER("`| 'maximum'")
 void image_operator_minimum(INT32 args)
 {
 STANDARD_OPERATOR_HEADER("`& 'minimum'")
-   while (i--)
    {
-      d->r=MINIMUM(s1->r,s2->r);
-      d->g=MINIMUM(s1->g,s2->g);
-      d->b=MINIMUM(s1->b,s2->b);
-      s1++; s2++; d++;
+     INT32 n = IMAGE_SIMD(min, (d, s1, s2, i));
+     d += n; s1 += n; s2 += n; i -= n;
+     while (i--)
+     {
+       d->r=MINIMUM(s1->r,s2->r);
+       d->g=MINIMUM(s1->g,s2->g);
+       d->b=MINIMUM(s1->b,s2->b);
+       s1++; s2++; d++;
+     }
    }
    else
    while (i--)
@@ -0,0 +1,198 @@
+/*
+|| This file is part of Pike. For copyright information see COPYRIGHT.
+|| Pike is distributed under GPL, LGPL and MPL. See the file COPYING
+|| for more information.
+*/
+
+/*
+**! module Image
+*/
+
+#include "global.h"
+
+#include "pike_macros.h"
+#include "interpret.h"
+#include "svalue.h"
+#include "threads.h"
+#include "pike_error.h"
+#include "module_support.h"
+
+#include "image.h"
+
+/* Never split jobs smaller than this (in pixels) between threads. */
+#define MIN_PIXELS_PER_THREAD 16384
+
+/* The thread farm keeps at most 16 idle threads around. */
+#define MAX_THREADS 16
+
+static int image_num_threads = 1;
+
+#ifdef PIKE_THREADS
+
+struct band
+{
+   void (*fun)(void *data, INT32 start, INT32 end);
+   void *data;
+   INT32 start, end;
+   struct band_group *group;
+};
+
+struct band_group
+{
+   PIKE_MUTEX_T lock;
+   COND_T done;
+   int remaining;
+};
+
+static void run_band(void *b_)
+{
+   struct band *b = b_;
+   struct band_group *g = b->group;
+
+   b->fun(b->data, b->start, b->end);
+
+   mt_lock(&g->lock);
+   if (!--g->remaining)
+      co_broadcast(&g->done);
+   mt_unlock(&g->lock);
+}
+
+#endif /* PIKE_THREADS */
+
+/* Returns the number of bands image_parallel_rows() would split a
+ * job of rows rows and work pixels into, 1 if it wouldn't use any
+ * other threads.
+ */
+int image_parallel_bands(INT32 rows, size_t work)
+{
+#ifdef PIKE_THREADS
+   int n = image_num_threads;
+
+   if ((size_t)n > work / MIN_PIXELS_PER_THREAD)
+      n = (int)(work / MIN_PIXELS_PER_THREAD);
+   if (n > rows) n = rows;
+
+   return n > 1 ? n : 1;
+#else
+   return 1;
+#endif /* PIKE_THREADS */
+}
+
+/* Calls fun for consecutive bands of the rows 0..rows-1, in parallel
+ * on the threads of the thread farm. work is an estimate of the
+ * number of pixels processed, which is used to avoid starting
+ * threads for small images. Returns when all bands are done.
+ *
+ * The bands are disjoint, so fun must only write to the rows given
+ * to it for the result to be the same as from a single call with all
+ * rows. This must be called with the interpreter lock released, and
+ * fun must not touch any Pike data.
+ */
+void image_parallel_rows(void (*fun)(void *data, INT32 start, INT32 end),
+			 void *data, INT32 rows, size_t work)
+{
+#ifdef PIKE_THREADS
+   struct band bands[MAX_THREADS];
+   struct band_group group;
+   int i, n = image_parallel_bands(rows, work);
+
+   if (n > 1)
+   {
+      mt_init(&group.lock);
+      co_init(&group.done);
+      group.remaining = n - 1;
+
+      for (i = 0; i < n; i++)
+      {
+	 bands[i].fun = fun;
+	 bands[i].data = data;
+	 bands[i].start = (INT32)(((INT64)rows * i) / n);
+	 bands[i].end = (INT32)(((INT64)rows * (i + 1)) / n);
+	 bands[i].group = &group;
+      }
+
+      /* The first band is handled by the current thread. */
+      for (i = 1; i < n; i++)
+	 th_farm(run_band, bands + i);
+      fun(data, bands[0].start, bands[0].end);
+
+      mt_lock(&group.lock);
+      while (group.remaining)
+	 co_wait(&group.done, &group.lock);
+      mt_unlock(&group.lock);
+
+      co_destroy(&group.done);
+      mt_destroy(&group.lock);
+      return;
+   }
+#endif /* PIKE_THREADS */
+   if (rows > 0)
+      fun(data, 0, rows);
+}
+
+/*
+**! method void set_num_threads(int(0..) n)
+**!	Sets the number of threads used by the operations that
+**!	split their work between several threads, like
+**!	<ref>Image.Image->scale</ref>, <ref>Image.Image->rotate</ref>,
+**!	<ref>Image.Image->skewx</ref>, <ref>Image.Image->skewy</ref>,
+**!	<ref>Image.Image->apply_matrix</ref>, and the undithered
+**!	lookups of an <ref>Image.Colortable</ref> in the
+**!	<ref>Image.Colortable->full</ref> and
+**!	<ref>Image.Colortable->kdtree</ref> modes.
+**!
+**!	The result of an operation doesn't depend on the number of
+**!	threads. Small images are always processed by one thread.
+**!
+**! arg int(0..) n
+**!	The number of threads, or 0 to use one thread per cpu.
+**!	At most 16 threads are used.
+**!
+**! see also: get_num_threads
+*/
+
+static int default_num_threads(void)
+{
+   int n = 1;
+#if defined(PIKE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+   n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (n < 1) n = 1;
+   if (n > MAX_THREADS) n = MAX_THREADS;
+   return n;
+}
+
+void image_set_num_threads(INT32 args)
+{
+   INT_TYPE n;
+
+   get_all_args(NULL, args, "%+", &n);
+
+   if (!n)
+      image_num_threads = default_num_threads();
+   else if (n > MAX_THREADS)
+      image_num_threads = MAX_THREADS;
+   else
+      image_num_threads = (int)n;
+
+   pop_n_elems(args);
+}
+
+/*
+**! method int(1..) get_num_threads()
+**!	Returns the number of threads used by the operations that
+**!	split their work between several threads.
+**!
+**! see also: set_num_threads
+*/
+
+void image_get_num_threads(INT32 args)
+{
+   pop_n_elems(args);
+   push_int(image_num_threads);
+}
+
+void init_image_parallel(void)
+{
+   image_num_threads = default_num_threads();
+}
@@ -0,0 +1,187 @@
+/*
+|| This file is part of Pike. For copyright information see COPYRIGHT.
+|| Pike is distributed under GPL, LGPL and MPL. See the file COPYING
+|| for more information.
+*/
+
+/* Vectorised versions of the per-byte pixel operators.
+ *
+ * SSE2 is always available on x86-64, and is used if the compiler
+ * targets it. AVX2 is compiled in with a function level target
+ * attribute where the compiler supports it, and is selected at
+ * runtime if the cpu has it. Otherwise image_simd is NULL, and the
+ * plain C loops are used.
+ */
+
+#include "global.h"
+
+#include "pike_macros.h"
+#include "interpret.h"
+#include "svalue.h"
+
+#include "image.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define IMAGE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(IMAGE_USE_SSE2) && defined(__GNUC__) &&			\
+  (defined(__clang__) || (__GNUC__ >= 5)) &&				\
+  (defined(__x86_64__) || defined(__i386__))
+#define IMAGE_USE_AVX2
+#include <immintrin.h>
+#endif
+
+const struct image_simd_ops *image_simd = NULL;
+
+#ifdef IMAGE_USE_SSE2
+
+#define SIMD_NAME	"sse2"
+#define SIMD_FUNC(X)	X##_sse2
+#define SIMD_TARGET
+#define VEC		__m128i
+#define V_SIZE		16
+#define V_LOAD(P)	_mm_loadu_si128((const __m128i *)(P))
+#define V_STORE(P,X)	_mm_storeu_si128((__m128i *)(P), (X))
+#define V_ZERO()	_mm_setzero_si128()
+#define V_SET1_8(X)	_mm_set1_epi8(X)
+#define V_SET1_16(X)	_mm_set1_epi16(X)
+#define V_ADDS(A,B)	_mm_adds_epu8(A,B)
+#define V_SUBS(A,B)	_mm_subs_epu8(A,B)
+#define V_MAX(A,B)	_mm_max_epu8(A,B)
+#define V_MIN(A,B)	_mm_min_epu8(A,B)
+#define V_AND(A,B)	_mm_and_si128(A,B)
+#define V_OR(A,B)	_mm_or_si128(A,B)
+#define V_XOR(A,B)	_mm_xor_si128(A,B)
+#define V_ADD16(A,B)	_mm_add_epi16(A,B)
+#define V_MULLO16(A,B)	_mm_mullo_epi16(A,B)
+#define V_SRLI16(A,N)	_mm_srli_epi16(A,N)
+#define V_UNPACKLO8(A,B) _mm_unpacklo_epi8(A,B)
+#define V_UNPACKHI8(A,B) _mm_unpackhi_epi8(A,B)
+#define V_PACKUS16(A,B)	_mm_packus_epi16(A,B)
+#define V_ANDNOT(A,B)	_mm_andnot_si128(A,B)
+#define V_SUB16(A,B)	_mm_sub_epi16(A,B)
+#define V_MADD16(A,B)	_mm_madd_epi16(A,B)
+#define V_UNPACKLO16(A,B) _mm_unpacklo_epi16(A,B)
+#define V_UNPACKHI16(A,B) _mm_unpackhi_epi16(A,B)
+#define V_SET1_32(X)	_mm_set1_epi32(X)
+#define V_ADD32(A,B)	_mm_add_epi32(A,B)
+#define V_CMPLT32(A,B)	_mm_cmplt_epi32(A,B)
+#define V_IDX_LO()	_mm_setr_epi32(0,1,2,3)
+#define V_IDX_HI()	_mm_setr_epi32(4,5,6,7)
+
+#include "simd_oper.h"
+
+#undef SIMD_NAME
+#undef SIMD_FUNC
+#undef SIMD_TARGET
+#undef VEC
+#undef V_SIZE
+#undef V_LOAD
+#undef V_STORE
+#undef V_ZERO
+#undef V_SET1_8
+#undef V_SET1_16
+#undef V_ADDS
+#undef V_SUBS
+#undef V_MAX
+#undef V_MIN
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_ADD16
+#undef V_MULLO16
+#undef V_SRLI16
+#undef V_UNPACKLO8
+#undef V_UNPACKHI8
+#undef V_PACKUS16
+#undef V_ANDNOT
+#undef V_SUB16
+#undef V_MADD16
+#undef V_UNPACKLO16
+#undef V_UNPACKHI16
+#undef V_SET1_32
+#undef V_ADD32
+#undef V_CMPLT32
+#undef V_IDX_LO
+#undef V_IDX_HI
+
+#endif /* IMAGE_USE_SSE2 */
+
+#ifdef IMAGE_USE_AVX2
+
+/* NB: unpack and pack work within the 128 bit lanes, so the bytes
+ *     end up in the right order after a pack of the unpacked halves.
+ *     For the same reason the low half of a 16 bit unpack holds the
+ *     elements 0-3 and 8-11, see V_IDX_LO and V_IDX_HI.
+ */
+#define SIMD_NAME	"avx2"
+#define SIMD_FUNC(X)	X##_avx2
+#define SIMD_TARGET	__attribute__((target("avx2")))
+#define VEC		__m256i
+#define V_SIZE		32
+#define V_LOAD(P)	_mm256_loadu_si256((const __m256i *)(P))
+#define V_STORE(P,X)	_mm256_storeu_si256((__m256i *)(P), (X))
+#define V_ZERO()	_mm256_setzero_si256()
+#define V_SET1_8(X)	_mm256_set1_epi8(X)
+#define V_SET1_16(X)	_mm256_set1_epi16(X)
+#define V_ADDS(A,B)	_mm256_adds_epu8(A,B)
+#define V_SUBS(A,B)	_mm256_subs_epu8(A,B)
+#define V_MAX(A,B)	_mm256_max_epu8(A,B)
+#define V_MIN(A,B)	_mm256_min_epu8(A,B)
+#define V_AND(A,B)	_mm256_and_si256(A,B)
+#define V_OR(A,B)	_mm256_or_si256(A,B)
+#define V_XOR(A,B)	_mm256_xor_si256(A,B)
+#define V_ADD16(A,B)	_mm256_add_epi16(A,B)
+#define V_MULLO16(A,B)	_mm256_mullo_epi16(A,B)
+#define V_SRLI16(A,N)	_mm256_srli_epi16(A,N)
+#define V_UNPACKLO8(A,B) _mm256_unpacklo_epi8(A,B)
+#define V_UNPACKHI8(A,B) _mm256_unpackhi_epi8(A,B)
+#define V_PACKUS16(A,B)	_mm256_packus_epi16(A,B)
+#define V_ANDNOT(A,B)	_mm256_andnot_si256(A,B)
+#define V_SUB16(A,B)	_mm256_sub_epi16(A,B)
+#define V_MADD16(A,B)	_mm256_madd_epi16(A,B)
+#define V_UNPACKLO16(A,B) _mm256_unpacklo_epi16(A,B)
+#define V_UNPACKHI16(A,B) _mm256_unpackhi_epi16(A,B)
+#define V_SET1_32(X)	_mm256_set1_epi32(X)
+#define V_ADD32(A,B)	_mm256_add_epi32(A,B)
+#define V_CMPLT32(A,B)	_mm256_cmpgt_epi32(B,A)
+#define V_IDX_LO()	_mm256_setr_epi32(0,1,2,3,8,9,10,11)
+#define V_IDX_HI()	_mm256_setr_epi32(4,5,6,7,12,13,14,15)
+
+#include "simd_oper.h"
+
+#endif /* IMAGE_USE_AVX2 */
+
+void init_image_simd(void)
+{
+#ifdef IMAGE_USE_AVX2
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+   {
+      image_simd = &ops_avx2;
+      return;
+   }
+#endif
+#ifdef IMAGE_USE_SSE2
+   image_simd = &ops_sse2;
+#endif
+}
+
+/*
+**! module Image
+**! method string simd_type()
+**!	Returns the instruction set used for the vectorised pixel
+**!	operators, like <tt>"sse2"</tt> or <tt>"avx2"</tt>, or 0 if
+**!	the plain C versions are used.
+*/
+
+void image_simd_type(INT32 args)
+{
+   pop_n_elems(args);
+   if (image_simd)
+      push_text(image_simd->name);
+   else
+      push_int(0);
+}
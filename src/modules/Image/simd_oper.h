@@ -0,0 +1,185 @@
+/*
+|| This file is part of Pike. For copyright information see COPYRIGHT.
+|| Pike is distributed under GPL, LGPL and MPL. See the file COPYING
+|| for more information.
+*/
+
+/* template for the vectorised pixel functions in simd.c
+ *
+ * The functions work on the bytes of packed rgb_group arrays, which
+ * is fine for the operators that treat all channels the same. Every
+ * call handles a multiple of V_SIZE pixels, which is three vectors,
+ * and returns the number of pixels handled. The caller does the
+ * rest with the scalar code.
+ */
+
+#define V_BLOCKS(N) (((N)/V_SIZE)*3)
+
+/* (x+1+(x>>8))>>8 == x/255 for all x in 0..255*255 */
+static SIMD_TARGET inline VEC SIMD_FUNC(div255)(VEC x)
+{
+   return V_SRLI16(V_ADD16(V_ADD16(x, V_SET1_16(1)), V_SRLI16(x, 8)), 8);
+}
+
+/* (a*b)/255 for each byte */
+static SIMD_TARGET inline VEC SIMD_FUNC(mul255)(VEC a, VEC b)
+{
+   VEC z = V_ZERO();
+   VEC lo = V_MULLO16(V_UNPACKLO8(a, z), V_UNPACKLO8(b, z));
+   VEC hi = V_MULLO16(V_UNPACKHI8(a, z), V_UNPACKHI8(b, z));
+   return V_PACKUS16(SIMD_FUNC(div255)(lo), SIMD_FUNC(div255)(hi));
+}
+
+#define SIMD_BINARY(NAME, EXPR)						\
+   static SIMD_TARGET INT32 SIMD_FUNC(NAME)(rgb_group *d,		\
+					    const rgb_group *s1,	\
+					    const rgb_group *s2,	\
+					    INT32 npixels)		\
+   {									\
+      unsigned char *dd = (unsigned char *)d;				\
+      const unsigned char *a = (const unsigned char *)s1;		\
+      const unsigned char *b = (const unsigned char *)s2;		\
+      INT32 n = V_BLOCKS(npixels);					\
+      while (n--)							\
+      {									\
+	 VEC x = V_LOAD(a), y = V_LOAD(b);				\
+	 V_STORE(dd, (EXPR));						\
+	 a += sizeof(VEC); b += sizeof(VEC); dd += sizeof(VEC);		\
+      }									\
+      return (npixels/V_SIZE)*V_SIZE;					\
+   }
+
+SIMD_BINARY(add, V_ADDS(x, y))
+SIMD_BINARY(sub, V_SUBS(x, y))
+SIMD_BINARY(invsub, V_SUBS(y, x))
+SIMD_BINARY(absdiff, V_OR(V_SUBS(x, y), V_SUBS(y, x)))
+SIMD_BINARY(mult, SIMD_FUNC(mul255)(x, y))
+SIMD_BINARY(imult, SIMD_FUNC(mul255)(x, V_XOR(y, V_SET1_8(-1))))
+SIMD_BINARY(max, V_MAX(x, y))
+SIMD_BINARY(min, V_MIN(x, y))
+SIMD_BINARY(bit_and, V_AND(x, y))
+SIMD_BINARY(bit_or, V_OR(x, y))
+SIMD_BINARY(bit_xor, V_XOR(x, y))
+
+#undef SIMD_BINARY
+
+static SIMD_TARGET INT32 SIMD_FUNC(invert)(rgb_group *d, const rgb_group *s,
+					   INT32 npixels)
+{
+   unsigned char *dd = (unsigned char *)d;
+   const unsigned char *a = (const unsigned char *)s;
+   INT32 n = V_BLOCKS(npixels);
+   VEC ones = V_SET1_8(-1);
+   while (n--)
+   {
+      V_STORE(dd, V_XOR(V_LOAD(a), ones));
+      a += sizeof(VEC); dd += sizeof(VEC);
+   }
+   return (npixels/V_SIZE)*V_SIZE;
+}
+
+/* d = (s1*alpha + s2*(255-alpha))/255 */
+static SIMD_TARGET INT32 SIMD_FUNC(blend)(rgb_group *d, const rgb_group *s1,
+					  const rgb_group *s2, INT32 npixels,
+					  int alpha)
+{
+   unsigned char *dd = (unsigned char *)d;
+   const unsigned char *a = (const unsigned char *)s1;
+   const unsigned char *b = (const unsigned char *)s2;
+   INT32 n = V_BLOCKS(npixels);
+   VEC z = V_ZERO();
+   VEC wa = V_SET1_16(alpha), wb = V_SET1_16(COLORMAX - alpha);
+   while (n--)
+   {
+      VEC x = V_LOAD(a), y = V_LOAD(b);
+      VEC lo = V_ADD16(V_MULLO16(V_UNPACKLO8(x, z), wa),
+		       V_MULLO16(V_UNPACKLO8(y, z), wb));
+      VEC hi = V_ADD16(V_MULLO16(V_UNPACKHI8(x, z), wa),
+		       V_MULLO16(V_UNPACKHI8(y, z), wb));
+      V_STORE(dd, V_PACKUS16(SIMD_FUNC(div255)(lo), SIMD_FUNC(div255)(hi)));
+      a += sizeof(VEC); b += sizeof(VEC); dd += sizeof(VEC);
+   }
+   return (npixels/V_SIZE)*V_SIZE;
+}
+
+/* Returns the index of the color in the planes pr, pg and pb that is
+ * closest to col[0..2] by the distance
+ *
+ *   col[3]*(r-col[0])^2 + col[4]*(g-col[1])^2 + col[5]*(b-col[2])^2
+ *
+ * and stores the distance in *dist. Of equally close colors the one
+ * with the lowest index is picked.
+ *
+ * The planes are read in blocks of V_SIZE/2 colors, so they must be
+ * padded with copies of a real color to a multiple of that. The
+ * weighted differences must fit in 16 bits.
+ */
+static SIMD_TARGET INT32 SIMD_FUNC(nearest)(const INT16 *pr, const INT16 *pg,
+					    const INT16 *pb, INT32 n,
+					    const INT16 *col, INT32 *dist)
+{
+   VEC z = V_ZERO();
+   VEC cr = V_SET1_16(col[0]), cg = V_SET1_16(col[1]), cb = V_SET1_16(col[2]);
+   VEC wr = V_SET1_16(col[3]), wg = V_SET1_16(col[4]), wb = V_SET1_16(col[5]);
+   VEC best_lo = V_SET1_32(0x7fffffff), best_hi = best_lo;
+   VEC bi_lo = z, bi_hi = z;
+   VEC idx_lo = V_IDX_LO(), idx_hi = V_IDX_HI();
+   VEC step = V_SET1_32(V_SIZE/2);
+   INT32 bd[V_SIZE/2], bi[V_SIZE/2];
+   INT32 i, res = 0, resd = 0x7fffffff;
+
+   for (i = 0; i < n; i += V_SIZE/2)
+   {
+      VEC dr = V_SUB16(V_LOAD(pr+i), cr);
+      VEC dg = V_SUB16(V_LOAD(pg+i), cg);
+      VEC db = V_SUB16(V_LOAD(pb+i), cb);
+      VEC er = V_MULLO16(dr, wr), eg = V_MULLO16(dg, wg), eb = V_MULLO16(db, wb);
+      VEC lo = V_ADD32(V_MADD16(V_UNPACKLO16(dr, dg), V_UNPACKLO16(er, eg)),
+		       V_MADD16(V_UNPACKLO16(db, z), V_UNPACKLO16(eb, z)));
+      VEC hi = V_ADD32(V_MADD16(V_UNPACKHI16(dr, dg), V_UNPACKHI16(er, eg)),
+		       V_MADD16(V_UNPACKHI16(db, z), V_UNPACKHI16(eb, z)));
+      VEC m = V_CMPLT32(lo, best_lo);
+      best_lo = V_OR(V_AND(m, lo), V_ANDNOT(m, best_lo));
+      bi_lo = V_OR(V_AND(m, idx_lo), V_ANDNOT(m, bi_lo));
+      m = V_CMPLT32(hi, best_hi);
+      best_hi = V_OR(V_AND(m, hi), V_ANDNOT(m, best_hi));
+      bi_hi = V_OR(V_AND(m, idx_hi), V_ANDNOT(m, bi_hi));
+      idx_lo = V_ADD32(idx_lo, step);
+      idx_hi = V_ADD32(idx_hi, step);
+   }
+
+   V_STORE(bd, best_lo);
+   V_STORE(bd + V_SIZE/4, best_hi);
+   V_STORE(bi, bi_lo);
+   V_STORE(bi + V_SIZE/4, bi_hi);
+   for (i = 0; i < V_SIZE/2; i++)
+      if (bd[i] < resd || (bd[i] == resd && bi[i] < res))
+      {
+	 resd = bd[i];
+	 res = bi[i];
+      }
+
+   *dist = resd;
+   return res;
+}
+
+static const struct image_simd_ops SIMD_FUNC(ops) =
+{
+   SIMD_NAME,
+   SIMD_FUNC(add),
+   SIMD_FUNC(sub),
+   SIMD_FUNC(invsub),
+   SIMD_FUNC(absdiff),
+   SIMD_FUNC(mult),
+   SIMD_FUNC(imult),
+   SIMD_FUNC(max),
+   SIMD_FUNC(min),
+   SIMD_FUNC(bit_and),
+   SIMD_FUNC(bit_or),
+   SIMD_FUNC(bit_xor),
+   SIMD_FUNC(invert),
+   SIMD_FUNC(blend),
+   SIMD_FUNC(nearest),
+};
+
+#undef V_BLOCKS
@@ -5539,6 +5539,8 @@ void init_parser_html(void)
    ADD_FUNCTION("parse_tag_args",html_parse_tag_args,
 		tFunc(tStr,tMap(tStr,tStr)),0);
 
+   init_parser_html_tokenizer();
+
    init_calc_chars();
 }
 
@@ -0,0 +1,940 @@
+/*
+|| This file is part of Pike. For copyright information see COPYRIGHT.
+|| Pike is distributed under GPL, LGPL and MPL. See the file COPYING
+|| for more information.
+*/
+
+#include "global.h"
+#include "config.h"
+
+#include "pike_macros.h"
+#include "object.h"
+#include "constants.h"
+#include "interpret.h"
+#include "svalue.h"
+#include "array.h"
+#include "pike_error.h"
+#include "builtin_functions.h"
+#include "module_support.h"
+#include "mapping.h"
+#include "stralloc.h"
+
+#include "parser.h"
+
+
+#define sp Pike_sp
+
+/*! @module Parser
+ */
+
+/*! @class HTML
+ */
+
+/*! @class Tokenizer
+ *! A pull tokenizer for HTML, for bulk scanning where the callbacks
+ *! of @[Parser.HTML] would cost more than the actual work, e.g. when
+ *! extracting links or stripping markup.
+ *!
+ *! Data is fed with @[feed()], and @[next()] steps to the next
+ *! token. A token is described by its type and positions in the fed
+ *! stream, see @[token()]; strings and argument mappings are only
+ *! created when asked for. Only the data from the current token and
+ *! on is kept, so memory use is bounded by the size of the largest
+ *! tag rather than the size of the document.
+ *!
+ *! Tokens can also be handled by built-in actions, see
+ *! @[set_action()] and @[set_tag_action()], in which case @[next()]
+ *! doesn't return them. If every token type has an action, a single
+ *! call to @[next()] processes all data fed so far.
+ *!
+ *! @example
+ *!   Parser.HTML.Tokenizer t = Parser.HTML.Tokenizer();
+ *!   t->set_action(t->TOKEN_TAG, t->ACTION_DROP)
+ *!    ->set_action(t->TOKEN_END_TAG, t->ACTION_DROP)
+ *!    ->set_action(t->TOKEN_COMMENT, t->ACTION_DROP)
+ *!    ->set_action(t->TOKEN_DECL, t->ACTION_DROP)
+ *!    ->set_action(t->TOKEN_PI, t->ACTION_DROP)
+ *!    ->set_action(t->TOKEN_TEXT, t->ACTION_KEEP)
+ *!    ->set_tag_action("script", t->ACTION_DROP_CONTENT)
+ *!    ->set_tag_action("style", t->ACTION_DROP_CONTENT)
+ *!    ->set_tag_action("a", t->ACTION_COLLECT, "href");
+ *!   while (string s = file->read(65536)) {
+ *!     if (s == "") break;
+ *!     t->feed(s)->next();
+ *!     text += t->read();
+ *!   }
+ *!   t->finish()->next();
+ *!   text += t->read();
+ *!   links = t->collected();
+ *!
+ *! @note
+ *!   No entities are decoded, neither in text nor in argument values.
+ *!
+ *! @seealso
+ *!   @[Parser.HTML]
+ */
+
+/*! @decl constant TOKEN_TEXT = 1
+ *! @decl constant TOKEN_TAG = 2
+ *! @decl constant TOKEN_END_TAG = 3
+ *! @decl constant TOKEN_COMMENT = 4
+ *! @decl constant TOKEN_DECL = 5
+ *! @decl constant TOKEN_PI = 6
+ *!
+ *! Token types: text, start tag (@expr{<a href=x>@}), end tag
+ *! (@expr{</a>@}), comment (@expr{<!--...-->@}), declaration
+ *! (@expr{<!DOCTYPE html>@}) and processing instruction
+ *! (@expr{<?xml ...?>@}).
+ */
+#define TOKEN_TEXT	1
+#define TOKEN_TAG	2
+#define TOKEN_END_TAG	3
+#define TOKEN_COMMENT	4
+#define TOKEN_DECL	5
+#define TOKEN_PI	6
+
+/*! @decl constant ACTION_RETURN = 0
+ *!   Return the token from @[next()]. This is the default.
+ *! @decl constant ACTION_DROP = 1
+ *!   Discard the token.
+ *! @decl constant ACTION_KEEP = 2
+ *!   Append the token as is to the output returned by @[read()].
+ *! @decl constant ACTION_COLLECT = 3
+ *!   Append the value of an argument of a start tag to the array
+ *!   returned by @[collected()], and discard the tag. Only for
+ *!   @[set_tag_action()].
+ *! @decl constant ACTION_DROP_CONTENT = 4
+ *!   Discard a start tag and everything up to and including its end
+ *!   tag, e.g. for @expr{<script>@}. Only for @[set_tag_action()].
+ */
+#define ACTION_RETURN		0
+#define ACTION_DROP		1
+#define ACTION_KEEP		2
+#define ACTION_COLLECT		3
+#define ACTION_DROP_CONTENT	4
+
+struct tag_action
+{
+   struct pike_string *name;
+   struct pike_string *attr;
+   int action;
+};
+
+struct html_tokenizer
+{
+   struct pike_string *buf;	/* data from the current token and on */
+   ptrdiff_t base;		/* stream position of buf[0] */
+   ptrdiff_t pos;		/* next position to scan */
+   int finished;
+
+   /* The current token, positions relative to buf. */
+   int type;
+   ptrdiff_t start, end;
+   ptrdiff_t name_start, name_end;
+   struct array *spans;		/* argument spans, when asked for */
+
+   int actions[TOKEN_PI + 1];
+   struct tag_action *tag_actions;
+   int num_tag_actions;
+
+   int skip;			/* tag action we're dropping content for */
+
+   struct string_builder out;
+   struct pike_string **collected;
+   ptrdiff_t num_collected, collected_size;
+};
+
+#define THIS ((struct html_tokenizer *)Pike_fp->current_storage)
+#define THISOBJ (Pike_fp->current_object)
+
+#define CH(T,I) INDEX_PCHARP(MKPCHARP_STR((T)->buf), (I))
+
+static inline int is_ws(p_wchar2 c)
+{
+   return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+      c == '\f';
+}
+
+static inline int is_alpha(p_wchar2 c)
+{
+   return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline p_wchar2 lower(p_wchar2 c)
+{
+   return (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+}
+
+/* Compares buf[pos..pos+len-1] with s, ignoring ASCII case. */
+static int match_nocase(struct html_tokenizer *t, ptrdiff_t pos,
+			struct pike_string *s)
+{
+   ptrdiff_t i;
+   if (pos + s->len > t->buf->len) return 0;
+   for (i = 0; i < s->len; i++)
+      if (lower(CH(t, pos + i)) != lower(index_shared_string(s, i)))
+	 return 0;
+   return 1;
+}
+
+static ptrdiff_t find_char(struct html_tokenizer *t, ptrdiff_t pos,
+			   p_wchar2 c)
+{
+   ptrdiff_t len = t->buf->len;
+   if (!t->buf->size_shift) {
+      const p_wchar0 *s = STR0(t->buf);
+      const p_wchar0 *p = memchr(s + pos, c, len - pos);
+      return p ? p - s : -1;
+   }
+   for (; pos < len; pos++)
+      if (CH(t, pos) == c) return pos;
+   return -1;
+}
+
+/* Finds the ASCII string 'what' at or after pos. */
+static ptrdiff_t find_str(struct html_tokenizer *t, ptrdiff_t pos,
+			  const char *what)
+{
+   ptrdiff_t n = strlen(what), len = t->buf->len, i;
+   while ((pos = find_char(t, pos, what[0])) >= 0) {
+      if (pos + n > len) return -1;
+      for (i = 1; i < n && CH(t, pos + i) == (p_wchar2)what[i]; i++);
+      if (i == n) return pos;
+      pos++;
+   }
+   return -1;
+}
+
+/*
+ * Tag arguments
+ *
+ * Scans the arguments of a tag from pos, which is just after the tag
+ * name, and returns the position after the closing '>', or -1 if the
+ * buffer ends first. The syntax is that of HTML 5: an argument value
+ * is either quoted or runs up to whitespace or '>', and quotes
+ * anywhere else are ordinary characters. The callback, if any, gets
+ * the name and value span of every argument; for arguments without a
+ * value the value span is the name span.
+ */
+
+typedef void arg_cb(void *ctx, ptrdiff_t ns, ptrdiff_t ne,
+		    ptrdiff_t vs, ptrdiff_t ve);
+
+static ptrdiff_t scan_args(struct html_tokenizer *t, ptrdiff_t pos,
+			   arg_cb *cb, void *ctx)
+{
+   ptrdiff_t len = t->buf->len;
+   ptrdiff_t ns, ne, vs, ve;
+   p_wchar2 c;
+
+   for (;;) {
+      while (pos < len && (is_ws(c = CH(t, pos)) || c == '/')) pos++;
+      if (pos >= len) return -1;
+      if (c == '>') return pos + 1;
+
+      ns = pos++;
+      while (pos < len && !is_ws(c = CH(t, pos)) &&
+	     c != '/' && c != '=' && c != '>')
+	 pos++;
+      ne = pos;
+      while (pos < len && is_ws(c = CH(t, pos))) pos++;
+      if (pos >= len) return -1;
+
+      vs = ns;
+      ve = ne;
+      if (c == '=') {
+	 pos++;
+	 while (pos < len && is_ws(c = CH(t, pos))) pos++;
+	 if (pos >= len) return -1;
+	 if (c == '"' || c == '\'') {
+	    ptrdiff_t q = find_char(t, pos + 1, c);
+	    if (q < 0) return -1;
+	    vs = pos + 1;
+	    ve = q;
+	    pos = q + 1;
+	 } else {
+	    vs = pos;
+	    while (pos < len && !is_ws(c = CH(t, pos)) && c != '>') pos++;
+	    if (pos >= len) return -1;
+	    ve = pos;
+	 }
+      }
+      if (cb) cb(ctx, ns, ne, vs, ve);
+   }
+}
+
+/*
+ * Scanning
+ */
+
+/* Scans the token at t->pos. Returns 0 if more data is needed. */
+static int scan_token(struct html_tokenizer *t)
+{
+   ptrdiff_t len = t->buf->len, pos = t->pos, e;
+   p_wchar2 c;
+
+   t->start = pos;
+
+   if (CH(t, pos) != '<') {
+      /* Text runs up to the next '<', or as far as we've got. */
+      e = find_char(t, pos + 1, '<');
+      goto text;
+   }
+
+   if (pos + 1 >= len) goto more;
+   c = CH(t, pos + 1);
+
+   if (c == '!') {
+      if (pos + 4 > len && !t->finished) {
+	 /* Could be the start of a comment. */
+	 if (pos + 2 >= len || (CH(t, pos + 2) == '-' &&
+				(pos + 3 >= len || CH(t, pos + 3) == '-')))
+	    return 0;
+      }
+      if (pos + 4 <= len && CH(t, pos + 2) == '-' && CH(t, pos + 3) == '-') {
+	 if ((e = find_str(t, pos + 4, "-->")) < 0) goto more;
+	 t->type = TOKEN_COMMENT;
+	 t->name_start = pos + 4;
+	 t->name_end = e;
+	 t->end = e + 3;
+	 return 1;
+      }
+      if ((e = find_char(t, pos + 2, '>')) < 0) goto more;
+      t->type = TOKEN_DECL;
+      t->name_start = pos + 2;
+      t->name_end = e;
+      t->end = e + 1;
+      return 1;
+   }
+
+   if (c == '?') {
+      if ((e = find_char(t, pos + 2, '>')) < 0) goto more;
+      t->type = TOKEN_PI;
+      t->name_start = pos + 2;
+      t->name_end = (e > pos + 2 && CH(t, e - 1) == '?') ? e - 1 : e;
+      t->end = e + 1;
+      return 1;
+   }
+
+   if (c == '/') {
+      if (pos + 2 >= len) goto more;
+      if (!is_alpha(CH(t, pos + 2))) goto lt_text;
+      t->type = TOKEN_END_TAG;
+      pos += 2;
+   } else if (is_alpha(c)) {
+      t->type = TOKEN_TAG;
+      pos++;
+   } else
+      goto lt_text;
+
+   t->name_start = pos;
+   while (pos < len && !is_ws(c = CH(t, pos)) && c != '/' && c != '>')
+      pos++;
+   t->name_end = pos;
+   if ((e = scan_args(t, pos, NULL, NULL)) < 0) goto more;
+   t->end = e;
+   return 1;
+
+more:
+   /* Unterminated markup at the end of the data is text. */
+   if (!t->finished) return 0;
+   e = len;
+   goto text;
+
+lt_text:
+   /* A '<' that doesn't start markup. */
+   e = find_char(t, pos + 1, '<');
+
+text:
+   if (e < 0) e = len;
+   t->type = TOKEN_TEXT;
+   t->name_start = t->start;
+   t->name_end = t->end = e;
+   return 1;
+}
+
+/* Skips data up to and including the end tag of the tag action
+ * t->skip. Returns 0 if more data is needed. */
+static int skip_content(struct html_tokenizer *t)
+{
+   struct pike_string *name = t->tag_actions[t->skip].name;
+   ptrdiff_t len = t->buf->len, pos = t->pos, e;
+   p_wchar2 c;
+
+   while ((pos = find_char(t, pos, '<')) >= 0) {
+      if (pos + 2 + name->len >= len) {
+	 if (!t->finished) break;
+      } else {
+	 c = CH(t, pos + 2 + name->len);
+	 if (CH(t, pos + 1) == '/' && match_nocase(t, pos + 2, name) &&
+	     (is_ws(c) || c == '/' || c == '>')) {
+	    if ((e = find_char(t, pos + 2 + name->len, '>')) < 0) {
+	       if (!t->finished) {
+		  t->pos = pos;
+		  return 0;
+	       }
+	       e = len - 1;
+	    }
+	    t->pos = e + 1;
+	    t->skip = -1;
+	    return 1;
+	 }
+      }
+      pos++;
+   }
+
+   if (t->finished) {
+      t->pos = len;
+      t->skip = -1;
+      return 1;
+   }
+
+   /* Keep what could be the start of the end tag. */
+   if (len - name->len - 2 > t->pos)
+      t->pos = len - name->len - 2;
+   return 0;
+}
+
+static int find_tag_action(struct html_tokenizer *t, ptrdiff_t start,
+			   ptrdiff_t end)
+{
+   int i;
+   for (i = 0; i < t->num_tag_actions; i++) {
+      struct pike_string *name = t->tag_actions[i].name;
+      if (name->len == end - start && match_nocase(t, start, name))
+	 return i;
+   }
+   return -1;
+}
+
+struct find_arg_ctx
+{
+   struct html_tokenizer *t;
+   struct pike_string *name;
+   ptrdiff_t vs, ve;
+};
+
+static void find_arg_cb(void *ctx, ptrdiff_t ns, ptrdiff_t ne,
+			ptrdiff_t vs, ptrdiff_t ve)
+{
+   struct find_arg_ctx *f = ctx;
+   if (f->vs < 0 && f->name->len == ne - ns &&
+       match_nocase(f->t, ns, f->name)) {
+      f->vs = vs;
+      f->ve = ve;
+   }
+}
+
+/* Returns the value of the first argument called name in the
+ * current tag, or NULL. */
+static struct pike_string *find_arg(struct html_tokenizer *t,
+				    struct pike_string *name)
+{
+   struct find_arg_ctx f;
+   f.t = t;
+   f.name = name;
+   f.vs = -1;
+   scan_args(t, t->name_end, find_arg_cb, &f);
+   if (f.vs < 0) return NULL;
+   return string_slice(t->buf, f.vs, f.ve - f.vs);
+}
+
+static void clear_token(struct html_tokenizer *t)
+{
+   t->type = 0;
+   if (t->spans) {
+      free_array(t->spans);
+      t->spans = NULL;
+   }
+}
+
+static void no_token(const char *func)
+{
+   Pike_error("%s: No current token.\n", func);
+}
+
+/*! @decl this_program feed(string s)
+ *!
+ *! Adds @[s] to the data to tokenize. No scanning is done until
+ *! @[next()] is called.
+ *!
+ *! @returns
+ *!   Returns the object being called.
+ */
+static void tok_feed(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   struct pike_string *s;
+   ptrdiff_t keep;
+
+   get_all_args("feed", args, "%t", &s);
+   if (t->finished)
+      Pike_error("feed: Already finished.\n");
+
+   if (!t->buf) {
+      copy_shared_string(t->buf, s);
+   } else {
+      /* Drop the data before the current token. */
+      struct pike_string *old = t->buf;
+      keep = t->type ? t->start : t->pos;
+      add_ref(s);
+      t->buf = add_and_free_shared_strings(string_slice(old, keep,
+							old->len - keep),
+					   s);
+      free_string(old);
+      t->base += keep;
+      t->pos -= keep;
+      t->start -= keep;
+      t->end -= keep;
+      t->name_start -= keep;
+      t->name_end -= keep;
+   }
+
+   pop_n_elems(args);
+   ref_push_object(THISOBJ);
+}
+
+/*! @decl this_program finish(void|string s)
+ *!
+ *! Tells the tokenizer that there is no more data, after adding
+ *! @[s] if given. Unterminated markup at the end is then returned as
+ *! text.
+ *!
+ *! @returns
+ *!   Returns the object being called.
+ */
+static void tok_finish(INT32 args)
+{
+   if (args && TYPEOF(sp[-args]) == T_STRING) {
+      tok_feed(args);
+      pop_stack();
+   } else
+      pop_n_elems(args);
+   THIS->finished = 1;
+   ref_push_object(THISOBJ);
+}
+
+/*! @decl int next()
+ *!
+ *! Steps to the next token, handling the tokens before it that have
+ *! actions.
+ *!
+ *! @returns
+ *!   Returns the type of the token, or @expr{0@} if more data has to
+ *!   be fed (or, after @[finish()], if there are no more tokens).
+ *!
+ *! @note
+ *!   Text is returned as soon as it's been fed, so a run of text may
+ *!   come as several tokens.
+ */
+static void tok_next(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   int action, i;
+
+   pop_n_elems(args);
+   clear_token(t);
+
+   while (t->buf && t->pos < t->buf->len) {
+      if (t->skip >= 0 && !skip_content(t)) break;
+      if (t->pos >= t->buf->len || !scan_token(t)) break;
+      t->pos = t->end;
+
+      i = -1;
+      if (t->type == TOKEN_TAG || t->type == TOKEN_END_TAG)
+	 i = find_tag_action(t, t->name_start, t->name_end);
+      action = (i >= 0) ? t->tag_actions[i].action : t->actions[t->type];
+
+      switch (action) {
+	 case ACTION_RETURN:
+	    push_int(t->type);
+	    return;
+
+	 case ACTION_KEEP:
+	    string_builder_append(&t->out, MKPCHARP_STR_OFF(t->buf, t->start),
+				  t->end - t->start);
+	    break;
+
+	 case ACTION_COLLECT:
+	    if (t->type == TOKEN_TAG) {
+	       struct pike_string *v = find_arg(t, t->tag_actions[i].attr);
+	       if (v) {
+		  if (t->num_collected == t->collected_size) {
+		     struct pike_string **c;
+		     ptrdiff_t size = t->collected_size ? 2 * t->collected_size : 16;
+		     if (!(c = realloc(t->collected, size * sizeof(*c)))) {
+			free_string(v);
+			SIMPLE_OUT_OF_MEMORY_ERROR("next", size * sizeof(*c));
+		     }
+		     t->collected = c;
+		     t->collected_size = size;
+		  }
+		  t->collected[t->num_collected++] = v;
+	       }
+	    }
+	    break;
+
+	 case ACTION_DROP_CONTENT:
+	    if (t->type == TOKEN_TAG && CH(t, t->end - 2) != '/')
+	       t->skip = i;
+	    break;
+      }
+      t->type = 0;
+   }
+
+   t->type = 0;
+   push_int(0);
+}
+
+/*! @decl array(int) token()
+ *!
+ *! Returns the current token as
+ *! @expr{({ type, start, end, name_start, name_end })@}, where the
+ *! positions are character offsets in the fed stream, with the ends
+ *! exclusive. The name is the tag name for tags, the contents for
+ *! comments, declarations and processing instructions, and the
+ *! whole token for text.
+ *!
+ *! Returns @expr{0@} if there's no current token.
+ */
+static void tok_token(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   pop_n_elems(args);
+   if (!t->type) {
+      push_int(0);
+      return;
+   }
+   push_int(t->type);
+   push_int(t->base + t->start);
+   push_int(t->base + t->end);
+   push_int(t->base + t->name_start);
+   push_int(t->base + t->name_end);
+   f_aggregate(5);
+}
+
+/*! @decl string text()
+ *! @decl string text(int start, int end)
+ *!
+ *! Returns the current token as it was fed, or the data between two
+ *! stream positions within it, e.g. from @[arg_spans()].
+ */
+static void tok_text(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   INT_TYPE start, end;
+
+   if (!t->type) no_token("text");
+   if (args == 1)
+      SIMPLE_WRONG_NUM_ARGS_ERROR("text", 2);
+   if (args) {
+      get_all_args("text", args, "%i%i", &start, &end);
+      start -= t->base;
+      end -= t->base;
+      if (start < t->start || end > t->end || start > end)
+	 Pike_error("text: Range outside of the current token.\n");
+   } else {
+      start = t->start;
+      end = t->end;
+   }
+   pop_n_elems(args);
+   push_string(string_slice(t->buf, start, end - start));
+}
+
+/*! @decl string tag_name()
+ *!
+ *! Returns the name of the current tag, as written, or @expr{0@} if
+ *! the current token isn't a tag.
+ */
+static void tok_tag_name(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   pop_n_elems(args);
+   if (t->type != TOKEN_TAG && t->type != TOKEN_END_TAG) {
+      push_int(0);
+      return;
+   }
+   push_string(string_slice(t->buf, t->name_start,
+			    t->name_end - t->name_start));
+}
+
+static void push_span_cb(void *ctx, ptrdiff_t ns, ptrdiff_t ne,
+			 ptrdiff_t vs, ptrdiff_t ve)
+{
+   struct html_tokenizer *t = ctx;
+   push_int(t->base + ns);
+   push_int(t->base + ne);
+   push_int(t->base + vs);
+   push_int(t->base + ve);
+}
+
+/*! @decl array(int) arg_spans()
+ *!
+ *! Returns the arguments of the current tag as a flat array with
+ *! the stream positions
+ *! @expr{name_start, name_end, value_start, value_end@} for each
+ *! argument, in order. Quotes around values are not included, and
+ *! for arguments without a value the value span is the name span.
+ *!
+ *! The arguments are parsed when first asked for.
+ */
+static void tok_arg_spans(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   pop_n_elems(args);
+   if (t->type != TOKEN_TAG) {
+      ref_push_array(&empty_array);
+      return;
+   }
+   if (!t->spans) {
+      struct svalue *save_sp = sp;
+      scan_args(t, t->name_end, push_span_cb, t);
+      f_aggregate(sp - save_sp);
+      t->spans = sp[-1].u.array;
+      add_ref(t->spans);
+      return;
+   }
+   ref_push_array(t->spans);
+}
+
+/*! @decl mapping(string:string) tag_args()
+ *!
+ *! Returns the arguments of the current tag. If an argument is
+ *! given more than once, the first value is used.
+ */
+static void tok_tag_args(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   struct mapping *m;
+   struct array *a;
+   ptrdiff_t i;
+
+   tok_arg_spans(args);
+   a = sp[-1].u.array;
+   m = allocate_mapping(a->size / 4);
+   push_mapping(m);
+   for (i = 0; i < a->size; i += 4) {
+      ptrdiff_t ns = ITEM(a)[i].u.integer - t->base;
+      ptrdiff_t ne = ITEM(a)[i + 1].u.integer - t->base;
+      ptrdiff_t vs = ITEM(a)[i + 2].u.integer - t->base;
+      ptrdiff_t ve = ITEM(a)[i + 3].u.integer - t->base;
+      push_string(string_slice(t->buf, ns, ne - ns));
+      if (!low_mapping_lookup(m, sp - 1)) {
+	 push_string(string_slice(t->buf, vs, ve - vs));
+	 mapping_insert(m, sp - 2, sp - 1);
+	 pop_stack();
+      }
+      pop_stack();
+   }
+   stack_pop_keep_top();
+}
+
+/*! @decl string tag_arg(string name)
+ *!
+ *! Returns the value of the argument @[name] of the current tag, or
+ *! @expr{0@} if there is none. The name is compared without regard
+ *! to ASCII case. This doesn't parse the other arguments into
+ *! strings.
+ */
+static void tok_tag_arg(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   struct pike_string *name, *v = NULL;
+
+   get_all_args("tag_arg", args, "%t", &name);
+   if (t->type == TOKEN_TAG)
+      v = find_arg(t, name);
+   pop_n_elems(args);
+   if (v)
+      push_string(v);
+   else
+      push_int(0);
+}
+
+/*! @decl this_program set_action(int type, int action)
+ *!
+ *! Sets how tokens of @[type] are handled: one of
+ *! @[ACTION_RETURN], @[ACTION_DROP] and @[ACTION_KEEP]. For tags
+ *! this is the default for those without an action of their own, see
+ *! @[set_tag_action()].
+ *!
+ *! @returns
+ *!   Returns the object being called.
+ */
+static void tok_set_action(INT32 args)
+{
+   INT_TYPE type, action;
+
+   get_all_args("set_action", args, "%i%i", &type, &action);
+   if (type < TOKEN_TEXT || type > TOKEN_PI)
+      SIMPLE_ARG_TYPE_ERROR("set_action", 1, "token type");
+   if (action < ACTION_RETURN || action > ACTION_KEEP)
+      SIMPLE_ARG_TYPE_ERROR("set_action", 2,
+			    "ACTION_RETURN, ACTION_DROP or ACTION_KEEP");
+   THIS->actions[type] = action;
+   pop_n_elems(args);
+   ref_push_object(THISOBJ);
+}
+
+/*! @decl this_program set_tag_action(string name, int action, @
+ *!                                   void|string arg)
+ *!
+ *! Sets how the start and end tags called @[name] are handled. Tag
+ *! names are compared without regard to ASCII case. For
+ *! @[ACTION_COLLECT], @[arg] is the argument to collect.
+ *!
+ *! @returns
+ *!   Returns the object being called.
+ */
+static void tok_set_tag_action(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   struct pike_string *name, *attr = NULL;
+   struct tag_action *ta;
+   INT_TYPE action;
+   int i;
+
+   get_all_args("set_tag_action", args, "%t%i.%t", &name, &action, &attr);
+   if (action < ACTION_RETURN || action > ACTION_DROP_CONTENT)
+      SIMPLE_ARG_TYPE_ERROR("set_tag_action", 2, "action");
+   if (action == ACTION_COLLECT && !attr)
+      SIMPLE_WRONG_NUM_ARGS_ERROR("set_tag_action", 3);
+   if (!name->len)
+      SIMPLE_ARG_TYPE_ERROR("set_tag_action", 1, "non-empty string");
+
+   for (i = 0; i < t->num_tag_actions; i++) {
+      ta = t->tag_actions + i;
+      if (ta->name->len == name->len) {
+	 ptrdiff_t j;
+	 for (j = 0; j < name->len; j++)
+	    if (lower(index_shared_string(ta->name, j)) !=
+		lower(index_shared_string(name, j)))
+	       break;
+	 if (j == name->len) break;
+      }
+   }
+
+   if (i == t->num_tag_actions) {
+      if (!(ta = realloc(t->tag_actions, (i + 1) * sizeof(*ta))))
+	 SIMPLE_OUT_OF_MEMORY_ERROR("set_tag_action", (i + 1) * sizeof(*ta));
+      t->tag_actions = ta;
+      ta = t->tag_actions + i;
+      copy_shared_string(ta->name, name);
+      ta->attr = NULL;
+      t->num_tag_actions++;
+   }
+
+   ta = t->tag_actions + i;
+   if (ta->attr) free_string(ta->attr);
+   ta->attr = attr;
+   if (attr) add_ref(attr);
+   ta->action = action;
+
+   pop_n_elems(args);
+   ref_push_object(THISOBJ);
+}
+
+/*! @decl string read()
+ *!
+ *! Returns and clears the output of @[ACTION_KEEP].
+ */
+static void tok_read(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   pop_n_elems(args);
+   push_string(finish_string_builder(&t->out));
+   init_string_builder(&t->out, 0);
+}
+
+/*! @decl array(string) collected()
+ *!
+ *! Returns and clears the argument values gathered by
+ *! @[ACTION_COLLECT], in document order.
+ */
+static void tok_collected(INT32 args)
+{
+   struct html_tokenizer *t = THIS;
+   struct array *a;
+   ptrdiff_t i;
+   pop_n_elems(args);
+   a = allocate_array(t->num_collected);
+   for (i = 0; i < t->num_collected; i++)
+      SET_SVAL(ITEM(a)[i], T_STRING, 0, string, t->collected[i]);
+   if (t->num_collected) a->type_field = BIT_STRING;
+   t->num_collected = 0;
+   push_array(a);
+}
+
+/*! @endclass
+ */
+
+/*! @endclass
+ */
+
+/*! @endmodule
+ */
+
+static void init_tokenizer_struct(struct object *UNUSED(o))
+{
+   struct html_tokenizer *t = THIS;
+   t->skip = -1;
+   init_string_builder(&t->out, 0);
+}
+
+static void exit_tokenizer_struct(struct object *UNUSED(o))
+{
+   struct html_tokenizer *t = THIS;
+   int i;
+   if (t->buf) free_string(t->buf);
+   clear_token(t);
+   for (i = 0; i < t->num_tag_actions; i++) {
+      free_string(t->tag_actions[i].name);
+      if (t->tag_actions[i].attr) free_string(t->tag_actions[i].attr);
+   }
+   if (t->tag_actions) free(t->tag_actions);
+   free_string_builder(&t->out);
+   for (i = 0; i < t->num_collected; i++)
+      free_string(t->collected[i]);
+   if (t->collected) free(t->collected);
+}
+
+void init_parser_html_tokenizer(void)
+{
+   start_new_program();
+   ADD_STORAGE(struct html_tokenizer);
+
+   set_init_callback(init_tokenizer_struct);
+   set_exit_callback(exit_tokenizer_struct);
+
+   ADD_FUNCTION("feed", tok_feed, tFunc(tStr, tObj), 0);
+   ADD_FUNCTION("finish", tok_finish, tFunc(tOr(tVoid, tStr), tObj), 0);
+   ADD_FUNCTION("next", tok_next, tFunc(tNone, tInt), 0);
+
+   ADD_FUNCTION("token", tok_token, tFunc(tNone, tOr(tArr(tInt), tZero)), 0);
+   ADD_FUNCTION("text", tok_text, tFunc(tOr(tVoid,tInt) tOr(tVoid,tInt), tStr), 0);
+   ADD_FUNCTION("tag_name", tok_tag_name, tFunc(tNone, tOr(tStr, tZero)), 0);
+   ADD_FUNCTION("arg_spans", tok_arg_spans, tFunc(tNone, tArr(tInt)), 0);
+   ADD_FUNCTION("tag_args", tok_tag_args, tFunc(tNone, tMap(tStr, tStr)), 0);
+   ADD_FUNCTION("tag_arg", tok_tag_arg, tFunc(tStr, tOr(tStr, tZero)), 0);
+
+   ADD_FUNCTION("set_action", tok_set_action, tFunc(tInt tInt, tObj), 0);
+   ADD_FUNCTION("set_tag_action", tok_set_tag_action,
+		tFunc(tStr tInt tOr(tVoid, tStr), tObj), 0);
+   ADD_FUNCTION("read", tok_read, tFunc(tNone, tStr), 0);
+   ADD_FUNCTION("collected", tok_collected, tFunc(tNone, tArr(tStr)), 0);
+
+   add_integer_constant("TOKEN_TEXT", TOKEN_TEXT, 0);
+   add_integer_constant("TOKEN_TAG", TOKEN_TAG, 0);
+   add_integer_constant("TOKEN_END_TAG", TOKEN_END_TAG, 0);
+   add_integer_constant("TOKEN_COMMENT", TOKEN_COMMENT, 0);
+   add_integer_constant("TOKEN_DECL", TOKEN_DECL, 0);
+   add_integer_constant("TOKEN_PI", TOKEN_PI, 0);
+
+   add_integer_constant("ACTION_RETURN", ACTION_RETURN, 0);
+   add_integer_constant("ACTION_DROP", ACTION_DROP, 0);
+   add_integer_constant("ACTION_KEEP", ACTION_KEEP, 0);
+   add_integer_constant("ACTION_COLLECT", ACTION_COLLECT, 0);
+   add_integer_constant("ACTION_DROP_CONTENT", ACTION_DROP_CONTENT, 0);
+
+   end_class("Tokenizer", 0);
+}
@@ -6,6 +6,7 @@
 
 void init_parser_html(void);
 void exit_parser_html(void);
+void init_parser_html_tokenizer(void);
 void init_parser_rcs(void);
 void exit_parser_rcs(void);
 void init_parser_c(void);
@@ -61,13 +61,20 @@ struct regexp_glue
  *! they match themselves, nothing else. Also note that when quoting
  *! these something in Pike you need two \ because Pike also uses
  *! this character for quoting.
+ *!
+ *! The regexp is compiled to an automaton, so matching never
+ *! backtracks and takes time linear in the length of the string,
+ *! whatever the regexp looks like.
+ *!
+ *! @seealso
+ *!   @[SimpleRegexpSet]
  */
 
 static void do_free(void)
 {
   if(THIS->regexp)
   {
-    free(THIS->regexp);
+    pike_regfree(THIS->regexp);
     THIS->regexp=0;
   }
 }
@@ -85,10 +92,10 @@ static void regexp_create(INT32 args)
 {
   if(args)
   {
-    const char *str;
+    struct pike_string *str;
     do_free();
-    get_all_args(NULL, args, "%s", &str);
-    THIS->regexp=pike_regcomp(Pike_sp[-args].u.string->str);
+    get_all_args(NULL, args, "%n", &str);
+    THIS->regexp=pike_regcomp(str->str, str->len);
   }
 }
 
@@ -104,8 +111,7 @@ static void regexp_create(INT32 args)
  *!
  *! @bugs
  *!   The current implementation doesn't support searching
- *!   in strings containing the NUL character or any
- *!   wide character.
+ *!   in strings containing any wide character.
  *!
  *! @seealso
  *!   @[split]
@@ -123,7 +129,8 @@ static void regexp_match(INT32 args)
     if(Pike_sp[-args].u.string->size_shift)
       SIMPLE_ARG_TYPE_ERROR("match", 1, "string(8bit)");
 
-    i = pike_regexec(regexp, (char *)STR0(Pike_sp[-args].u.string));
+    i = pike_regexec(regexp, STR0(Pike_sp[-args].u.string),
+		     Pike_sp[-args].u.string->len);
     pop_n_elems(args);
     push_int(i);
     return;
@@ -142,7 +149,7 @@ static void regexp_match(INT32 args)
       if(TYPEOF(*sv) != T_STRING || sv->u.string->size_shift)
 	SIMPLE_ARG_TYPE_ERROR("match", 1, "string(8bit)");
 
-      if(pike_regexec(regexp, (char *)STR0(sv->u.string)))
+      if(pike_regexec(regexp, STR0(sv->u.string), sv->u.string->len))
       {
 	ref_push_string(sv->u.string);
 	n++;
@@ -168,8 +175,7 @@ static void regexp_match(INT32 args)
  *!
  *! @bugs
  *!   The current implementation doesn't support searching
- *!   in strings containing the NUL character or any
- *!   wide character.
+ *!   in strings containing any wide character.
  *!
  *! @seealso
  *!   @[match]
@@ -177,23 +183,23 @@ static void regexp_match(INT32 args)
 static void regexp_split(INT32 args)
 {
   struct pike_string *s;
-  struct regexp *r;
+  ptrdiff_t sub[2*NSUBEXP];
 
   get_all_args(NULL, args, "%S", &s);
 
-  if(pike_regexec(r=THIS->regexp, s->str))
+  if(pike_regexec_sub(THIS->regexp, STR0(s), s->len, sub))
   {
     int i,j;
     add_ref(s);
     pop_n_elems(args);
     for(j=i=1;i<NSUBEXP;i++)
     {
-      if(!r->startp[i] || !r->endp[i])
+      if(sub[2*i] < 0 || sub[2*i+1] < 0)
       {
 	push_int(0);
       }else{
-	push_string(make_shared_binary_string(r->startp[i],
-					      r->endp[i]-r->startp[i]));
+	push_string(make_shared_binary_string(s->str + sub[2*i],
+					      sub[2*i+1]-sub[2*i]));
 	j=i;
       }
     }
@@ -211,6 +217,121 @@ static void exit_regexp_glue(struct object *UNUSED(o))
   do_free();
 }
 
+/*! @endclass
+ */
+
+struct regexp_set_glue
+{
+  struct regexp *regexp;
+  int size;
+  int *ids;
+};
+
+#define THIS_SET ((struct regexp_set_glue *)(Pike_fp->current_storage))
+
+/*! @class SimpleRegexpSet
+ *!
+ *! A set of regexps in the syntax of @[SimpleRegexp], that are all
+ *! matched against a string in a single pass. The time that takes is
+ *! linear in the length of the string, and doesn't grow with the
+ *! number of regexps the way matching them one at a time would.
+ *!
+ *! @example
+ *!   Regexp.SimpleRegexpSet(({ "^GET ", "\\.png$", "admin" }))->
+ *!     match("GET /admin/logo.png");
+ *!   // Result: ({ 0, 1, 2 })
+ *!
+ *! @seealso
+ *!   @[SimpleRegexp]
+ */
+
+static void do_free_set(void)
+{
+  if(THIS_SET->regexp)
+  {
+    pike_regfree(THIS_SET->regexp);
+    THIS_SET->regexp=0;
+  }
+  if(THIS_SET->ids)
+  {
+    free(THIS_SET->ids);
+    THIS_SET->ids=0;
+  }
+  THIS_SET->size=0;
+}
+
+/*! @decl void create(array(string) regexps)
+ *!
+ *! Compiles @[regexps] into a set. A regexp that doesn't compile
+ *! throws the same error as it would in @[SimpleRegexp].
+ */
+static void regexp_set_create(INT32 args)
+{
+  struct array *a;
+  const char **exps;
+  size_t *lens;
+  ONERROR err;
+  int i;
+
+  get_all_args(NULL, args, "%a", &a);
+  do_free_set();
+
+  for(i = 0; i < a->size; i++)
+    if(TYPEOF(ITEM(a)[i]) != T_STRING || ITEM(a)[i].u.string->size_shift)
+      SIMPLE_ARG_TYPE_ERROR("create", 1, "array(string(8bit))");
+
+  if(!a->size) return;
+
+  exps = xalloc(a->size * (sizeof(char *) + sizeof(size_t)));
+  lens = (size_t *)(exps + a->size);
+  SET_ONERROR(err, free, exps);
+  for(i = 0; i < a->size; i++)
+  {
+    exps[i] = ITEM(a)[i].u.string->str;
+    lens[i] = ITEM(a)[i].u.string->len;
+  }
+  THIS_SET->ids = xalloc(a->size * sizeof(int));
+  THIS_SET->regexp = pike_regcomp_set(exps, lens, a->size);
+  THIS_SET->size = a->size;
+  CALL_AND_UNSET_ONERROR(err);
+}
+
+/*! @decl array(int) match(string str)
+ *!
+ *! Returns the indices in the array given to @[create] of the
+ *! regexps that match @[str], in increasing order.
+ */
+static void regexp_set_match(INT32 args)
+{
+  struct pike_string *s;
+  int i, n = 0;
+
+  get_all_args(NULL, args, "%n", &s);
+
+  if(THIS_SET->regexp)
+    n = pike_regexec_set(THIS_SET->regexp, STR0(s), s->len, THIS_SET->ids);
+
+  pop_n_elems(args);
+  for(i = 0; i < n; i++)
+    push_int(THIS_SET->ids[i]);
+  f_aggregate(n);
+}
+
+/*! @decl int _sizeof()
+ *!
+ *! Returns the number of regexps in the set.
+ */
+static void regexp_set_sizeof(INT32 args)
+{
+  pop_n_elems(args);
+  push_int(THIS_SET->size);
+}
+
+static void exit_regexp_set_glue(struct object *UNUSED(o))
+{
+  do_free_set();
+}
+
 /*! @endclass
  */
 
@@ -237,4 +358,15 @@ PIKE_MODULE_INIT
 
   set_exit_callback(exit_regexp_glue);
   end_class("_SimpleRegexp", 0);
+
+  start_new_program();
+  ADD_STORAGE(struct regexp_set_glue);
+
+  ADD_FUNCTION("create",regexp_set_create,tFunc(tArr(tStr),tVoid),
+               ID_PROTECTED);
+  ADD_FUNCTION("match",regexp_set_match,tFunc(tStr,tArr(tInt)),0);
+  ADD_FUNCTION("_sizeof",regexp_set_sizeof,tFunc(tNone,tInt),0);
+
+  set_exit_callback(exit_regexp_set_glue);
+  end_class("SimpleRegexpSet", 0);
 }
@@ -48,6 +48,32 @@
  * Also altered by Fredrik Hubinette to handle the + operator and
  * eight-bit chars. Mars 22 1996
  *
+ * Altered to replace the backtracking matcher.  The parser and its
+ * diagnostics are still Henry's, but the pattern is now compiled to a
+ * program for a Thompson NFA, and matching never backtracks: the time
+ * it takes is linear in the length of the subject, whatever the
+ * pattern.
+ *
+ *	Whether a subject matches is decided by a DFA that is built
+ *	lazily from the program, a state at a time as the subject needs
+ *	them, and cached in the regexp.  The cache is flushed when it
+ *	fills up, and if it keeps doing that the scan continues as a
+ *	plain simulation of the NFA.
+ *
+ *	The positions of the subexpressions are found by a "Pike VM",
+ *	which runs a thread per program counter in priority order.  That
+ *	gives the same answer as the backtracking matcher did: the
+ *	leftmost match, and within it the first alternative and the
+ *	longest repetition that lead to a match.
+ *
+ *	If every match starts with the same literal string, memchr() is
+ *	used to skip to the next place it occurs whenever no thread is
+ *	alive.
+ *
+ *	Several patterns can be compiled into one program, each ending
+ *	in its own MATCH instruction.  pike_regexec_set() then finds out
+ *	which of them match in a single scan of the subject.
+ *
  *
  * 	Beware that some of this code is subtly aware of the way operator
  * 	precedence is structured in regular expressions.  Serious changes in
@@ -70,103 +96,84 @@
 #include "pike_error.h"
 #include "interpret.h"
 
-#undef NOTHING
-
 /*
- * The "internal use only" fields in regexp.h are present to pass info from
- * compile to execute that permits the execute phase to run lots faster on
- * simple cases.  They are:
- *
- * regstart	char that must begin a match; '\0' if none obvious
- * reganch	is the match anchored (at beginning-of-line only)?
- * regmust	string (pointer into program) that match must include, or NULL
- * regmlen	length of regmust string
- *
- * Regstart and reganch permit very fast decisions on suitable starting points
- * for a match, cutting down the work a lot.  Regmust permits fast rejection
- * of lines that cannot possibly match.  The regmust tests are costly enough
- * that regcomp() supplies a regmust only if the r.e. contains something
- * potentially expensive (at present, the only such thing detected is * or +
- * at the start of the r.e., which can involve a lot of backup).  Regmlen is
- * supplied because the test in regexec() needs it and regcomp() is computing
- * it anyway.
+ * The program.  Each instruction is an opcode with up to two operands.
+ * SPLIT and JMP are the only ones that don't continue with the next
+ * instruction.
  */
 
-/*
- * Structure for regexp "program".  This is essentially a linear encoding
- * of a nondeterministic finite-state machine (aka syntax charts or
- * "railroad normal form" in parsing technology).  Each node is an opcode
- * plus a "next" pointer, possibly plus an operand.  "Next" pointers of
- * all nodes except BRANCH implement concatenation; a "next" pointer with
- * a BRANCH on both ends of it is connecting two alternatives.  (Here we
- * have one of the subtle syntax dependencies:  an individual BRANCH (as
- * opposed to a collection of them) is never concatenated with anything
- * because of operator precedence.)  The operand of some types of node is
- * a literal string; for others, it is a node leading into a sub-FSM.  In
- * particular, the operand of a BRANCH node is the first node of the branch.
- * (NB this is *not* a tree structure:  the tail of the branch connects
- * to the thing following the set of BRANCHes.)  The opcodes are:
- */
-
-/* definition	  number	opnd?   meaning */
-#define	END	  0		/* no	End of program. */
-#define	BOL	  1		/* no	Match "" at beginning of line. */
-#define	EOL	  2		/* no	Match "" at end of line. */
-#define	ANY	  3		/* no	Match any one character. */
-#define	ANYOF	  4		/* str	Match any character in this string. */
-#define	ANYBUT	  5		/* str	Match any character not in this
-				 * string. */
-#define	BRANCH	  6		/* node	Match this alternative, or the
-				 * next... */
-#define	BACK	  7		/* no	Match "", "next" ptr points backward. */
-#define	EXACTLY	  8		/* str	Match this string. */
-#define	NOTHING	  9		/* no	Match empty string. */
-#define	STAR	  10		/* node	Match this (simple) thing 0 or more
-				 * times. */
-#define WORDSTART 11		/* node matching a start of a word          */
-#define WORDEND   12		/* node matching an end of a word           */
-#define KPLUS	  13		/* node Match this (simple) thing 1 or more
-				 * times. */
-#define	OPEN	  20		/* no	Mark this point in input as start of
-				 * #n. */
- /* OPEN+1 is number 1, etc. */
-#define	CLOSE	(OPEN+NSUBEXP)	/* no	Analogous to OPEN. */
+/* definition	  number	opnd?	meaning */
+#define	I_CHAR	  0		/* c	Match the character c. */
+#define	I_ANY	  1		/* no	Match any one character. */
+#define	I_CLASS	  2		/* x	Match a character in class x. */
+#define	I_SPLIT	  3		/* x,y	Continue at x, and with lower
+				 *	priority at y. */
+#define	I_JMP	  4		/* x	Continue at x. */
+#define	I_SAVE	  5		/* x	Record the position in slot x. */
+#define	I_BOL	  6		/* no	Match "" at beginning of line. */
+#define	I_EOL	  7		/* no	Match "" at end of line. */
+#define	I_WORDSTART 8		/* no	Match "" at the start of a word. */
+#define	I_WORDEND 9		/* no	Match "" at the end of a word. */
+#define	I_MATCH	  10		/* x	Pattern number x has matched. */
+
+struct reginst
+{
+  unsigned char op;
+  unsigned char c;
+  int x, y;
+};
 
 /*
- * Opcode notes:
- *
- * BRANCH	The set of branches constituting a single choice are hooked
- *		together with their "next" pointers, since precedence prevents
- *		anything being concatenated to any individual branch.  The
- *		"next" pointer of the last BRANCH in a choice points to the
- *		thing following the whole choice.  This is also where the
- *		final "next" pointer of each individual branch points; each
- *		branch starts with the operand node of a BRANCH node.
- *
- * BACK		Normal "next" pointers all implicitly point forward; BACK
- *		exists to make loop structures possible.
- *
- * STAR,KPLUS	Complex cases are implemented as circular BRANCH structures
- *		using BACK.  Simple cases (one character per match) are
- *		implemented with STAR or KPLUS for speed and to minimize
- *		recursive plunges.
- *
- * OPEN,CLOSE	...are numbered at compile time.
+ * A state of the DFA is the set of instructions the live threads
+ * continue at (the kernel), and what is known about the character
+ * before the current position.  The start of the program is always
+ * implicitly part of the kernel, which makes the search unanchored.
  */
+#define DS_BOL		1	/* At the beginning of the subject. */
+#define DS_WORD		2	/* The previous character is a word part. */
 
-/*
- * A node is one char of opcode followed by two chars of "next" pointer.
- * "Next" pointers are stored as two 8-bit pieces, high order first.  The
- * value is a positive offset from the opcode of the node containing it.
- * An operand, if any, simply follows the node.  (Note that much of the
- * code generation knows about this implicit relationship.)
- *
- * Using two bytes for the "next" pointer is vast overkill for most things,
- * but allows patterns to get big without disasters.
- */
-#define	OP(p)	(*(p))
-#define	NEXT(p)	(((*((p)+1)&0377)<<8) + (*((p)+2)&0377))
-#define	OPERAND(p)	((p) + 3)
+struct dstate
+{
+  struct dstate *hnext;		/* Hash chain. */
+  int *ids[3];			/* Matching patterns, see dfa_merge(). */
+  int next[256];		/* State<<1 | matched, or -1 if unknown. */
+  int end;			/* Matched at the end, or -1 if unknown. */
+  int index;
+  int flags;
+  int n;
+  int kernel[1];
+};
+
+#define DFA_HASH	1024	/* Must be a power of two. */
+#define DFA_MAX_STATES	1024	/* Each takes a little over 1 kb. */
+#define DFA_MAX_FLUSHES	4	/* Per scan, before falling back to the NFA. */
+
+struct regexp
+{
+  struct reginst *prog;
+  int ninst;
+  int ncap;			/* Submatch slots, two per (). */
+  int npatterns;
+  int anchored;			/* Can only match at the beginning. */
+  unsigned char *prefix;	/* Every match starts with this. */
+  size_t prefixlen;
+  unsigned char (*classes)[32];
+  int nclasses;
+
+  /* Work space. */
+  unsigned int *mark;
+  unsigned int gen;
+  int *stack;
+  int *kbuf;
+  int *ids;
+  char *found;
+  ptrdiff_t *vm;
+
+  /* The DFA. */
+  struct dstate **states;
+  int nstates;
+  struct dstate *hash[DFA_HASH];
+};
 
 /*
  * Utility definitions.
@@ -186,78 +193,53 @@
 #define RSQBRAC (']'|SPECIAL)
 #define LSHBRAC ('<'|SPECIAL)
 #define RSHBRAC ('>'|SPECIAL)
-#define	FAIL(m)	{ regerror(m); return(NULL); }
 #define	ISMULT(c)	((c) == ASTERIX || (c)==PLUS)
-#define	META	"^$.[()|*+\\"
-#ifndef CHARBITS
 #define CHARBITS	0xff
-#define	UCHARAT(p)	((int)*(unsigned char *)(p))
-#else
-#define	UCHARAT(p)	((int)*(p)&CHARBITS)
-#endif
 #define ISWORDPART(c) ( isalnum(c) || (c) == '_' )
+#define CLASSHAS(C,X)	((C)[(X)>>3] & (1<<((X)&7)))
+#define CLASSSET(C,X)	((C)[(X)>>3] |= (1<<((X)&7)))
 
 /*
  * Flags to be passed up and down.
  */
 #define	HASWIDTH	01	/* Known never to match null string. */
-#define	SIMPLE		02	/* Simple enough to be STAR or KPLUS operand. */
-#define	SPSTART		04	/* Starts with * */
 #define	WORST		0	/* Worst case. */
 
-/*
- * Global work variables for regcomp().
- */
-static short   *regparse;	/* Input-scan pointer. */
-static int      regnpar;	/* () count. */
-static char    *regcode;	/* Code-emit pointer; &regdummy = don't. */
-static long     regsize;	/* Code size. */
-static char     regdummy[3] = { NOTHING, 0, 0 };
+static unsigned char regword[256];
 
 /*
- * Forward declarations for regcomp()'s friends.
+ * Work variables for regcomp().
  */
-static char    *reg(int, int *);
-static char    *regbranch(int *);
-static char    *regpiece(int *);
-static char    *regatom(int *);
-static char    *regnode(char);
-static char    *regnext(char *);
-static void     regc(char b);
-static void     reginsert(char, char *);
-static void     regtail(char *, const char *);
-static void     regoptail(char *, const char *);
+struct regcomp
+{
+  regexp *r;
+  short *toks;			/* The pattern, see regtokens(). */
+  const short *parse;		/* Input-scan pointer. */
+  const short *end;
+  int npar;			/* () count. */
+};
+
+#define PEEK(rc)	((rc)->parse < (rc)->end ? *(rc)->parse : -1)
+
+static int reg(struct regcomp *, int);
+static int regbranch(struct regcomp *);
+static int regpiece(struct regcomp *);
+static int regatom(struct regcomp *);
 
 /*
- - regcomp - compile a regular expression into internal code
- *
- * We can't allocate space until we know how big the compiled form will be,
- * but we can't compile it (and thus know how big it is) until we've got a
- * place to put the code.  So we cheat:  we compile it twice, once with code
- * generation turned off and size counting turned on, and once "for real".
- * This also means that we don't allocate space until we are sure that the
- * thing really will compile successfully, and we never have to move the
- * code and thus invalidate pointers into it.  (Note that it has to be in
- * one piece because free() must be able to free it all.)
+ - regtokens - mark the operators in a pattern
  *
- * Beware that the optimization-preparation code in here knows about some
- * of the structure of the compiled regexp.
+ * Operators get the SPECIAL bit, quoted characters and everything
+ * else is literal.
  */
-regexp *pike_regcomp(const char *exp)
+static void regtokens(struct regcomp *rc, const char *exp, size_t len)
 {
-  regexp *r = NULL;
-  char   *scan;
-  int     flags;
-  short  *exp2,*dest,c;
-  ONERROR oerr;
-
-  if (exp == NULL)
-    FAIL("NULL argument");
+  const unsigned char *p = (const unsigned char *)exp, *pend = p + len;
+  short *dest = rc->toks;
+  int c;
 
-  exp2=xcalloc( (strlen(exp)+1), sizeof(short) );
-  SET_ONERROR(oerr, free, exp2);
-  for ( dest=exp2; (c=UCHARAT(exp++)); ) {
-    switch (c) {
+  while (p < pend) {
+    switch (c = *p++) {
     case '(':
     case ')':
     case '.':
@@ -268,21 +250,19 @@ regexp *pike_regcomp(const char *exp)
     case '^':
     case '[':
     case ']':
-      *dest++ =  c | SPECIAL;
+      *dest++ = c | SPECIAL;
       break;
     case '\\':
-      switch ( c = *exp++ ) {
-      case '(':
-      case ')':
-        *dest++ = c;
-        break;
+      if (p == pend)
+        regerror("trailing \\");
+      switch (c = *p++) {
       case '<':
       case '>':
         *dest++ = c | SPECIAL;
         break;
       case '{':
       case '}':
-        FAIL("sorry, unimplemented operator");
+        regerror("sorry, unimplemented operator");
       case 'b': *dest++ = '\b'; break;
       case 't': *dest++ = '\t'; break;
       case 'r': *dest++ = '\r'; break;
@@ -295,155 +275,207 @@ regexp *pike_regcomp(const char *exp)
     }
   }
 
-  /* First pass: determine size, legality. */
-  regparse = exp2;
-  regnpar = 1;
-  regsize = 0L;
-  regcode = regdummy;
-  if (reg(0, &flags) == NULL)
-    goto exit_regcomp;
-
-  /* Small enough for pointer-storage convention? */
-  if (regsize >= 32767L)	/* Probably could be 65535L. */
-  {
-    FAIL("regexp too big");
+  rc->parse = rc->toks;
+  rc->end = dest;
+}
+
+/*
+ - regemit - emit an instruction
+ */
+static int regemit(regexp *r, int op, int c, int x, int y)
+{
+  struct reginst *i = r->prog + r->ninst;
+
+  i->op = op;
+  i->c = c;
+  i->x = x;
+  i->y = y;
+  return r->ninst++;
+}
+
+/*
+ - reginsert - insert an instruction in front of already emitted code
+ *
+ * Jumps into the moved code are adjusted.  Those that point at pos
+ * from before it are not, they end up at the inserted instruction.
+ */
+static void reginsert(regexp *r, int pos, int op, int x, int y)
+{
+  struct reginst *i;
+  int n;
+
+  memmove(r->prog + pos + 1, r->prog + pos,
+          (r->ninst - pos) * sizeof(struct reginst));
+  r->ninst++;
+
+  for (n = pos + 1; n < r->ninst; n++) {
+    i = r->prog + n;
+    if (i->op == I_SPLIT || i->op == I_JMP) {
+      if (i->x >= pos)
+        i->x++;
+      if (i->op == I_SPLIT && i->y >= pos)
+        i->y++;
+    }
+  }
+
+  i = r->prog + pos;
+  i->op = op;
+  i->c = 0;
+  i->x = x;
+  i->y = y;
+}
+
+static void regcomp_abort(struct regcomp *rc)
+{
+  free(rc->toks);
+  pike_regfree(rc->r);
+}
+
+/*
+ - pike_regcomp_set - compile a set of regular expressions
+ *
+ * The patterns become one program, which starts with a chain of
+ * SPLITs to the individual patterns.  Each pattern is bracketed by
+ * SAVE 0 and SAVE 1, and ends in MATCH with its number.
+ */
+regexp *pike_regcomp_set(const char **exps, const size_t *lens, int n)
+{
+  struct regcomp rc;
+  regexp *r;
+  size_t total = 0, maxlen = 0;
+  int i, split, pc;
+  ONERROR oerr;
+
+  if (!regword['a'])
+    for (i = 0; i < 256; i++)
+      regword[i] = ISWORDPART(i);
+
+  for (i = 0; i < n; i++) {
+    total += lens[i];
+    if (lens[i] > maxlen)
+      maxlen = lens[i];
   }
 
-  /* Allocate space. */
-  r = xalloc(sizeof(regexp) + (unsigned) regsize);
-
-  /* Second pass: emit code. */
-  regparse = exp2;
-  regnpar = 1;
-  regcode = r->program;
-  if (reg(0, &flags) == NULL)
-  {
-    free(r);
-    r = NULL;
-    goto exit_regcomp;
+  rc.r = r = xcalloc(1, sizeof(regexp));
+  rc.toks = NULL;
+  SET_ONERROR(oerr, regcomp_abort, &rc);
+
+  /* Each token emits at most two instructions. */
+  r->prog = xalloc((2 * total + 4 * n + 1) * sizeof(struct reginst));
+  r->classes = xalloc((total / 2 + 1) * sizeof(*r->classes));
+  r->npatterns = n;
+  rc.toks = xalloc((maxlen + 1) * sizeof(short));
+
+  for (i = 0; i < n; i++) {
+    split = -1;
+    if (i < n - 1)
+      split = regemit(r, I_SPLIT, 0, r->ninst + 1, 0);
+
+    regtokens(&rc, exps[i], lens[i]);
+    rc.npar = 1;
+    regemit(r, I_SAVE, 0, 0, 0);
+    reg(&rc, 0);
+    regemit(r, I_SAVE, 0, 1, 0);
+    regemit(r, I_MATCH, 0, i, 0);
+    if (2 * rc.npar > r->ncap)
+      r->ncap = 2 * rc.npar;
+
+    if (split >= 0)
+      r->prog[split].y = r->ninst;
   }
 
   /* Dig out information for optimizations. */
-  r->regstart = '\0';		/* Worst-case defaults. */
-  r->reganch = 0;
-  r->regmust = NULL;
-  r->regmlen = 0;
-  scan = r->program;	/* First BRANCH. */
-  if (OP(regnext(scan)) == END) {	/* Only one top-level choice. */
-    scan = OPERAND(scan);
-
-    /* Starting-point info. */
-    if (OP(scan) == EXACTLY)
-       r->regstart = *OPERAND(scan);
-    else if (OP(scan) == BOL)
-      r->reganch++;
-
-    /*
-     * If there's something expensive in the r.e., find the longest
-     * literal string that must appear and make it the regmust.
-     * Resolve ties in favor of later strings, since the regstart
-     * check works with the beginning of the r.e. and avoiding
-     * duplication strengthens checking. Not a strong reason, but
-     * sufficient in the absence of others.
-     */
-    if (flags & SPSTART) {
-      char *longest = NULL;
-      size_t len = 0;
-      for (; scan != NULL; scan = regnext(scan))
-        if (OP(scan) == EXACTLY &&
-            strlen(OPERAND(scan)) >= (size_t)len) {
-          longest = OPERAND(scan);
-          len = strlen(OPERAND(scan));
-        }
-      r->regmust = longest;
-      r->regmlen = len;
+  if (n == 1) {
+    r->prefix = xalloc(total + 1);
+    for (pc = 0;; pc++) {
+      if (r->prog[pc].op == I_CHAR)
+        r->prefix[r->prefixlen++] = r->prog[pc].c;
+      else if (r->prog[pc].op != I_SAVE)
+        break;
     }
+    r->anchored = !r->prefixlen && r->prog[pc].op == I_BOL;
   }
 
- exit_regcomp:
-  CALL_AND_UNSET_ONERROR(oerr);
+  r->mark = xcalloc(r->ninst, sizeof(unsigned int));
+  r->stack = xalloc((r->ninst + 1) * sizeof(int));
+  r->kbuf = xalloc(2 * r->ninst * sizeof(int));
+  r->ids = xalloc((n + 1) * sizeof(int));
+  r->found = xalloc(n);
+
+  UNSET_ONERROR(oerr);
+  free(rc.toks);
   return r;
 }
 
+regexp *pike_regcomp(const char *exp, size_t len)
+{
+  return pike_regcomp_set(&exp, &len, 1);
+}
+
 /*
  - reg - regular expression, i.e. main body or parenthesized thing
  *
  * Caller must absorb opening parenthesis.
  *
- * Combining parenthesis handling with the base level of regular
- * expression is a trifle forced, but the need to tie the tails of the
- * branches to what follows makes it hard to avoid.
+ * The branches are compiled as
+ *
+ *	SPLIT L1, L2
+ *   L1: <branch 1>
+ *	JMP L3
+ *   L2: <branch 2>
+ *   L3:
+ *
+ * The SPLIT is inserted when the | is seen, and the JMPs are chained
+ * through their operands until the end is known.
  */
-static char *reg(int paren,int *flagp)
+static int reg(struct regcomp *rc, int paren)
 {
-  char  *ret;
-  char  *br;
-  char  *ender;
-  int    parno=0; /* make gcc happy */
-  int    flags;
-
-  *flagp = HASWIDTH;		/* Tentatively. */
-
-  /* Make an OPEN node, if parenthesized. */
-  if (paren)
-  {
-    if (regnpar >= NSUBEXP)
-      FAIL("too many ()");
-    parno = regnpar;
-    regnpar++;
-    ret = regnode((char)(OPEN + parno));
+  regexp *r = rc->r;
+  int flags = HASWIDTH;		/* Tentatively. */
+  int parno = 0, start, holes = -1, h;
+
+  if (paren) {
+    if (rc->npar >= NSUBEXP)
+      regerror("too many ()");
+    parno = rc->npar++;
+    regemit(r, I_SAVE, 0, 2 * parno, 0);
   }
-  else
-    ret = NULL;
-
-  /* Pick up the branches, linking them together. */
-  br = regbranch(&flags);
-  if (br == NULL)
-    return NULL;
-  if (ret != NULL)
-    regtail(ret, br);	/* OPEN -> first. */
-  else
-    ret = br;
 
-  if (!(flags & HASWIDTH))
-    *flagp &= ~HASWIDTH;
-  *flagp |= flags & SPSTART;
-
-  while (*regparse == OR_OP) {
-    regparse++;
-    br = regbranch(&flags);
-    if (br == NULL)
-      return NULL;
-    regtail(ret, br);	/* BRANCH -> BRANCH. */
-    if (!(flags & HASWIDTH))
-      *flagp &= ~HASWIDTH;
-    *flagp |= flags & SPSTART;
+  start = r->ninst;
+  if (!(regbranch(rc) & HASWIDTH))
+    flags &= ~HASWIDTH;
+
+  while (PEEK(rc) == OR_OP) {
+    rc->parse++;
+    reginsert(r, start, I_SPLIT, start + 1, 0);
+    holes = regemit(r, I_JMP, 0, holes, 0);
+    start = r->prog[start].y = r->ninst;
+    if (!(regbranch(rc) & HASWIDTH))
+      flags &= ~HASWIDTH;
   }
 
-  /* Make a closing node, and hook it on the end. */
-  ender = regnode((char)((paren) ? (CLOSE + parno) : END));
-  regtail(ret, ender);
-
-  /* Hook the tails of the branches to the closing node. */
-  for (br = ret; br != NULL; br = regnext(br))
-    regoptail(br, ender);
+  /* Hook the tails of the branches to what follows. */
+  for (; holes >= 0; holes = h) {
+    h = r->prog[holes].x;
+    r->prog[holes].x = r->ninst;
+  }
 
   /* Check for proper termination. */
-  if (paren && *regparse++ != RBRAC)
-  {
-    FAIL("unmatched ()");
+  if (paren) {
+    if (PEEK(rc) != RBRAC)
+      regerror("unmatched ()");
+    rc->parse++;
+    regemit(r, I_SAVE, 0, 2 * parno + 1, 0);
   }
-  else if (!paren && *regparse != '\0')
-  {
-    if (*regparse == RBRAC)
-    {
-      FAIL("unmatched ()");
+  else if (PEEK(rc) != -1) {
+    if (PEEK(rc) == RBRAC) {
+      regerror("unmatched ()");
     }
     else
-      FAIL("junk on end");/* "Can't happen". */
+      regerror("junk on end");	/* "Can't happen". */
   }
 
-  return ret;
+  return flags;
 }
 
 /*
@@ -451,795 +483,741 @@ static char *reg(int paren,int *flagp)
  *
  * Implements the concatenation operator.
  */
-static char  *regbranch(int *flagp)
+static int regbranch(struct regcomp *rc)
 {
-  char  *ret;
-  char  *chain;
-  char  *latest;
-  int    flags;
-
-  *flagp = WORST;		/* Tentatively. */
-  ret = regnode(BRANCH);
-  chain = NULL;
-
-  while (*regparse != '\0' && *regparse != OR_OP && *regparse != RBRAC) {
-    latest = regpiece(&flags);
-    if (latest == NULL)
-      return NULL;
-    *flagp |= flags & HASWIDTH;
-    if (chain == NULL)	/* First piece. */
-      *flagp |= flags & SPSTART;
-    else
-      regtail(chain, latest);
-    chain = latest;
-  }
-  if (chain == NULL)		/* Loop ran zero times. */
-    regnode(NOTHING);
+  int flags = WORST;		/* Tentatively. */
+  int c;
 
-  return ret;
+  while ((c = PEEK(rc)) != -1 && c != OR_OP && c != RBRAC)
+    flags |= regpiece(rc) & HASWIDTH;
+
+  return flags;
 }
 
 /*
  - regpiece - something followed by possible [*] or [+]
  *
- * Note that the branching code sequence used for * is somewhat
- * optimized: they use the same NOTHING node as both the endmarker for
- * their branch list and the body of the last branch. It might seem
- * that this node could be dispensed with entirely, but the endmarker
- * role is not redundant.
+ * x* is compiled as
+ *
+ *   L1: SPLIT L2, L3
+ *   L2: <x>
+ *	JMP L1
+ *   L3:
+ *
+ * and x+ as
+ *
+ *   L1: <x>
+ *	SPLIT L1, L2
+ *   L2:
  */
-static char *regpiece(int *flagp)
+static int regpiece(struct regcomp *rc)
 {
-  char  *ret;
-  short  op;
-  int    flags;
-
-  ret = regatom(&flags);
-  if (ret == NULL)
-    return NULL;
-
-  op = *regparse;
-  if (!ISMULT(op)) {
-    *flagp = flags;
-    return ret;
-  }
+  regexp *r = rc->r;
+  int start = r->ninst;
+  int flags = regatom(rc);
+  int op = PEEK(rc);
+
+  if (!ISMULT(op))
+    return flags;
 
   /* FIXME: + can not be empty */
   if (!(flags & HASWIDTH))
-    FAIL("* or + operand could be empty");
-  *flagp = (WORST | SPSTART);
-
-  if(op == ASTERIX)
-  {
-    if (flags & SIMPLE)
-    {
-      reginsert(STAR, ret);
-    }
-    else
-    {
-      /* Emit x* as (x&|), where & means "self". */
-      reginsert(BRANCH, ret);	/* Either x */
-      regoptail(ret, regnode(BACK)); /* and loop */
-      regoptail(ret, ret);	/* back */
-      regtail(ret, regnode(BRANCH)); /* or */
-      regtail(ret, regnode(NOTHING)); /* null. */
-    }
+    regerror("* or + operand could be empty");
+
+  if (op == ASTERIX) {
+    reginsert(r, start, I_SPLIT, start + 1, 0);
+    regemit(r, I_JMP, 0, start, 0);
+    r->prog[start].y = r->ninst;
   }
-  else if(op == PLUS)
-  {
-    if (flags & SIMPLE)
-    {
-      reginsert(KPLUS, ret);
+  else
+    regemit(r, I_SPLIT, 0, start, r->ninst + 1);
+
+  rc->parse++;
+  if (ISMULT(PEEK(rc)))
+    regerror("nested * or +");
+
+  return WORST;
+}
+
+/*
+ - regclass - a [] class, the [ already absorbed
+ */
+static void regclass(struct regcomp *rc)
+{
+  regexp *r = rc->r;
+  unsigned char *cls = r->classes[r->nclasses];
+  int negate = 0, last = 0, c, i;
+
+  memset(cls, 0, sizeof(*r->classes));
+
+  if (PEEK(rc) == CARET) {
+    /* Complement of range. */
+    negate = 1;
+    rc->parse++;
+  }
+
+  if ((c = PEEK(rc)) == RSQBRAC || c == '-') {
+    last = c & CHARBITS;
+    CLASSSET(cls, last);
+    rc->parse++;
+  }
+
+  while ((c = PEEK(rc)) != -1 && c != RSQBRAC) {
+    rc->parse++;
+    if (c == '-') {
+      c = PEEK(rc);
+      if (c == RSQBRAC || c == -1)
+        CLASSSET(cls, '-');
+      else {
+        c &= CHARBITS;
+        if (last > c)
+          regerror("invalid [] range");
+        for (i = last; i <= c; i++)
+          CLASSSET(cls, i);
+        last = c;
+        rc->parse++;
+      }
     }
-    else
-    {
-      /* ret ->	1: x			next: 2
-       * tmp ->	2: BRANCH	op: 3	next: 4
-       *	3: BACK			next: 1
-       *	4: BRANCH	op: 5	next: 5
-       *	5: NOTHING
-       */
-      char *tmp;
-      tmp=regnode(BACK);
-      reginsert(BRANCH, tmp);
-      regtail(ret, tmp);
-      regoptail(tmp, ret);
-      regtail(ret, regnode(BRANCH));
-      regtail(ret, regnode(NOTHING));
+    else {
+      last = c & CHARBITS;
+      CLASSSET(cls, last);
     }
   }
 
-  regparse++;
-  if (ISMULT(*regparse))
-    FAIL("nested * or +");
+  if (PEEK(rc) != RSQBRAC)
+    regerror("unmatched []");
+  rc->parse++;
 
-  return ret;
-}
+  if (negate)
+    for (i = 0; i < (int)sizeof(*r->classes); i++)
+      cls[i] ^= 0xff;
 
+  regemit(r, I_CLASS, 0, r->nclasses++, 0);
+}
 
 /*
  - regatom - the lowest level
- *
- * Optimization: gobbles an entire sequence of ordinary characters so
- * that it can turn them into a single node, which is smaller to store
- * and faster to run.
  */
-static char *regatom(int *flagp)
+static int regatom(struct regcomp *rc)
 {
-  char  *ret;
-  int    flags;
+  regexp *r = rc->r;
+  int c = PEEK(rc);
 
-  *flagp = WORST;		/* Tentatively. */
-
-  switch (*regparse++)
-  {
+  rc->parse++;
+  switch (c) {
   case CARET:
-    ret = regnode(BOL);
-    break;
+    regemit(r, I_BOL, 0, 0, 0);
+    return WORST;
   case DOLLAR:
-    ret = regnode(EOL);
-    break;
+    regemit(r, I_EOL, 0, 0, 0);
+    return WORST;
   case DOT:
-    ret = regnode(ANY);
-    *flagp |= HASWIDTH | SIMPLE;
-    break;
+    regemit(r, I_ANY, 0, 0, 0);
+    return HASWIDTH;
   case LSHBRAC:
-    ret = regnode(WORDSTART);
-    break;
+    regemit(r, I_WORDSTART, 0, 0, 0);
+    return WORST;
   case RSHBRAC:
-    ret = regnode(WORDEND);
-    break;
+    regemit(r, I_WORDEND, 0, 0, 0);
+    return WORST;
   case LSQBRAC:
-    {
-      int range;
-      int rangeend;
-
-      if (*regparse == CARET)
-      {
-        /* Complement of range. */
-        ret = regnode(ANYBUT);
-        regparse++;
-      }
-      else
-        ret = regnode(ANYOF);
-
-      if (*regparse == RSQBRAC || *regparse == '-')
-        regc((char)(*regparse++));
-
-      while (*regparse != '\0' && *regparse != RSQBRAC)
-      {
-        if (*regparse == '-')
-        {
-          regparse++;
-          if (*regparse == RSQBRAC || *regparse == '\0')
-            regc('-');
-          else
-          {
-            range = (CHARBITS & *(regparse - 2));
-            rangeend = (CHARBITS & *(regparse));
-            if (range > rangeend)
-              FAIL("invalid [] range");
-            for (range++; range <= rangeend; range++)
-              regc((char)range);
-            regparse++;
-          }
-        }
-        else
-          regc((char)(*regparse++));
-      }
-      regc('\0');
-      if (*regparse != RSQBRAC)
-        FAIL("unmatched []");
-      regparse++;
-      *flagp |= HASWIDTH | SIMPLE;
-    }
-    break;
-
+    regclass(rc);
+    return HASWIDTH;
   case LBRAC:
-    ret = reg(1, &flags);
-    if (ret == NULL)
-      return NULL;
-    *flagp |= flags & (HASWIDTH | SPSTART);
-    break;
-
-  case '\0':
+    return reg(rc, 1) & HASWIDTH;
+  case -1:
   case OR_OP:
   case RBRAC:
-    FAIL("internal urp");	/* Supposed to be caught earlier. */
-    break;
-
+    regerror("internal urp");	/* Supposed to be caught earlier. */
   case PLUS:
   case ASTERIX:
-    FAIL("*/+ follows nothing\n");
-    break;
-
+    regerror("*/+ follows nothing\n");
+  case RSQBRAC:
+    regerror("internal disaster");
   default:
-    {
-      size_t len;
-      short  ender;
-
-      regparse--;
-      for (len=0; regparse[len] &&
-             !(regparse[len]&SPECIAL) && regparse[len] != RSQBRAC; len++) ;
-      if (len <= 0)
-        FAIL("internal disaster");
-
-      ender = *(regparse + len);
-      if (len > 1 && ISMULT(ender))
-        len--;		/* Back off clear of +,* operand. */
-      *flagp |= HASWIDTH;
-      if (len == 1)
-        *flagp |= SIMPLE;
-      ret = regnode(EXACTLY);
-      for (; len > 0; len--)
-        regc((char)(*regparse++));
-      regc('\0');
-    }
-    break;
+    regemit(r, I_CHAR, c, 0, 0);
+    return HASWIDTH;
   }
-
-  return ret;
 }
 
-/*
- - regnode - emit a node
- */
-static char *regnode(char op)
+void pike_regfree(regexp *r)
 {
-  char  *ret = regcode;
-  char  *ptr;
+  int i;
 
-  if (ret == regdummy) {
-    regsize += 3;
-    return ret;
-  }
-
-  ptr = ret;
-  *ptr++ = op;
-  *ptr++ = '\0';		/* Null "next" pointer. */
-  *ptr++ = '\0';
-  regcode = ptr;
+  if (!r)
+    return;
 
-  return ret;
+  for (i = 0; i < r->nstates; i++) {
+    free(r->states[i]->ids[0]);
+    free(r->states[i]->ids[1]);
+    free(r->states[i]->ids[2]);
+    free(r->states[i]);
+  }
+  free(r->states);
+  free(r->prog);
+  free(r->classes);
+  free(r->prefix);
+  free(r->mark);
+  free(r->stack);
+  free(r->kbuf);
+  free(r->ids);
+  free(r->found);
+  free(r->vm);
+  free(r);
 }
 
 /*
- - regc - emit (if appropriate) a byte of code
+ * Matching.
  */
-static void regc(char b)
+
+static void regnextgen(regexp *r)
 {
-  if (regcode != regdummy)
-    *regcode++ = b;
-  else
-    regsize++;
+  if (!++r->gen) {
+    memset(r->mark, 0, r->ninst * sizeof(unsigned int));
+    r->gen = 1;
+  }
+}
+
+static int regflags(const unsigned char *s, size_t pos)
+{
+  if (!pos)
+    return DS_BOL;
+  return regword[s[pos - 1]] ? DS_WORD : 0;
 }
 
 /*
- - reginsert - insert an operator in front of already-emitted operand
- *
- * Means relocating the operand.
+ * Whether the zero width instruction op holds between the previous
+ * character, described by flags, and c, which is -1 at the end.
  */
-static void reginsert(char op, char *opnd)
+static inline int regassert(int op, int flags, int c)
 {
-  char *place;
-
-  if (regcode == regdummy)
-  {
-    regsize += 3;
-    return;
+  switch (op) {
+  case I_BOL:
+    return flags & DS_BOL;
+  case I_EOL:
+    return c < 0;
+  case I_WORDSTART:
+    return (flags & DS_BOL) ||
+      (c >= 0 && !(flags & DS_WORD) && regword[c]);
+  case I_WORDEND:
+    return c < 0 ||
+      (!(flags & DS_BOL) && (flags & DS_WORD) && !regword[c]);
   }
+  return 0;
+}
 
-  memmove(opnd+3, opnd, (size_t)(regcode - opnd));
-  regcode += 3;
-
-  place = opnd;		/* Op node, where operand used to be. */
-  *place++ = op;
-  *place++ = '\0';
-  *place++ = '\0';
+static inline int regconsumes(regexp *r, const struct reginst *i, int c)
+{
+  switch (i->op) {
+  case I_CHAR:
+    return c == i->c;
+  case I_ANY:
+    return c >= 0;
+  case I_CLASS:
+    return c >= 0 && CLASSHAS(r->classes[i->x], c);
+  }
+  return 0;
 }
 
 /*
- - regtail - set the next-pointer at the end of a node chain
+ * Where the next match can start, at or after s: where the prefix
+ * occurs next, or NULL if it doesn't.
  */
-static void regtail(char *p, const char *val)
+static const unsigned char *regprefix(regexp *r, const unsigned char *s,
+                                      const unsigned char *end)
 {
-  char      *scan;
-  char      *temp;
-  ptrdiff_t  offset;
-
-  if (p == regdummy)
-    return;
+  size_t len = r->prefixlen;
 
-  /* Find last node. */
-  for (scan = p; (temp = regnext(scan)) != NULL; scan = temp)
-    continue;
+  while ((size_t)(end - s) >= len &&
+         (s = memchr(s, r->prefix[0], (end - s) - len + 1))) {
+    if (!memcmp(s + 1, r->prefix + 1, len - 1))
+      return s;
+    s++;
+  }
+  return NULL;
+}
 
-  if (OP(scan) == BACK)
-    offset = scan - val;
-  else
-    offset = val - scan;
-  *(scan + 1) = (offset >> 8) & 0377;
-  *(scan + 2) = offset & 0377;
+static int regintcmp(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
 }
 
 /*
- - regoptail - regtail on operand of first argument; nop if operandless
+ - dfa_closure - follow the empty transitions
+ *
+ * Starts from the kernel and the start of the program, in the context
+ * of the previous character (flags) and the next one (c, -1 at the
+ * end).  If out is set, the instructions the threads continue at
+ * after c are stored in it, in order.  If ids is set, the numbers of
+ * the patterns that match are stored in it, terminated by -1.
+ *
+ * Returns whether some pattern matches here.
  */
-static void regoptail(char *p, const char *val)
+static int dfa_closure(regexp *r, const int *kernel, int n, int flags,
+                       int c, int *out, int *nout, int *ids)
 {
-  /* "Operandless" and "op != BRANCH" are synonymous in practice. */
-  if (p == NULL || p == regdummy || OP(p) != BRANCH)
-    return;
-  regtail(OPERAND(p), val);
+  int *stack = r->stack, sp = 0, matched = 0, pc, i;
+  const struct reginst *in;
+
+  regnextgen(r);
+
+#define PUSH(PC) do {						\
+    if (r->mark[PC] != r->gen) {				\
+      r->mark[PC] = r->gen;					\
+      stack[sp++] = (PC);					\
+    }								\
+  } while(0)
+
+  PUSH(0);
+  for (i = 0; i < n; i++)
+    PUSH(kernel[i]);
+
+  if (nout)
+    *nout = 0;
+
+  while (sp) {
+    in = r->prog + (pc = stack[--sp]);
+    switch (in->op) {
+    case I_JMP:
+      PUSH(in->x);
+      break;
+    case I_SPLIT:
+      PUSH(in->x);
+      PUSH(in->y);
+      break;
+    case I_SAVE:
+      PUSH(pc + 1);
+      break;
+    case I_BOL:
+    case I_EOL:
+    case I_WORDSTART:
+    case I_WORDEND:
+      if (regassert(in->op, flags, c))
+        PUSH(pc + 1);
+      break;
+    case I_MATCH:
+      matched = 1;
+      if (ids)
+        *ids++ = in->x;
+      break;
+    default:
+      if (out && regconsumes(r, in, c))
+        out[(*nout)++] = pc + 1;
+    }
+  }
+#undef PUSH
+
+  if (ids)
+    *ids = -1;
+  if (out && *nout > 1)
+    qsort(out, *nout, sizeof(int), regintcmp);
+  return matched;
 }
 
-/*
- * regexec and friends
- */
+static void dfa_flush(regexp *r)
+{
+  int i;
 
-/*
- * Global work variables for regexec().
- */
-static char    *reginput;	/* String-input pointer. */
-static char    *regbol;		/* Beginning of input, for ^ check. */
-static char   **regstartp;	/* Pointer to startp array. */
-static char   **regendp;	/* Ditto for endp. */
+  for (i = 0; i < r->nstates; i++) {
+    free(r->states[i]->ids[0]);
+    free(r->states[i]->ids[1]);
+    free(r->states[i]->ids[2]);
+    free(r->states[i]);
+  }
+  r->nstates = 0;
+  memset(r->hash, 0, sizeof(r->hash));
+}
 
 /*
- * Forwards.
+ - dfa_state - find or make the state for a kernel
+ *
+ * Returns its index, or -1 if the cache is full.
  */
-static int    regtry(regexp *, char *);
-static int    regmatch(char *);
-static size_t regrepeat(const char *);
-
-#ifdef PIKE_DEBUG
-int           regnarrate = 0;
-void          regdump(regexp *);
-static char  *regprop(char *op);
-#endif
+static int dfa_state(regexp *r, const int *kernel, int n, int flags)
+{
+  struct dstate *s;
+  unsigned int h = flags;
+  int i;
+
+  for (i = 0; i < n; i++)
+    h = (h ^ kernel[i]) * 16777619;
+  h = (h ^ (h >> 15)) & (DFA_HASH - 1);
+
+  for (s = r->hash[h]; s; s = s->hnext)
+    if (s->flags == flags && s->n == n &&
+        !memcmp(s->kernel, kernel, n * sizeof(int)))
+      return s->index;
+
+  if (!r->states)
+    r->states = xalloc(DFA_MAX_STATES * sizeof(struct dstate *));
+  if (r->nstates == DFA_MAX_STATES)
+    return -1;
+
+  s = xalloc(sizeof(struct dstate) + n * sizeof(int));
+  memset(s->next, 0xff, sizeof(s->next));
+  s->ids[0] = s->ids[1] = s->ids[2] = NULL;
+  s->end = -1;
+  s->flags = flags;
+  s->n = n;
+  memcpy(s->kernel, kernel, n * sizeof(int));
+
+  s->index = r->nstates;
+  r->states[r->nstates++] = s;
+  s->hnext = r->hash[h];
+  r->hash[h] = s;
+  return s->index;
+}
 
 /*
- - regexec - match a regexp against a string
+ * Same as dfa_state(), but flushes the cache if it is full.  Returns
+ * -1 if that has happened too many times already.
  */
-int pike_regexec(regexp *prog, char *string)
+static int dfa_get(regexp *r, const int *kernel, int n, int flags,
+                   int *flushes)
 {
-  char  *s;
-
-  /* Be paranoid... */
-  if (prog == NULL || string == NULL) {
-    regerror("NULL parameter");
-    return 0;
-  }
-
-  /* If there is a "must appear" string, look for it. */
-  if (prog->regmust != NULL && strstr(string, prog->regmust) == NULL)
-    return 0;
+  int t = dfa_state(r, kernel, n, flags);
 
-  /* Mark beginning of line for ^ . */
-  regbol = string;
-
-  /* Simplest case:  anchored match need be tried only once. */
-  if (prog->reganch)
-    return regtry(prog, string);
-
-  /* Messy cases:  unanchored match. */
-  s = string;
-  if (prog->regstart != '\0')
-  {
-    /* We know what char it must start with. */
-    for (s = string; s != NULL; s = strchr(s+1, prog->regstart))
-      if (regtry(prog, s))
-        return 1;
-    return 0;
+  if (t < 0) {
+    if (++*flushes > DFA_MAX_FLUSHES)
+      return -1;
+    dfa_flush(r);
+    t = dfa_state(r, kernel, n, flags);
   }
-  else
-  {
-    /* We don't -- general case. */
-    for (s = string; !regtry(prog, s); s++)
-      if (*s == '\0')
-        return 0;
-    return 1;
-  }
-
-  UNREACHABLE(return 0);
+  return t;
 }
 
 /*
- - regtry - try match at specific point
+ * Marks the patterns that match in state s before c (-1 at the end)
+ * in found, and returns how many of them weren't already.  Which they
+ * are only depends on whether c is a word part or the end, so that is
+ * cached in the state.
  */
-static int regtry(regexp *prog, char *string)
+static int dfa_merge(regexp *r, struct dstate *s, int c, char *found)
 {
-  int    i;
-  char **stp;
-  char **enp;
-
-  reginput = string;
-  regstartp = prog->startp;
-  regendp = prog->endp;
-
-  stp = prog->startp;
-  enp = prog->endp;
-  for (i = NSUBEXP; i > 0; i--)
-  {
-    *stp++ = NULL;
-    *enp++ = NULL;
-  }
-  if (regmatch(prog->program))
-  {
-    prog->startp[0] = string;
-    prog->endp[0] = reginput;
-    return 1;
+  int cls = c < 0 ? 2 : regword[c];
+  int *ids = s->ids[cls], n = 0;
+
+  if (!ids) {
+    dfa_closure(r, s->kernel, s->n, s->flags, c, NULL, NULL, r->ids);
+    for (; r->ids[n] >= 0; n++)
+      ;
+    ids = xalloc((n + 1) * sizeof(int));
+    memcpy(ids, r->ids, (n + 1) * sizeof(int));
+    s->ids[cls] = ids;
+    n = 0;
   }
 
-  return 0;
+  for (; *ids >= 0; ids++)
+    if (!found[*ids]) {
+      found[*ids] = 1;
+      n++;
+    }
+  return n;
 }
 
 /*
- - regmatch - main matching routine
+ - dfa_search - decide whether, and with found set which, patterns match
  *
- * Conceptually the strategy is simple:  check to see whether the current
- * node matches, call self recursively to see whether the rest matches,
- * and then act accordingly.  In practice we make some effort to avoid
- * recursion, in particular by going through "ordinary" nodes (that don't
- * need to know whether the rest of the match failed) by a loop instead of
- * by recursion.
+ * Returns 1 if some pattern matches when found is NULL, otherwise the
+ * number of patterns that do, with found[i] set for each of them.
  */
-static int regmatch(char *prog)
+static int dfa_search(regexp *r, const unsigned char *s, size_t len,
+                      char *found)
 {
-  char  *scan;	/* Current node. */
-  char  *next;	/* next node. */
-
-  check_c_stack (4 * sizeof (void *));
-
-  scan = prog;
-#ifdef PIKE_DEBUG
-  if (scan != NULL && regnarrate)
-    fprintf(stderr, "%s(\n", regprop(scan));
-#endif
-
-  while (scan != NULL)
-  {
-#ifdef PIKE_DEBUG
-    if (regnarrate)
-      fprintf(stderr, "%s...\n", regprop(scan));
-#endif
-    next = regnext(scan);
-
-    switch (OP(scan))
-    {
-    case BOL:
-      if (reginput != regbol)
-        return 0;
-      break;
-
-    case EOL:
-      if (*reginput != '\0')
-        return 0;
-      break;
-
-    case ANY:
-      if (*reginput == '\0')
-        return 0;
-      reginput++;
-      break;
-
-    case WORDSTART:
-      if (reginput == regbol)
-        break;
-      if (*reginput == '\0' ||
-          ISWORDPART( *((unsigned char *)reginput-1) ) ||
-          !ISWORDPART( *((unsigned char *)reginput) ) )
-        return 0;
-      break;
-
-    case WORDEND:
-      if (*reginput == '\0')
-        break;
-      if ( reginput == regbol ||
-           !ISWORDPART( *((unsigned char *)reginput-1) ) ||
-           ISWORDPART( *((unsigned char *)reginput) ) )
-        return 0;
-      break;
-
-    case EXACTLY:
-      {
-        ptrdiff_t  len;
-        char      *opnd;
-
-        opnd = OPERAND(scan);
-        /* Inline the first character, for speed. */
-        if (*opnd != *reginput)
-          return 0;
-        len = strlen(opnd);
-        if (len > 1 && strncmp(opnd, reginput, len) != 0)
-          return 0;
-        reginput += len;
-      }
-      break;
-
-    case ANYOF:
-      if (*reginput == '\0' ||
-          strchr(OPERAND(scan), *reginput) == NULL)
-        return 0;
-      reginput++;
-      break;
-
-    case ANYBUT:
-      if (*reginput == '\0' ||
-          strchr(OPERAND(scan), *reginput) != NULL)
-        return 0;
-      reginput++;
-      break;
-
-    case NOTHING:
-      break;
-    case BACK:
-      break;
-
-    case BRANCH:
-      {
-        if (OP(next) != BRANCH)	/* No choice. */
-          next = OPERAND(scan);	/* Avoid recursion. */
-        else
-        {
-          /* FIXME: This loop is different upstream. */
-          char *save = reginput;
-          do
-          {
-            if (regmatch(OPERAND(scan)))
-              return 1;
-            reginput = save;
-            scan = regnext(scan);
-          } while (scan != NULL && OP(scan) == BRANCH);
-          return 0;
+  const unsigned char *p;
+  struct dstate *st;
+  int flushes = 0, nfound = 0, flags, matched, t, n, m, c;
+  int *k, *k2;
+  size_t pos;
+
+  if ((t = dfa_get(r, r->kbuf, 0, DS_BOL, &flushes)) < 0)
+    return 0;				/* Can't happen. */
+  st = r->states[t];
+
+  for (pos = 0; pos < len; pos++) {
+    if (!st->n) {
+      /* Only the start of the program is alive. */
+      if (r->anchored && pos)
+        return nfound;
+      if (r->prefixlen) {
+        if (!(p = regprefix(r, s + pos, s + len)))
+          return nfound;
+        if (p != s + pos) {
+          pos = p - s;
+          if ((t = dfa_get(r, r->kbuf, 0, regflags(s, pos), &flushes)) < 0) {
+            k = r->kbuf;
+            n = 0;
+            flags = regflags(s, pos);
+            goto nfa;
+          }
+          st = r->states[t];
         }
       }
-      break;
+    }
 
-    case KPLUS:
-    case STAR:
-      {
-        char   nextch =
-          (OP(next) == EXACTLY) ? *OPERAND(next) : '\0';
-        size_t no;
-        char  *save = reginput;
-        size_t minimum = (OP(scan) == STAR) ? 0 : 1;
-
-        for(no = regrepeat(OPERAND(scan)) + 1; no > minimum; no--) {
-          reginput = save + no -1;
-          /* If it could work, try it. */
-          if (nextch == '\0' || *reginput == nextch)
-            if (regmatch(next))
-              return 1;
-        }
-        return 0;
+    c = s[pos];
+    if ((t = st->next[c]) >= 0) {
+      if (t & 1) {
+        if (!found)
+          return 1;
+        nfound += dfa_merge(r, st, c, found);
       }
-
-    case END:
-      return 1;		/* Success! */
-
-    default:
-      if(OP(scan) >= OPEN && OP(scan)<OPEN+NSUBEXP)
-      {
-        int    no = OP(scan) - OPEN;
-        char  *input = reginput;
-
-        if (regmatch(next))
-        {
-          /*
-           * Don't set startp if some later invocation of the same
-           * parentheses already has.
-           */
-          if (regstartp[no] == NULL)
-            regstartp[no] = input;
+    }
+    else {
+      k = r->kbuf;
+      matched = dfa_closure(r, st->kernel, st->n, st->flags, c, k, &n, NULL);
+      if (matched) {
+        if (!found)
           return 1;
-        } else
-          return 0;
+        nfound += dfa_merge(r, st, c, found);
       }
+      flags = regword[c] ? DS_WORD : 0;
+      m = flushes;
+      if ((t = dfa_get(r, k, n, flags, &flushes)) < 0) {
+        pos++;
+        goto nfa;
+      }
+      if (m == flushes)
+        st->next[c] = t << 1 | matched;
+      t <<= 1;
+    }
 
-      if(OP(scan) >= CLOSE && OP(scan)<CLOSE+NSUBEXP)
-      {
-        int    no = OP(scan) - CLOSE;
-        char  *input = reginput;
-
-        if (regmatch(next))
-        {
-          /*
-           * Don't set endp if some later invocation of the same
-           * parentheses already has.
-           */
-          if (regendp[no] == NULL)
-            regendp[no] = input;
-          return 1;
+    if (found && nfound == r->npatterns)
+      return nfound;
+    st = r->states[t >> 1];
+  }
+
+  if (st->end < 0)
+    st->end = dfa_closure(r, st->kernel, st->n, st->flags, -1,
+                          NULL, NULL, NULL);
+  if (st->end) {
+    if (!found)
+      return 1;
+    nfound += dfa_merge(r, st, -1, found);
+  }
+  return nfound;
+
+ nfa:
+  /* The cache thrashes, continue without it. The next kernel is k,
+   * of length n, at pos. */
+  for (;; pos++) {
+    c = pos < len ? s[pos] : -1;
+    k2 = (k == r->kbuf) ? r->kbuf + r->ninst : r->kbuf;
+    if (dfa_closure(r, k, n, flags, c, c < 0 ? NULL : k2, &m,
+                    found ? r->ids : NULL)) {
+      if (!found)
+        return 1;
+      for (t = 0; r->ids[t] >= 0; t++)
+        if (!found[r->ids[t]]) {
+          found[r->ids[t]] = 1;
+          nfound++;
         }
-        else
-          return 0;
-      }
-      regerror("memory corruption");
-      return 0;
+      if (nfound == r->npatterns)
+        return nfound;
     }
-    scan = next;
+    if (c < 0)
+      return nfound;
+    k = k2;
+    n = m;
+    flags = regword[c] ? DS_WORD : 0;
   }
+}
 
-  /*
-   * We get here only if there's trouble -- normally "case END" is the
-   * terminating point.
-   */
-  regerror("corrupted pointers");
-  return 0;
+int pike_regexec(regexp *r, const unsigned char *s, size_t len)
+{
+  if (r == NULL)
+    regerror("NULL parameter");
+  return dfa_search(r, s, len, NULL);
 }
 
 /*
- - regrepeat - repeatedly match something simple, report how many
+ - pike_regexec_set - find the patterns in a set that match
+ *
+ * Stores their numbers in ids, in order, and returns how many they
+ * are.
  */
-static size_t regrepeat(const char *node)
+int pike_regexec_set(regexp *r, const unsigned char *s, size_t len,
+                     int *ids)
 {
-  switch (OP(node))
-  {
-  case ANY:
-    return(strlen(reginput));
-    break;
-
-  case EXACTLY:
-    {
-      char   *scan;
-      char   ch = *OPERAND(node);
-      size_t count = 0;
-
-      for (scan = reginput; *scan == ch; scan++)
-        count++;
-      return count;
-    }
-    break;
+  int i, n = 0;
 
-  case ANYOF:
-    return strspn(reginput, OPERAND(node));
-    break;
-
-  case ANYBUT:
-    return strcspn(reginput, OPERAND(node));
-    break;
+  if (r == NULL)
+    regerror("NULL parameter");
 
-  default:			/* Oh dear.  Called inappropriately. */
-    regerror("internal foulup");
-    return 0;		/* Best compromise. */
-    break;
-  }
+  memset(r->found, 0, r->npatterns);
+  if (dfa_search(r, s, len, r->found))
+    for (i = 0; i < r->npatterns; i++)
+      if (r->found[i])
+        ids[n++] = i;
+  return n;
 }
 
-
 /*
- - regnext - dig the "next" pointer out of a node
+ * The Pike VM.  A thread list holds the program counters and the
+ * submatch slots of the threads, in priority order.
  */
-static char *regnext(char *p)
+struct regthreads
 {
-  int offset = NEXT(p);
-
-  if (offset == 0)
-    return NULL;
-
-  if (OP(p) == BACK)
-    return (p - offset);
-  else
-    return (p + offset);
-}
-
-#ifdef PIKE_DEBUG
-
-static char *regprop(char *);
+  int n;
+  ptrdiff_t *pc;
+  ptrdiff_t *cap;
+};
 
 /*
- - regdump - dump a regexp onto stdout in vaguely comprehensible form
+ - vm_add - add a thread, and those it splits into, to a list
+ *
+ * The instructions are followed depth first, preferred branch first,
+ * so the threads end up in priority order.  A thread that reaches an
+ * instruction already in the list dies, since an earlier one got
+ * there with higher priority.  cap is changed, but restored when
+ * done.
  */
-void regdump(regexp *r)
+static void vm_add(regexp *r, struct regthreads *l, ptrdiff_t pc,
+                   ptrdiff_t *cap, const unsigned char *s, size_t len,
+                   size_t pos, ptrdiff_t *stack)
 {
-    char  *s;
-    char   op = EXACTLY;	/* Arbitrary non-END op. */
-    char  *next;
-
-    s = r->program;
-    while (op != END) {		/* While that wasn't END last time... */
-	op = OP(s);
-	printf("%2ld%s",	/* Where, what. */
-               (long)(s - r->program),
-	       regprop(s));
-	next = regnext(s);
-	if (next == NULL)	/* next ptr. */
-	    printf("(0)");
-	else
-	    printf("(%ld)",
-                   (long)( (s - r->program) + (next - s)));
-	s += 3;
-	if (op == ANYOF || op == ANYBUT || op == EXACTLY) {
-	    /* Literal string, where present. */
-	    while (*s != '\0') {
-		putchar(*s);
-		s++;
-	    }
-	    s++;
-	}
-	putchar('\n');
+  int flags = regflags(s, pos), c = pos < len ? s[pos] : -1;
+  int ncap = r->ncap, sp = 0;
+  const struct reginst *in;
+  ptrdiff_t v;
+
+  /* A pc, or a negative slot to restore and its value. */
+#define PUSH(A, B) do { stack[sp++] = (A); stack[sp++] = (B); } while(0)
+
+  PUSH(pc, 0);
+  while (sp) {
+    sp -= 2;
+    pc = stack[sp];
+    v = stack[sp + 1];
+    if (pc < 0) {
+      cap[-pc - 1] = v;
+      continue;
     }
-
-    /* Header fields of interest. */
-    if (r->regstart != '\0')
-	printf("start `%c' ", r->regstart);
-    if (r->reganch)
-	printf("anchored ");
-    if (r->regmust != NULL)
-	printf("must have \"%s\"", r->regmust);
-    printf("\n");
+    if (r->mark[pc] == r->gen)
+      continue;
+    r->mark[pc] = r->gen;
+
+    in = r->prog + pc;
+    switch (in->op) {
+    case I_JMP:
+      PUSH(in->x, 0);
+      break;
+    case I_SPLIT:
+      PUSH(in->y, 0);
+      PUSH(in->x, 0);
+      break;
+    case I_SAVE:
+      PUSH(-in->x - 1, cap[in->x]);
+      cap[in->x] = pos;
+      PUSH(pc + 1, 0);
+      break;
+    case I_BOL:
+    case I_EOL:
+    case I_WORDSTART:
+    case I_WORDEND:
+      if (regassert(in->op, flags, c))
+        PUSH(pc + 1, 0);
+      break;
+    default:
+      l->pc[l->n] = pc;
+      memcpy(l->cap + l->n * ncap, cap, ncap * sizeof(ptrdiff_t));
+      l->n++;
+    }
+  }
+#undef PUSH
 }
 
 /*
- - regprop - printable representation of opcode
+ - pike_regexec_sub - match, and find the positions of the ()
+ *
+ * sub gets the start and end of the whole match in 0 and 1, and of
+ * the n:th () in 2*n and 2*n+1, or -1 if it didn't take part in the
+ * match.  Only for single patterns.
  */
-static char *regprop(char *op)
+int pike_regexec_sub(regexp *r, const unsigned char *s, size_t len,
+                     ptrdiff_t *sub)
 {
-    char  *p;
-    static char     buf[50];
-
-    strcpy(buf, ":");
-
-    switch (OP(op)) {
-    case BOL:
-	p = "BOL";
-	break;
-    case EOL:
-	p = "EOL";
-	break;
-    case ANY:
-	p = "ANY";
-	break;
-    case ANYOF:
-	p = "ANYOF";
-	break;
-    case ANYBUT:
-	p = "ANYBUT";
-	break;
-    case BRANCH:
-	p = "BRANCH";
-	break;
-    case EXACTLY:
-	p = "EXACTLY";
-	break;
-    case NOTHING:
-	p = "NOTHING";
-	break;
-    case BACK:
-	p = "BACK";
-	break;
-    case END:
-	p = "END";
-	break;
-
-    case STAR:
-	p = "STAR";
-	break;
-
-    case KPLUS:
-	p = "KPLUS";
-	break;
+  struct regthreads clist, nlist, tmp;
+  const unsigned char *p;
+  const struct reginst *in;
+  ptrdiff_t *cap0, *tcap, *stack, *best;
+  int ncap, matched = 0, i, c;
+  size_t pos = 0;
+
+  if (r == NULL)
+    regerror("NULL parameter");
 
-    default:
-        if(OP(op) >= OPEN && OP(op) < OPEN+NSUBEXP)
-	{
-	  sprintf(buf + strlen(buf), "OPEN%d", OP(op) - OPEN);
-	  p = NULL;
-	  break;
-	}
-        if(OP(op) >= CLOSE && OP(op) < CLOSE+NSUBEXP)
-	{
-	  sprintf(buf + strlen(buf), "CLOSE%d", OP(op) - CLOSE);
-	  p = NULL;
-	  break;
-	}
-	regerror("corrupted opcode");
-	p=NULL;
-	break;
+  /* The DFA is a lot faster at saying no. */
+  if (!dfa_search(r, s, len, NULL))
+    return 0;
+
+  ncap = r->ncap;
+  if (!r->vm)
+    r->vm = xalloc((2 * r->ninst * (1 + ncap) + 2 * ncap +
+                    4 * r->ninst + 2) * sizeof(ptrdiff_t));
+  clist.pc = r->vm;
+  clist.cap = clist.pc + r->ninst;
+  nlist.pc = clist.cap + r->ninst * ncap;
+  nlist.cap = nlist.pc + r->ninst;
+  cap0 = nlist.cap + r->ninst * ncap;
+  best = cap0 + ncap;
+  stack = best + ncap;
+
+  for (i = 0; i < ncap; i++)
+    cap0[i] = -1;
+
+  if (r->prefixlen && (p = regprefix(r, s, s + len)))
+    pos = p - s;
+
+  regnextgen(r);
+  clist.n = 0;
+  vm_add(r, &clist, 0, cap0, s, len, pos, stack);
+
+  for (;; pos++) {
+    c = pos < len ? s[pos] : -1;
+    regnextgen(r);
+    nlist.n = 0;
+
+    for (i = 0; i < clist.n; i++) {
+      in = r->prog + clist.pc[i];
+      tcap = clist.cap + i * ncap;
+      if (in->op == I_MATCH) {
+        /* The threads after this one have lower priority. */
+        matched = 1;
+        memcpy(best, tcap, ncap * sizeof(ptrdiff_t));
+        break;
+      }
+      if (regconsumes(r, in, c))
+        vm_add(r, &nlist, clist.pc[i] + 1, tcap, s, len, pos + 1, stack);
+    }
+
+    if (c < 0)
+      break;
+
+    if (!matched) {
+      if (!nlist.n) {
+        if (r->anchored)
+          break;
+        if (r->prefixlen) {
+          if (!(p = regprefix(r, s + pos + 1, s + len)))
+            break;
+          pos = p - s - 1;
+        }
+      }
+      vm_add(r, &nlist, 0, cap0, s, len, pos + 1, stack);
     }
-    if (p != NULL)
-	strcat(buf, p);
-    return (buf);
+    else if (!nlist.n)
+      break;
+
+    tmp = clist;
+    clist = nlist;
+    nlist = tmp;
+  }
+
+  if (!matched)
+    return 0;
+
+  for (i = 0; i < 2 * NSUBEXP; i++)
+    sub[i] = i < ncap ? best[i] : -1;
+  return 1;
 }
-#endif
@@ -8,29 +8,26 @@
 #define REGEXP_H
 
 /*
- * Definitions etc. for regexp(3) routines.
+ * Definitions etc. for the regexp routines.
  *
- * Caveat:  this is V8 regexp(3) [actually, a reimplementation thereof],
- * not the System V one.
+ * The syntax is that of V8 regexp(3), but the matcher is an automaton
+ * and runs in time linear in the length of the subject.
  */
 
 #define NSUBEXP  40
-typedef struct regexp
-{
-  char *startp[NSUBEXP];
-  char *endp[NSUBEXP];
-  char regstart;		/* Internal use only. */
-  char reganch;			/* Internal use only. */
-  char *regmust;		/* Internal use only. */
-  size_t regmlen;		/* Internal use only. */
-  char program[1];		/* Unwarranted chumminess with compiler. */
-} regexp;
-
 
+/* Opaque, see pike_regexp.c. */
+typedef struct regexp regexp;
 
 /* Prototypes begin here */
-regexp *pike_regcomp(const char *exp);
-int pike_regexec(regexp *prog, char *string);
+regexp *pike_regcomp(const char *exp, size_t len);
+regexp *pike_regcomp_set(const char **exps, const size_t *lens, int n);
+void pike_regfree(regexp *r);
+int pike_regexec(regexp *r, const unsigned char *s, size_t len);
+int pike_regexec_sub(regexp *r, const unsigned char *s, size_t len,
+		     ptrdiff_t *sub);
+int pike_regexec_set(regexp *r, const unsigned char *s, size_t len,
+		     int *ids);
 /* Prototypes end here */
 
 #endif
@@ -1160,6 +1160,11 @@ static void exit_gz_inflate(struct object *UNUSED(o))
 /*! @endclass
  */
 
+/* Checksums of strings at least this long are calculated without
+ * the interpreter lock.
+ */
+#define CHECKSUM_THREADS_LIMIT	65536
+
 /*! @decl int crc32(string(8bit) data, void|int(0..) start_value)
  *!
  *!   This function calculates the standard ISO3309 Cyclic Redundancy Check.
@@ -1180,9 +1185,15 @@ static void gz_crc32(INT32 args)
    } else
       crc=0;
 
-   crc=crc32(crc,
-	     (unsigned char*)sp[-args].u.string->str,
-             (unsigned INT32)(sp[-args].u.string->len));
+   {
+     struct pike_string *s = sp[-args].u.string;
+     if (s->len >= CHECKSUM_THREADS_LIMIT) {
+       THREADS_ALLOW();
+       crc = crc32(crc, (unsigned char*)s->str, (unsigned INT32)s->len);
+       THREADS_DISALLOW();
+     } else
+       crc = crc32(crc, (unsigned char*)s->str, (unsigned INT32)s->len);
+   }
 
    pop_n_elems(args);
    push_int64((INT64)crc);
@@ -1208,14 +1219,78 @@ static void gz_adler32(INT32 args)
    } else
       crc=1;
 
-   crc=adler32(crc,
-               (unsigned char*)sp[-args].u.string->str,
-               (unsigned INT32)(sp[-args].u.string->len));
+   {
+     struct pike_string *s = sp[-args].u.string;
+     if (s->len >= CHECKSUM_THREADS_LIMIT) {
+       THREADS_ALLOW();
+       crc = adler32(crc, (unsigned char*)s->str, (unsigned INT32)s->len);
+       THREADS_DISALLOW();
+     } else
+       crc = adler32(crc, (unsigned char*)s->str, (unsigned INT32)s->len);
+   }
 
    pop_n_elems(args);
    push_int64((INT64)crc);
 }
 
+#ifdef HAVE_CRC32_COMBINE
+/*! @decl int crc32_combine(int(0..) crc1, int(0..) crc2, int(0..) len2)
+ *!
+ *!   Combines two @[crc32()] checksums.
+ *!
+ *! @param crc1
+ *!   The checksum of the first part of the data.
+ *!
+ *! @param crc2
+ *!   The checksum of the second part of the data.
+ *!
+ *! @param len2
+ *!   The length of the second part of the data.
+ *!
+ *! @returns
+ *!   The checksum of the concatenation of the two parts, ie
+ *!   @expr{crc32(a + b) == crc32_combine(crc32(a), crc32(b), sizeof(b))@}.
+ *!
+ *! @note
+ *!   This function is only available if Pike was compiled with
+ *!   zlib 1.2.2.1 or later.
+ *!
+ *! @seealso
+ *!   @[crc32()], @[adler32_combine()]
+ */
+static void gz_crc32_combine(INT32 args)
+{
+  INT_TYPE crc1, crc2, len2;
+  get_all_args("crc32_combine", args, "%+%+%+", &crc1, &crc2, &len2);
+  crc1 = crc32_combine((uLong)crc1, (uLong)crc2, (z_off_t)len2);
+  pop_n_elems(args);
+  push_int64((INT64)(crc1 & 0xffffffff));
+}
+#endif
+
+#ifdef HAVE_ADLER32_COMBINE
+/*! @decl int adler32_combine(int(0..) adler1, int(0..) adler2, @
+ *!                           int(0..) len2)
+ *!
+ *!   Combines two @[adler32()] checksums. See @[crc32_combine()].
+ *!
+ *! @note
+ *!   This function is only available if Pike was compiled with
+ *!   zlib 1.2.2.1 or later.
+ *!
+ *! @seealso
+ *!   @[adler32()], @[crc32_combine()]
+ */
+static void gz_adler32_combine(INT32 args)
+{
+  INT_TYPE adler1, adler2, len2;
+  get_all_args("adler32_combine", args, "%+%+%+", &adler1, &adler2, &len2);
+  adler1 = adler32_combine((uLong)adler1, (uLong)adler2, (z_off_t)len2);
+  pop_n_elems(args);
+  push_int64((INT64)(adler1 & 0xffffffff));
+}
+#endif
+
 static void gz_deflate_size( INT32 args )
 {
 #define L_CODES (256 + 29 + 1)
@@ -1342,6 +1417,14 @@ PIKE_MODULE_INIT
   /* function(string(8bit),void|int:int) */
   ADD_FUNCTION("crc32",gz_crc32,tFunc(tStr8 tOr(tVoid,tIntPos),tIntPos),0);
   ADD_FUNCTION("adler32",gz_adler32,tFunc(tStr8 tOr(tVoid,tIntPos),tIntPos),0);
+#ifdef HAVE_CRC32_COMBINE
+  ADD_FUNCTION("crc32_combine", gz_crc32_combine,
+               tFunc(tIntPos tIntPos tIntPos, tIntPos), 0);
+#endif
+#ifdef HAVE_ADLER32_COMBINE
+  ADD_FUNCTION("adler32_combine", gz_adler32_combine,
+               tFunc(tIntPos tIntPos tIntPos, tIntPos), 0);
+#endif
 
   /* function(string(8bit)|String.Buffer|System.Memory|Stdio.Buffer,void|int(0..1),void|int,void|int:string(8bit)) */
   ADD_FUNCTION("compress",gz_compress,tFunc(tOr(tStr8,tObj) tOr(tVoid,tInt01) tOr(tVoid,tInt09) tOr(tVoid,tInt) tOr(tVoid,tInt),tStr8),0);
@@ -619,6 +619,72 @@ void set_jpeg_transform_options(INT32 args, jpeg_transform_info *options)
 }
 #endif /*TRANSFORMS_SUPPORTED*/
 
+/* Sets the compression parameters given in the options mapping map. */
+static void parameter_compress(struct svalue *map,
+			       struct jpeg_compress_struct *cinfo)
+{
+   INT32 p,q=95;
+
+   p=-1;
+   if (parameter_int(map,param_quality,&q)) {
+      if (q<25) p=0; else p=1;
+   }
+   if (parameter_int(map,param_baseline,&p) || p!=-1)
+   {
+      if (q<0) q=0; else if (q>100) q=100;
+      jpeg_set_quality(cinfo, q, (boolean)(!!p));
+   }
+
+   if (parameter_int(map,param_grayscale,&p) && p)
+   {
+      jpeg_set_colorspace(cinfo,JCS_GRAYSCALE);
+      cinfo->input_components=3;     /* 1 */
+      cinfo->in_color_space=JCS_RGB; /* JCS_GRAYSCALE */
+   }
+
+   if (parameter_int(map,param_optimize,&p))
+   {
+      cinfo->optimize_coding=!!p;
+   }
+
+   if (parameter_int(map,param_smoothing,&p))
+   {
+      if (p<1) p=1; else if (p>100) p=100;
+      cinfo->smoothing_factor=p;
+   }
+
+   if (parameter_int(map,param_x_density,&p) &&
+       parameter_int(map,param_y_density,&q))
+   {
+      cinfo->X_density=p;
+      cinfo->Y_density=q;
+      cinfo->density_unit=1;
+   }
+
+   if (parameter_int(map,param_density,&p))
+   {
+      cinfo->X_density=p;
+      cinfo->Y_density=p;
+      cinfo->density_unit=1;
+   }
+
+   if (parameter_int(map,param_density_unit,&p))
+      cinfo->density_unit=p;
+
+   if (parameter_int(map,param_method,&p)
+       && (p==JDCT_IFAST ||
+	   p==JDCT_FLOAT ||
+	   p==JDCT_DEFAULT ||
+	   p==JDCT_ISLOW ||
+	   p==JDCT_FASTEST))
+      cinfo->dct_method=p;
+
+   if (parameter_int(map,param_progressive,&p) && p)
+      jpeg_simple_progression(cinfo);
+
+   parameter_qt(map,param_quant_tables,cinfo);
+}
+
 /*! @decl string encode(object image)
  *! @decl string encode(string|object image, mapping options)
  *! Encodes an @[image] object with JPEG compression. The image
@@ -804,69 +870,7 @@ static void image_jpeg_encode(INT32 args)
 
    /* check configuration */
    if (args>1)
-   {
-      INT32 p,q=95;
-
-      p=-1;
-      if (parameter_int(sp+1-args,param_quality,&q)) {
-	 if (q<25) p=0; else p=1;
-      }
-      if (parameter_int(sp+1-args,param_baseline,&p) || p!=-1)
-      {
-	 if (q<0) q=0; else if (q>100) q=100;
-	 jpeg_set_quality(&cinfo, q, (boolean)(!!p));
-      }
-
-      if (parameter_int(sp+1-args,param_grayscale,&p) && p)
-      {
-	 jpeg_set_colorspace(&cinfo,JCS_GRAYSCALE);
-	 cinfo.input_components=3;     /* 1 */
-	 cinfo.in_color_space=JCS_RGB; /* JCS_GRAYSCALE */
-      }
-
-      if (parameter_int(sp+1-args,param_optimize,&p))
-      {
-	 cinfo.optimize_coding=!!p;
-      }
-
-      if (parameter_int(sp+1-args,param_smoothing,&p))
-      {
-	 if (p<1) p=1; else if (p>100) p=100;
-	 cinfo.smoothing_factor=p;
-      }
-
-
-      if (parameter_int(sp+1-args,param_x_density,&p) &&
-	  parameter_int(sp+1-args,param_y_density,&q))
-      {
-	 cinfo.X_density=p;
-	 cinfo.Y_density=q;
-	 cinfo.density_unit=1;
-      }
-
-      if (parameter_int(sp+1-args,param_density,&p))
-      {
-	 cinfo.X_density=p;
-	 cinfo.Y_density=p;
-	 cinfo.density_unit=1;
-      }
-
-      if (parameter_int(sp+1-args,param_density_unit,&p))
-	 cinfo.density_unit=p;
-
-      if (parameter_int(sp+1-args,param_method,&p)
-	  && (p==JDCT_IFAST ||
-	      p==JDCT_FLOAT ||
-	      p==JDCT_DEFAULT ||
-	      p==JDCT_ISLOW ||
-	      p==JDCT_FASTEST))
-	 cinfo.dct_method=p;
-
-      if (parameter_int(sp+1-args,param_progressive,&p) && p)
-	 jpeg_simple_progression(&cinfo);
-
-      parameter_qt(sp+1-args,param_quant_tables,&cinfo);
-   }
+      parameter_compress(sp+1-args,&cinfo);
 
    if (img) {
        jpeg_start_compress(&cinfo, TRUE);
@@ -1353,6 +1357,257 @@ void image_jpeg__decode(INT32 args)
    img_jpeg_decode(args,IMG_DECODE_MUCH);
 }
 
+/*! @decl string thumbnail(string data, int(1..) max_xsize, @
+ *!                        int(1..) max_ysize)
+ *! @decl string thumbnail(string data, int(1..) max_xsize, @
+ *!                        int(1..) max_ysize, mapping options)
+ *! Makes a JPEG thumbnail of the JPEG image @[data], as large as
+ *! possible while fitting in @[max_xsize] x @[max_ysize] pixels and
+ *! keeping the aspect ratio. Images that already fit are not
+ *! enlarged.
+ *!
+ *! The result is about the same as from
+ *! @code
+ *!   encode(decode(data)->scale(...), options)
+ *! @endcode
+ *! but the image is never decoded at full size. It is decoded with
+ *! the largest libjpeg DCT scaling (1/2, 1/4 or 1/8) that still gives
+ *! at least the wanted size, and every decoded row is box filtered
+ *! down to the wanted size and passed on to the compressor right
+ *! away. The memory used is proportional to the width of the image
+ *! rather than to its area.
+ *!
+ *! The @[options] are the ones of @[encode], and the
+ *! @expr{"fancy_upsampling"@} and @expr{"block_smoothing"@} options
+ *! of @[decode]. The @expr{"method"@} is used both when decoding and
+ *! when encoding. The markers of @[data] are not copied to the
+ *! result.
+ *!
+ *! @seealso
+ *!   @[decode], @[encode], @[Image.Image()->scale]
+ */
+
+static void image_jpeg_thumbnail(INT32 args)
+{
+   struct jpeg_error_mgr errmgr;
+   struct my_source_mgr srcmgr;
+   struct my_decompress_struct mds;
+   struct my_destination_mgr destmgr;
+   struct jpeg_compress_struct cinfo;
+
+   INT_TYPE max_x, max_y;
+   INT32 w, h, dw, dh, sw, sh, denom, x, y, dy;
+   INT32 *xidx, *xw;
+   INT64 *hrow, *acc, *next, total;
+   unsigned char *mem, *src, *dst;
+   JSAMPROW row;
+   int comp;
+
+   if (args<3
+       || TYPEOF(sp[-args]) != T_STRING
+       || TYPEOF(sp[1-args]) != T_INT || sp[1-args].u.integer<1
+       || TYPEOF(sp[2-args]) != T_INT || sp[2-args].u.integer<1
+       || (args>3 && TYPEOF(sp[3-args]) != T_MAPPING))
+      Pike_error("Image.JPEG.thumbnail: Illegal arguments\n");
+
+   max_x=sp[1-args].u.integer;
+   max_y=sp[2-args].u.integer;
+
+   init_src(sp[-args].u.string, &errmgr, &srcmgr, &mds);
+
+   while (mds.first_marker)
+   {
+     struct my_marker *mm=mds.first_marker;
+     mds.first_marker=mm->next;
+     free(mm);
+   }
+
+   if (mds.cinfo.jpeg_color_space == JCS_CMYK ||
+       mds.cinfo.jpeg_color_space == JCS_YCCK)
+     mds.cinfo.out_color_space = JCS_CMYK;
+   else
+     mds.cinfo.out_color_space = JCS_RGB;
+
+   /* size of the thumbnail */
+
+   w=mds.cinfo.image_width;
+   h=mds.cinfo.image_height;
+   if (max_x>w) max_x=w;
+   if (max_y>h) max_y=h;
+
+   if ((INT64)w*max_y > (INT64)h*max_x)
+   {
+      dw=(INT32)max_x;
+      dh=(INT32)(((INT64)h*max_x+w/2)/w);
+   }
+   else
+   {
+      dh=(INT32)max_y;
+      dw=(INT32)(((INT64)w*max_y+h/2)/h);
+   }
+   if (dw<1) dw=1;
+   if (dh<1) dh=1;
+
+   /* let libjpeg do as much of the scaling as possible */
+
+   for (denom=8; denom>1; denom/=2)
+      if ((w+denom-1)/denom>=dw && (h+denom-1)/denom>=dh)
+	 break;
+   mds.cinfo.scale_num=1;
+   mds.cinfo.scale_denom=denom;
+
+   if (args>3)
+   {
+      INT32 p;
+
+      if (parameter_int(sp+3-args,param_method,&p)
+	  && (p==JDCT_IFAST ||
+	      p==JDCT_FLOAT ||
+	      p==JDCT_DEFAULT ||
+	      p==JDCT_ISLOW ||
+	      p==JDCT_FASTEST))
+	 mds.cinfo.dct_method=p;
+
+      if (parameter_int(sp+3-args,param_fancy_upsampling,&p))
+	 mds.cinfo.do_fancy_upsampling=!!p;
+
+      if (parameter_int(sp+3-args,param_block_smoothing,&p))
+	 mds.cinfo.do_block_smoothing=!!p;
+   }
+
+   jpeg_start_decompress(&mds.cinfo);
+   sw=mds.cinfo.output_width;
+   sh=mds.cinfo.output_height;
+   comp=mds.cinfo.output_components;
+   if (dw>sw) dw=sw;
+   if (dh>sh) dh=sh;
+
+   /* One decoded row, one encoded row, the column mapping, and the
+    * current and next output row of sums. */
+   mem=malloc(sw*comp + dw*3 + sw*2*sizeof(INT32) + dw*3*3*sizeof(INT64));
+   if (!mem)
+   {
+      jpeg_destroy_decompress(&mds.cinfo);
+      Pike_error("Image.JPEG.thumbnail: out of memory\n");
+   }
+   hrow=(INT64 *)mem;
+   acc=hrow+dw*3;
+   next=acc+dw*3;
+   xidx=(INT32 *)(next+dw*3);
+   xw=xidx+sw;
+   src=(unsigned char *)(xw+sw);
+   dst=src+sw*comp;
+
+   /* Source column x covers [x*dw,(x+1)*dw) and destination column
+    * j covers [j*sw,(j+1)*sw). As sw>=dw, a source column overlaps at
+    * most two destination columns; xw is the overlap with the first.
+    * Rows are handled the same way, so the weights of every
+    * destination pixel add up to sw*sh.
+    */
+   for (x=0; x<sw; x++)
+   {
+      INT64 j=(INT64)x*dw/sw;
+      xidx[x]=(INT32)j;
+      xw[x]=(INT32)(MINIMUM((j+1)*sw,(INT64)(x+1)*dw)-(INT64)x*dw);
+   }
+   total=(INT64)sw*sh;
+
+   jpeg_std_error(&errmgr);
+   errmgr.error_exit=my_error_exit;
+   errmgr.emit_message=my_emit_message;
+   errmgr.output_message=my_output_message;
+
+   destmgr.pub.init_destination=my_init_destination;
+   destmgr.pub.empty_output_buffer=my_empty_output_buffer;
+   destmgr.pub.term_destination=my_term_destination;
+
+   cinfo.err=&errmgr;
+   jpeg_create_compress(&cinfo);
+   cinfo.dest=(struct jpeg_destination_mgr*)&destmgr;
+
+   cinfo.image_width=dw;
+   cinfo.image_height=dh;
+   cinfo.input_components=3;
+   cinfo.in_color_space=JCS_RGB;
+
+   jpeg_set_defaults(&cinfo);
+   cinfo.optimize_coding=(dw*dh)<50000;
+
+   if (args>3)
+      parameter_compress(sp+3-args,&cinfo);
+
+   jpeg_start_compress(&cinfo, TRUE);
+
+   if (args>3)
+      parameter_comment(sp+3-args,param_comment,&cinfo);
+
+   THREADS_ALLOW();
+   memset(acc,0,dw*3*sizeof(INT64));
+   memset(next,0,dw*3*sizeof(INT64));
+   dy=0;
+   for (y=0; y<sh; y++)
+   {
+      INT64 y0=(INT64)y*dh, y1=y0+dh, wy0, wy1;
+      unsigned char *s=src;
+
+      row=src;
+      jpeg_read_scanlines(&mds.cinfo, &row, 1);
+
+      memset(hrow,0,dw*3*sizeof(INT64));
+      for (x=0; x<sw; x++)
+      {
+	 INT64 *hp=hrow+xidx[x]*3;
+	 INT32 a=xw[x], b=dw-a;
+	 int r,g,bl;
+
+	 if (comp==3)
+	    r=s[0], g=s[1], bl=s[2];
+	 else if (comp==4)
+	    r=(s[0]*s[3])/255, g=(s[1]*s[3])/255, bl=(s[2]*s[3])/255;
+	 else
+	    r=g=bl=s[0];
+	 s+=comp;
+
+	 hp[0]+=r*a; hp[1]+=g*a; hp[2]+=bl*a;
+	 if (b)
+	 {
+	    hp[3]+=r*b; hp[4]+=g*b; hp[5]+=bl*b;
+	 }
+      }
+
+      wy0=MINIMUM((INT64)(dy+1)*sh,y1)-y0;
+      wy1=dh-wy0;
+      for (x=0; x<dw*3; x++)
+      {
+	 acc[x]+=hrow[x]*wy0;
+	 next[x]+=hrow[x]*wy1;
+      }
+
+      if (y1>=(INT64)(dy+1)*sh)
+      {
+	 INT64 *t;
+	 for (x=0; x<dw*3; x++)
+	    dst[x]=(unsigned char)((acc[x]+total/2)/total);
+	 row=dst;
+	 jpeg_write_scanlines(&cinfo, &row, 1);
+	 dy++;
+	 t=acc; acc=next; next=t;
+	 memset(next,0,dw*3*sizeof(INT64));
+      }
+   }
+   THREADS_DISALLOW();
+
+   free(mem);
+
+   jpeg_finish_decompress(&mds.cinfo);
+   jpeg_destroy_decompress(&mds.cinfo);
+   jpeg_finish_compress(&cinfo);
+
+   pop_n_elems(args);
+   push_string(my_result_and_clean(&cinfo));
+   jpeg_destroy_compress(&cinfo);
+}
+
 /*! @decl mapping(int:array(array(int))) quant_tables(int|void a)
  *! @fixme
  *!   Document this function
@@ -1567,6 +1822,8 @@ PIKE_MODULE_INIT
     ADD_FUNCTION("decode_header",image_jpeg_decode_header,
 		 tFunc(tStr tOr(tVoid,tOptions),tMap(tStr,tOr4(tStr,tInt,tFlt,tMap(tInt,tStr)))),0);
     ADD_FUNCTION("encode",image_jpeg_encode,tFunc(tOr(tObj,tStr) tOr(tVoid,tOptions),tStr),0);
+    ADD_FUNCTION("thumbnail",image_jpeg_thumbnail,
+		 tFunc(tStr tIntPos tIntPos tOr(tVoid,tOptions),tStr),0);
 
    add_integer_constant("IFAST", JDCT_IFAST, 0);
    add_integer_constant("FLOAT", JDCT_FLOAT, 0);
@@ -20,6 +20,7 @@
 #include "resultset.h"
 #include "blob.h"
 #include "buffer.h"
+#include "segment.h"
 
 #define sp Pike_sp
 
@@ -46,6 +47,9 @@ int wf_blob_next( Blob *b )
   if( b->eof )
     return 0;
 
+  if( b->cursors )
+    return wf_segment_blob_next( b );
+
   b->docid = 0;
   if( b->b->rpos >= b->b->size )
   {
@@ -93,6 +97,15 @@ int wf_blob_next( Blob *b )
   return wf_blob_docid( b );
 }
 
+int wf_blob_seek( Blob *b, unsigned int docid )
+{
+  if( b->cursors )
+    return wf_segment_blob_seek( b, docid );
+  while( !b->eof && (unsigned int)wf_blob_docid( b ) < docid )
+    wf_blob_next( b );
+  return wf_blob_docid( b );
+}
+
 int wf_blob_eof( Blob *b )
 {
   if( b->eof )
@@ -180,6 +193,8 @@ Blob *wf_blob_new( struct svalue *feed, struct pike_string *word )
 
 void wf_blob_free( Blob *b )
 {
+  if( b->cursors )
+    wf_segment_blob_free( b );
   if( b->b )
     wf_buffer_free( b->b );
   if( b->word )
@@ -7,6 +7,10 @@ typedef struct _Blob
   unsigned int eof;
 
   struct buffer *b;
+
+  struct wf_segment_cursor *cursors;
+  int ncursors;
+  /* Set when the hits are read from segments instead of 'feed' */
 } Blob;
 
 typedef enum {
@@ -46,6 +50,12 @@ void wf_blob_free( Blob *b );
 int wf_blob_next( Blob *b );
 /* Return the document-id of the next document in the blob, or -1 */
 
+int wf_blob_seek( Blob *b, unsigned int docid );
+/* Move forward to the first document with a document-id not less
+ * than docid, and return its document-id, or -1. Blobs reading from
+ * segments use the skip lists, others step through the documents.
+ */
+
 int wf_blob_nhits( Blob *b );
 /* Return the number of hits for the current document in the blob */
 
@@ -0,0 +1,1318 @@
+/*
+|| This file is part of Pike. For copyright information see COPYRIGHT.
+|| Pike is distributed under GPL, LGPL and MPL. See the file COPYING
+|| for more information.
+*/
+
+#include "global.h"
+#include "stralloc.h"
+#include "pike_macros.h"
+#include "interpret.h"
+#include "program.h"
+#include "object.h"
+#include "array.h"
+#include "module_support.h"
+#include "threads.h"
+#include "fdlib.h"
+#include "bignum.h"
+#include "builtin_functions.h"
+
+#include "config.h"
+
+#include "whitefish.h"
+#include "blob.h"
+#include "buffer.h"
+#include "segment.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#ifndef MAP_FAILED
+#define MAP_FAILED	((void *)-1)
+#endif
+
+/*
+  Segment files are immutable, and are mapped into memory when opened.
+  All fixed size integers are in NBO, var is an unsigned LEB128 integer.
+
+  +--------+-------------+------------+---------------+--------------+-----------+
+  | "WFSG" | version: 32 | nwords: 32 | max_docid: 32 | dict: 64     | size: 64  |
+  +--------+-------------+------------+---------------+--------------+-----------+
+
+  The header is followed by one posting list per word:
+
+  +------------+-------------+-------------------------------+---------+
+  | ndocs: var | nskips: var | skip: nskips*(base:32 off:32) | docs... |
+  +------------+-------------+-------------------------------+---------+
+
+  Skip entry n points at document (n+1)*SKIP_BLOCK of the list. 'off'
+  is relative to the first document and 'base' is the docid of the
+  document preceding it. Each document is stored as
+
+  +----------------+------------+----------+-------------+
+  | docid-prev:var | nhits: var | hit: var | hit-prev:var|...
+  +----------------+------------+----------+-------------+
+
+  with the hits (in the format used by Blob) sorted.
+
+  The dictionary at offset 'dict' is nwords 64 bit offsets to the
+  entries, followed by the entries, sorted by word in octet order:
+
+  +----------+------+---------------+------------+
+  | len: var | word | postings: var | ndocs: var |
+  +----------+------+---------------+------------+
+*/
+
+#define SEGMENT_MAGIC	0x57465347	/* "WFSG" */
+#define SEGMENT_VERSION	1
+#define SEGMENT_HEADER	32
+#define SKIP_BLOCK	64
+#define WRITE_BUFFER	65536
+
+struct wf_segment
+{
+  int refs;
+  unsigned char *data;
+  size_t size;
+  int mmapped;
+  unsigned int nwords;
+  unsigned int max_docid;
+  size_t dict;
+};
+
+struct segment_storage
+{
+  struct wf_segment *seg;
+};
+
+#define THIS ((struct segment_storage *)Pike_fp->current_storage)
+
+static struct program *segment_program;
+
+static inline unsigned int get_int( const unsigned char *p )
+{
+  return ((unsigned int)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+static inline UINT64 get_int64( const unsigned char *p )
+{
+  return ((UINT64)get_int( p )<<32) | get_int( p+4 );
+}
+
+static inline int get_varint( const unsigned char **pp,
+			      const unsigned char *end,
+			      UINT64 *res )
+{
+  const unsigned char *p = *pp;
+  UINT64 v = 0;
+  int shift = 0;
+  while( p < end && shift < 64 )
+  {
+    unsigned char c = *p++;
+    v |= (UINT64)(c & 0x7f) << shift;
+    if( !(c & 0x80) )
+    {
+      *pp = p;
+      *res = v;
+      return 1;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+static int word_cmp( const unsigned char *a, size_t al,
+		     const unsigned char *b, size_t bl )
+{
+  int c = memcmp( a, b, MINIMUM( al, bl ) );
+  if( c )
+    return c;
+  return al < bl ? -1 : al > bl;
+}
+
+static void segment_unref( struct wf_segment *s )
+{
+  if( --s->refs )
+    return;
+#ifdef HAVE_MMAP
+  if( s->mmapped )
+    munmap( (void *)s->data, s->size );
+  else
+#endif
+    free( s->data );
+  free( s );
+}
+
+/* Decode dictionary entry n. */
+static int segment_entry( struct wf_segment *s, unsigned int n,
+			  const unsigned char **word, size_t *len,
+			  UINT64 *postings, UINT64 *ndocs )
+{
+  const unsigned char *end = s->data + s->size, *p;
+  UINT64 off = get_int64( s->data + s->dict + 8*(size_t)n ), l;
+
+  if( off < s->dict || off >= s->size )
+    return 0;
+  p = s->data + off;
+  if( !get_varint( &p, end, &l ) || l > (UINT64)(end - p) )
+    return 0;
+  *word = p;
+  *len = (size_t)l;
+  p += l;
+  if( !get_varint( &p, end, postings ) || !get_varint( &p, end, ndocs ) )
+    return 0;
+  return *postings >= SEGMENT_HEADER && *postings < s->dict;
+}
+
+/* The index of the first word that is not less than 'word'. */
+static unsigned int segment_lower_bound( struct wf_segment *s,
+					 const unsigned char *word,
+					 size_t len )
+{
+  unsigned int lo = 0, hi = s->nwords;
+  while( lo < hi )
+  {
+    unsigned int mid = lo + (hi-lo)/2;
+    const unsigned char *w;
+    size_t wl;
+    UINT64 postings, ndocs;
+    segment_entry( s, mid, &w, &wl, &postings, &ndocs );
+    if( word_cmp( w, wl, word, len ) < 0 )
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int segment_find( struct wf_segment *s,
+			 const unsigned char *word, size_t len,
+			 UINT64 *postings, UINT64 *ndocs )
+{
+  unsigned int n = segment_lower_bound( s, word, len );
+  const unsigned char *w;
+  size_t wl;
+  if( n == s->nwords )
+    return 0;
+  segment_entry( s, n, &w, &wl, postings, ndocs );
+  return !word_cmp( w, wl, word, len );
+}
+
+static const char *segment_check( struct wf_segment *s )
+{
+  const unsigned char *d = s->data, *pw = NULL;
+  size_t pl = 0;
+  UINT64 dict;
+  unsigned int i;
+
+  if( get_int( d ) != SEGMENT_MAGIC )
+    return "Not a segment file";
+  if( get_int( d+4 ) != SEGMENT_VERSION )
+    return "Unsupported segment version";
+  if( get_int64( d+24 ) != s->size )
+    return "Truncated segment";
+
+  s->nwords = get_int( d+8 );
+  s->max_docid = get_int( d+12 );
+  dict = get_int64( d+16 );
+  if( dict < SEGMENT_HEADER || dict > s->size ||
+      (s->size - dict)/8 < s->nwords )
+    return "Corrupt dictionary";
+  s->dict = (size_t)dict;
+
+  /* The lookups depend on a valid and sorted dictionary. */
+  for( i = 0; i<s->nwords; i++ )
+  {
+    const unsigned char *w;
+    size_t wl;
+    UINT64 postings, ndocs;
+    if( !segment_entry( s, i, &w, &wl, &postings, &ndocs ) ||
+	(i && word_cmp( pw, pl, w, wl ) >= 0) )
+      return "Corrupt dictionary";
+    pw = w;
+    pl = wl;
+  }
+  return NULL;
+}
+
+static inline ptrdiff_t my_read( int fd, void *t, size_t towrite )
+{
+  ptrdiff_t res;
+  while( (res = fd_read( fd, t, towrite )) < 0 && errno == EINTR )
+    ;
+  return res;
+}
+
+static struct wf_segment *segment_open( const char *path, const char **err )
+{
+  struct wf_segment *s;
+  PIKE_STAT_T st;
+  size_t size;
+  int fd;
+
+  do
+  {
+    fd = fd_open( path, fd_RDONLY, 0 );
+    if( fd < 0 && errno == EINTR ) check_threads_etc();
+  } while( fd < 0 && errno == EINTR );
+
+  if( fd < 0 )
+  {
+    *err = strerror( errno );
+    return NULL;
+  }
+  if( fd_fstat( fd, &st ) || (st.st_mode & S_IFMT) != S_IFREG )
+  {
+    fd_close( fd );
+    *err = "Not a regular file";
+    return NULL;
+  }
+  size = (size_t)st.st_size;
+  if( size < SEGMENT_HEADER || (PIKE_OFF_T)size != st.st_size ||
+      !(s = calloc( 1, sizeof(struct wf_segment) )) )
+  {
+    fd_close( fd );
+    *err = size < SEGMENT_HEADER ? "Truncated segment" : "Out of memory";
+    return NULL;
+  }
+  s->refs = 1;
+  s->size = size;
+
+  THREADS_ALLOW();
+#ifdef HAVE_MMAP
+  s->data = mmap( 0, size, PROT_READ, MAP_SHARED, fd, 0 );
+  if( (void *)s->data != MAP_FAILED )
+    s->mmapped = 1;
+  else
+#endif
+  {
+    size_t pos = 0;
+    if( (s->data = malloc( size )) )
+      while( pos < size )
+      {
+	ptrdiff_t r = my_read( fd, s->data+pos, size-pos );
+	if( r <= 0 )
+	{
+	  free( s->data );
+	  s->data = NULL;
+	  break;
+	}
+	pos += r;
+      }
+  }
+  THREADS_DISALLOW();
+  fd_close( fd );
+
+  if( !s->data )
+  {
+    free( s );
+    *err = "Failed to read segment";
+    return NULL;
+  }
+  if( (*err = segment_check( s )) )
+  {
+    segment_unref( s );
+    return NULL;
+  }
+  return s;
+}
+
+/* Cursors. A cursor does not keep a reference to its segment. */
+
+static int cursor_init( struct wf_segment_cursor *c, struct wf_segment *s,
+			UINT64 postings )
+{
+  const unsigned char *p = s->data + postings;
+  UINT64 ndocs, nskips;
+
+  c->end = s->data + s->dict;
+  if( !get_varint( &p, c->end, &ndocs ) ||
+      !get_varint( &p, c->end, &nskips ) ||
+      ndocs > 0xffffffff || nskips > (UINT64)(c->end - p)/8 )
+    return 0;
+
+  c->seg = s;
+  c->ndocs = (unsigned int)ndocs;
+  c->nskips = (unsigned int)nskips;
+  c->skips = p;
+  c->docs = c->p = p + 8*nskips;
+  c->n = c->docid = c->nhits = 0;
+  c->hits = NULL;
+  c->eof = !ndocs;
+  return 1;
+}
+
+static int cursor_next( struct wf_segment_cursor *c )
+{
+  UINT64 delta, nhits;
+  unsigned int i;
+
+  if( c->eof )
+    return 0;
+  if( c->n == c->ndocs ||
+      !get_varint( &c->p, c->end, &delta ) ||
+      !get_varint( &c->p, c->end, &nhits ) ||
+      !nhits || nhits > 255 || delta > (UINT64)(0xffffffff - c->docid) ||
+      (c->n && !delta) )
+  {
+    c->eof = 1;
+    return 0;
+  }
+  c->docid += (unsigned int)delta;
+  c->nhits = (unsigned int)nhits;
+  c->hits = c->p;
+
+  /* Step past the hits, they are only decoded when asked for. */
+  for( i = 0; i < c->nhits && c->p < c->end; c->p++ )
+    if( !(*c->p & 0x80) )
+      i++;
+  if( i < c->nhits )
+  {
+    c->eof = 1;
+    return 0;
+  }
+  c->n++;
+  return 1;
+}
+
+#define SKIP_BASE(C,N) get_int( (C)->skips + 8*(N) )
+#define SKIP_OFF(C,N)  get_int( (C)->skips + 8*(N) + 4 )
+
+/* Move to the first document with a docid not less than 'target'. */
+static int cursor_seek( struct wf_segment_cursor *c, unsigned int target )
+{
+  unsigned int k;
+
+  if( c->eof )
+    return 0;
+  if( c->n && c->docid >= target )
+    return 1;
+
+  /* Gallop through the skip list, starting at the block after the
+   * current one, to find the last block starting before 'target'.
+   */
+  k = c->n ? (c->n-1)/SKIP_BLOCK : 0;
+  if( k < c->nskips && SKIP_BASE( c, k ) < target )
+  {
+    unsigned int step = 1, hi;
+    while( k+step < c->nskips && SKIP_BASE( c, k+step ) < target )
+    {
+      k += step;
+      step <<= 1;
+    }
+    hi = MINIMUM( k+step, c->nskips );
+    while( hi-k > 1 )
+    {
+      unsigned int mid = k + (hi-k)/2;
+      if( SKIP_BASE( c, mid ) < target )
+	k = mid;
+      else
+	hi = mid;
+    }
+    if( SKIP_OFF( c, k ) >= (size_t)(c->end - c->docs) ||
+	(UINT64)(k+1)*SKIP_BLOCK >= c->ndocs )
+    {
+      c->eof = 1;
+      return 0;
+    }
+    c->p = c->docs + SKIP_OFF( c, k );
+    c->docid = SKIP_BASE( c, k );
+    c->n = (k+1)*SKIP_BLOCK;
+  }
+
+  while( cursor_next( c ) )
+    if( c->docid >= target )
+      return 1;
+  return 0;
+}
+
+static unsigned int cursor_hits( struct wf_segment_cursor *c,
+				 unsigned short *hits )
+{
+  const unsigned char *p = c->hits;
+  unsigned int i, h = 0;
+  UINT64 v;
+  for( i = 0; i<c->nhits; i++ )
+  {
+    get_varint( &p, c->end, &v );
+    h += (unsigned int)v;
+    hits[i] = h;
+  }
+  return c->nhits;
+}
+
+/* Blobs reading from segments */
+
+void wf_segment_check_array( struct array *segments )
+{
+  int i;
+  for( i = 0; i<segments->size; i++ )
+  {
+    struct segment_storage *s;
+    if( TYPEOF(segments->item[i]) != T_OBJECT ||
+	!(s = get_storage( segments->item[i].u.object, segment_program )) )
+      Pike_error("Expected an array of Segment objects.\n");
+    if( !s->seg )
+      Pike_error("Segment %d is not open.\n", i);
+  }
+}
+
+Blob *wf_blob_new_segments( struct array *segments, struct pike_string *word )
+{
+  Blob *b = wf_blob_new( NULL, word );
+  int i;
+
+  b->cursors = xcalloc( segments->size+1, sizeof(struct wf_segment_cursor) );
+  wf_buffer_set_empty( b->b );
+
+  /* Segment words are 8bit (UTF-8), so a wide word can never match. */
+  if( !word->size_shift )
+    for( i = 0; i<segments->size; i++ )
+    {
+      struct wf_segment *s =
+	((struct segment_storage *)
+	 get_storage( segments->item[i].u.object, segment_program ))->seg;
+      UINT64 postings, ndocs;
+      if( segment_find( s, STR0(word), word->len, &postings, &ndocs ) &&
+	  cursor_init( b->cursors + b->ncursors, s, postings ) )
+      {
+	s->refs++;
+	b->ncursors++;
+      }
+    }
+  return b;
+}
+
+int wf_segment_blob_seek( Blob *b, unsigned int docid )
+{
+  unsigned short hits[255], tmp[255], res[255];
+  unsigned int min = 0, nhits = 0;
+  int i, found = 0;
+
+  if( b->eof )
+    return -1;
+
+  for( i = 0; i<b->ncursors; i++ )
+  {
+    struct wf_segment_cursor *c = b->cursors+i;
+    if( cursor_seek( c, docid ) && (!found || c->docid < min) )
+    {
+      min = c->docid;
+      found = 1;
+    }
+  }
+  if( !found )
+  {
+    b->eof = 1;
+    return -1;
+  }
+
+  /* Combine the hits of all segments having the document, keeping the
+   * first 255 as Blob does.
+   */
+  for( i = 0; i<b->ncursors; i++ )
+  {
+    struct wf_segment_cursor *c = b->cursors+i;
+    if( !c->eof && c->docid == min )
+    {
+      unsigned int n = cursor_hits( c, tmp ), x = 0, y = 0, r = 0;
+      while( r < 255 && (x < nhits || y < n) )
+	if( y == n || (x < nhits && hits[x] <= tmp[y]) )
+	  res[r++] = hits[x++];
+	else
+	  res[r++] = tmp[y++];
+      memcpy( hits, res, r*sizeof(hits[0]) );
+      nhits = r;
+    }
+  }
+
+  /* Present the document as a single classic blob record. */
+  wf_buffer_rewind_w( b->b, -1 );
+  b->b->rpos = 0;
+  wf_buffer_wint( b->b, min );
+  wf_buffer_wbyte( b->b, nhits );
+  for( i = 0; i<(int)nhits; i++ )
+    wf_buffer_wshort( b->b, hits[i] );
+  b->docid = min;
+  return min;
+}
+
+int wf_segment_blob_next( Blob *b )
+{
+  if( !b->b->size )
+    return wf_segment_blob_seek( b, 0 );
+  if( b->docid == 0xffffffff )
+  {
+    b->eof = 1;
+    return -1;
+  }
+  return wf_segment_blob_seek( b, b->docid+1 );
+}
+
+void wf_segment_blob_free( Blob *b )
+{
+  int i;
+  for( i = 0; i<b->ncursors; i++ )
+    segment_unref( b->cursors[i].seg );
+  free( b->cursors );
+  b->cursors = NULL;
+  b->ncursors = 0;
+}
+
+/* Writing segments. Everything here runs without the interpreter lock,
+ * so errors are recorded in 'err' instead of thrown.
+ */
+
+struct seg_doc
+{
+  unsigned int docid;
+  unsigned int nhits;
+  size_t hits;
+};
+
+struct seg_entry
+{
+  const unsigned char *word;
+  size_t len;
+  UINT64 postings;
+  unsigned int ndocs;
+};
+
+struct seg_writer
+{
+  int fd;
+  int err;
+  UINT64 pos;
+  size_t fill;
+  unsigned char *out;
+  unsigned int max_docid;
+
+  const unsigned int *deleted;
+  size_t ndeleted;
+
+  struct seg_doc *docs;
+  size_t ndocs, adocs;
+  unsigned short *hits;
+  size_t nhits, ahits;
+  unsigned short *group;
+  size_t agroup;
+  unsigned char *post;
+  size_t npost, apost;
+  unsigned int *skips;
+  size_t nskips, askips;
+  struct seg_entry *dict;
+  size_t nwords, adict;
+};
+
+static int grow( struct seg_writer *w, void *ptr, size_t *alloc,
+		 size_t need, size_t elem )
+{
+  void **pp = (void **)ptr, *p;
+  size_t n;
+  if( need <= *alloc )
+    return 1;
+  for( n = *alloc ? *alloc : 64; n < need; n *= 2 )
+    ;
+  if( !(p = realloc( *pp, n*elem )) )
+  {
+    if( !w->err ) w->err = ENOMEM;
+    return 0;
+  }
+  *pp = p;
+  *alloc = n;
+  return 1;
+}
+
+static void w_flush( struct seg_writer *w )
+{
+  size_t pos = 0;
+  while( pos < w->fill && !w->err )
+  {
+    ptrdiff_t r = fd_write( w->fd, w->out+pos, w->fill-pos );
+    if( r < 0 )
+    {
+      if( errno != EINTR )
+	w->err = errno;
+    }
+    else
+      pos += r;
+  }
+  w->fill = 0;
+}
+
+static void w_bytes( struct seg_writer *w, const unsigned char *data,
+		     size_t len )
+{
+  w->pos += len;
+  while( len )
+  {
+    size_t n = MINIMUM( len, WRITE_BUFFER - w->fill );
+    memcpy( w->out + w->fill, data, n );
+    w->fill += n;
+    data += n;
+    len -= n;
+    if( w->fill == WRITE_BUFFER )
+      w_flush( w );
+  }
+}
+
+static size_t put_int( unsigned char *p, unsigned int v )
+{
+  p[0] = v>>24; p[1] = v>>16; p[2] = v>>8; p[3] = v;
+  return 4;
+}
+
+static size_t put_int64( unsigned char *p, UINT64 v )
+{
+  put_int( p, (unsigned int)(v>>32) );
+  return 4 + put_int( p+4, (unsigned int)v );
+}
+
+static size_t put_varint( unsigned char *p, UINT64 v )
+{
+  size_t n = 0;
+  while( v >= 0x80 )
+  {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = (unsigned char)v;
+  return n;
+}
+
+static void w_varint( struct seg_writer *w, UINT64 v )
+{
+  unsigned char tmp[10];
+  w_bytes( w, tmp, put_varint( tmp, v ) );
+}
+
+static int is_deleted( struct seg_writer *w, unsigned int docid )
+{
+  size_t lo = 0, hi = w->ndeleted;
+  while( lo < hi )
+  {
+    size_t mid = lo + (hi-lo)/2;
+    if( w->deleted[mid] == docid )
+      return 1;
+    if( w->deleted[mid] < docid )
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return 0;
+}
+
+static unsigned short *writer_add_doc( struct seg_writer *w,
+				       unsigned int docid,
+				       unsigned int nhits )
+{
+  struct seg_doc *d;
+  if( !grow( w, &w->docs, &w->adocs, w->ndocs+1, sizeof(struct seg_doc) ) ||
+      !grow( w, &w->hits, &w->ahits, w->nhits+nhits,
+	     sizeof(unsigned short) ) )
+    return NULL;
+  d = w->docs + w->ndocs++;
+  d->docid = docid;
+  d->nhits = nhits;
+  d->hits = w->nhits;
+  w->nhits += nhits;
+  return w->hits + d->hits;
+}
+
+/* Add all documents in a blob in the format used by Blob. */
+static void writer_add_blob( struct seg_writer *w,
+			     const unsigned char *p, size_t len )
+{
+  while( len >= 5 && !w->err )
+  {
+    unsigned int docid = get_int( p ), nhits = p[4], i;
+    unsigned short *hits;
+    p += 5;
+    len -= 5;
+    if( nhits > len/2 )
+      nhits = (unsigned int)(len/2);
+    if( nhits && !is_deleted( w, docid ) &&
+	(hits = writer_add_doc( w, docid, nhits )) )
+      for( i = 0; i<nhits; i++ )
+	hits[i] = (p[2*i]<<8) | p[2*i+1];
+    p += 2*nhits;
+    len -= 2*nhits;
+  }
+}
+
+/* Add all documents in a posting list of a segment. */
+static void writer_add_postings( struct seg_writer *w,
+				 struct wf_segment_cursor *c )
+{
+  while( !w->err && cursor_next( c ) )
+  {
+    unsigned short *hits;
+    if( !is_deleted( w, c->docid ) &&
+	(hits = writer_add_doc( w, c->docid, c->nhits )) )
+      cursor_hits( c, hits );
+  }
+}
+
+static int cmp_doc( const void *a, const void *b )
+{
+  const struct seg_doc *x = a, *y = b;
+  if( x->docid != y->docid )
+    return x->docid < y->docid ? -1 : 1;
+  return x->hits < y->hits ? -1 : x->hits > y->hits;
+}
+
+static int cmp_short( const void *a, const void *b )
+{
+  return (int)*(const unsigned short *)a - (int)*(const unsigned short *)b;
+}
+
+/* Write the posting list of the documents added since the last word. */
+static void writer_end_word( struct seg_writer *w,
+			     const unsigned char *word, size_t len )
+{
+  size_t i, j, n = 0, k;
+  unsigned int prev = 0;
+  unsigned char tmp[8];
+  struct seg_entry *e;
+
+  if( w->ndocs > 1 )
+    qsort( w->docs, w->ndocs, sizeof(struct seg_doc), cmp_doc );
+
+  w->npost = w->nskips = 0;
+  for( i = 0; i<w->ndocs && !w->err; i = j )
+  {
+    unsigned int docid = w->docs[i].docid, h = 0;
+    size_t ng = 0;
+
+    /* Documents indexed more than once get their hits combined. */
+    for( j = i; j<w->ndocs && w->docs[j].docid == docid; j++ )
+    {
+      if( !grow( w, &w->group, &w->agroup, ng+w->docs[j].nhits,
+		 sizeof(unsigned short) ) )
+	return;
+      memcpy( w->group+ng, w->hits+w->docs[j].hits,
+	      w->docs[j].nhits*sizeof(unsigned short) );
+      ng += w->docs[j].nhits;
+    }
+    if( ng > 1 )
+      qsort( w->group, ng, sizeof(unsigned short), cmp_short );
+    if( ng > 255 )
+      ng = 255;
+
+    if( n && !(n % SKIP_BLOCK) )
+    {
+      if( !grow( w, &w->skips, &w->askips, w->nskips+2,
+		 sizeof(unsigned int) ) )
+	return;
+      w->skips[w->nskips++] = prev;
+      w->skips[w->nskips++] = (unsigned int)w->npost;
+    }
+
+    if( !grow( w, &w->post, &w->apost, w->npost+10*(ng+2), 1 ) )
+      return;
+    w->npost += put_varint( w->post+w->npost, docid-prev );
+    w->npost += put_varint( w->post+w->npost, ng );
+    for( k = 0; k<ng; k++ )
+    {
+      w->npost += put_varint( w->post+w->npost, w->group[k]-h );
+      h = w->group[k];
+    }
+    prev = docid;
+    n++;
+  }
+  w->ndocs = w->nhits = 0;
+
+  if( !n || w->err || w->npost > 0xffffffff )
+  {
+    if( !w->err && n )
+      w->err = EFBIG;
+    return;
+  }
+  if( !grow( w, &w->dict, &w->adict, w->nwords+1, sizeof(struct seg_entry) ) )
+    return;
+  e = w->dict + w->nwords++;
+  e->word = word;
+  e->len = len;
+  e->postings = w->pos;
+  e->ndocs = (unsigned int)n;
+  if( prev > w->max_docid )
+    w->max_docid = prev;
+
+  w_varint( w, n );
+  w_varint( w, w->nskips/2 );
+  for( k = 0; k<w->nskips; k++ )
+    w_bytes( w, tmp, put_int( tmp, w->skips[k] ) );
+  w_bytes( w, w->post, w->npost );
+}
+
+static void writer_init( struct seg_writer *w, const char *path,
+			 const unsigned int *deleted, size_t ndeleted )
+{
+  unsigned char header[SEGMENT_HEADER];
+  memset( w, 0, sizeof(struct seg_writer) );
+  w->deleted = deleted;
+  w->ndeleted = ndeleted;
+  do
+    w->fd = fd_open( path, fd_WRONLY|fd_CREAT|fd_TRUNC, 0666 );
+  while( w->fd < 0 && errno == EINTR );
+  if( w->fd < 0 )
+  {
+    w->err = errno;
+    return;
+  }
+  if( !(w->out = malloc( WRITE_BUFFER )) )
+  {
+    w->err = ENOMEM;
+    return;
+  }
+  /* Written again by writer_finish, when the offsets are known. */
+  memset( header, 0, sizeof(header) );
+  w_bytes( w, header, sizeof(header) );
+}
+
+static void writer_finish( struct seg_writer *w, const char *path )
+{
+  unsigned char tmp[SEGMENT_HEADER];
+  UINT64 dict = w->pos, off = dict + 8*(UINT64)w->nwords;
+  size_t i;
+
+  if( !w->err )
+  {
+    for( i = 0; i<w->nwords; i++ )
+    {
+      struct seg_entry *e = w->dict+i;
+      w_bytes( w, tmp, put_int64( tmp, off ) );
+      off += put_varint( tmp, e->len ) + e->len +
+	put_varint( tmp, e->postings ) + put_varint( tmp, e->ndocs );
+    }
+    for( i = 0; i<w->nwords; i++ )
+    {
+      struct seg_entry *e = w->dict+i;
+      w_varint( w, e->len );
+      w_bytes( w, e->word, e->len );
+      w_varint( w, e->postings );
+      w_varint( w, e->ndocs );
+    }
+    w_flush( w );
+  }
+
+  if( !w->err )
+  {
+    put_int( tmp, SEGMENT_MAGIC );
+    put_int( tmp+4, SEGMENT_VERSION );
+    put_int( tmp+8, (unsigned int)w->nwords );
+    put_int( tmp+12, w->max_docid );
+    put_int64( tmp+16, dict );
+    put_int64( tmp+24, w->pos );
+    if( fd_lseek( w->fd, 0, SEEK_SET ) < 0 )
+      w->err = errno;
+    else
+    {
+      w->pos = 0;
+      w_bytes( w, tmp, SEGMENT_HEADER );
+      w_flush( w );
+    }
+  }
+
+  if( w->fd >= 0 && fd_close( w->fd ) && !w->err )
+    w->err = errno;
+  if( w->err && w->fd >= 0 )
+    fd_unlink( path );
+
+  free( w->out );
+  free( w->docs );
+  free( w->hits );
+  free( w->group );
+  free( w->post );
+  free( w->skips );
+  free( w->dict );
+}
+
+static int cmp_uint( const void *a, const void *b )
+{
+  unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+  return x < y ? -1 : x > y;
+}
+
+static unsigned int *get_deleted( struct array *deleted, size_t *n )
+{
+  unsigned int *res;
+  int i;
+
+  *n = 0;
+  if( !deleted || !deleted->size )
+    return NULL;
+  for( i = 0; i<deleted->size; i++ )
+    if( TYPEOF(deleted->item[i]) != T_INT )
+      Pike_error("Expected an array of document ids.\n");
+  res = xalloc( deleted->size * sizeof(unsigned int) );
+  for( i = 0; i<deleted->size; i++ )
+    res[i] = (unsigned int)deleted->item[i].u.integer;
+  qsort( res, deleted->size, sizeof(unsigned int), cmp_uint );
+  *n = deleted->size;
+  return res;
+}
+
+/*! @module Search
+ */
+
+/*! @decl void write_segment(string path, @
+ *!                          array(array(string)) blobs, @
+ *!                          void|array(int) deleted)
+ *!
+ *! Write a new segment file to @[path].
+ *!
+ *! @param blobs
+ *!   An array of @expr{({ word, blob })@} pairs, sorted on word in
+ *!   octet order, such as the one returned by
+ *!   @[Blobs()->read_all_sorted()]. The words must be 8bit, typically
+ *!   UTF-8 encoded. The blobs are in the format used by @[Blob], but
+ *!   need not be sorted.
+ *!
+ *! @param deleted
+ *!   Documents that should not be included in the segment.
+ *!
+ *! The interpreter lock is released while the file is written.
+ *!
+ *! @seealso
+ *!   @[Segment], @[merge_segments]
+ */
+static void f_write_segment( INT32 args )
+{
+  struct seg_writer w;
+  struct array *words, *deleted = NULL;
+  struct pike_string **strs;
+  unsigned int *del;
+  size_t ndel;
+  char *path;
+  int i, n;
+
+  get_all_args( NULL, args, "%s%a.%a", &path, &words, &deleted );
+
+  n = words->size;
+  for( i = 0; i<n; i++ )
+  {
+    struct array *pair;
+    if( TYPEOF(words->item[i]) != T_ARRAY ||
+	(pair = words->item[i].u.array)->size != 2 ||
+	TYPEOF(pair->item[0]) != T_STRING ||
+	TYPEOF(pair->item[1]) != T_STRING ||
+	pair->item[0].u.string->size_shift ||
+	pair->item[1].u.string->size_shift )
+      SIMPLE_ARG_TYPE_ERROR( "write_segment", 2,
+			     "array(array(string(8bit)))" );
+    if( i )
+    {
+      struct pike_string *a =
+	words->item[i-1].u.array->item[0].u.string;
+      struct pike_string *b = pair->item[0].u.string;
+      if( word_cmp( STR0(a), a->len, STR0(b), b->len ) >= 0 )
+	Pike_error("Words not sorted, or not unique.\n");
+    }
+  }
+
+  del = get_deleted( deleted, &ndel );
+
+  /* Keep our own references, the array may change while we write. */
+  strs = xalloc( (2*n+1) * sizeof(struct pike_string *) );
+  for( i = 0; i<n; i++ )
+  {
+    add_ref( strs[2*i] = words->item[i].u.array->item[0].u.string );
+    add_ref( strs[2*i+1] = words->item[i].u.array->item[1].u.string );
+  }
+
+  THREADS_ALLOW();
+  writer_init( &w, path, del, ndel );
+  for( i = 0; i<n && !w.err; i++ )
+  {
+    writer_add_blob( &w, STR0(strs[2*i+1]), strs[2*i+1]->len );
+    writer_end_word( &w, STR0(strs[2*i]), strs[2*i]->len );
+  }
+  writer_finish( &w, path );
+  THREADS_DISALLOW();
+
+  for( i = 0; i<2*n; i++ )
+    free_string( strs[i] );
+  free( strs );
+  free( del );
+
+  if( w.err )
+    Pike_error("Failed to write segment %s: %s\n", path, strerror( w.err ));
+  pop_n_elems( args );
+}
+
+/*! @decl void merge_segments(string path, array(Segment) segments, @
+ *!                           void|array(int) deleted)
+ *!
+ *! Merge @[segments] into a new segment file at @[path].
+ *!
+ *! Documents present in more than one segment get their hits
+ *! combined, and the documents in @[deleted] are left out.
+ *!
+ *! The interpreter lock is released while the file is written, so
+ *! this is suitable for running in a background thread.
+ */
+static void f_merge_segments( INT32 args )
+{
+  struct seg_writer w;
+  struct array *segments, *deleted = NULL;
+  struct wf_segment **segs;
+  unsigned int *pos, *del;
+  size_t ndel;
+  char *path;
+  int i, n;
+
+  get_all_args( NULL, args, "%s%a.%a", &path, &segments, &deleted );
+  wf_segment_check_array( segments );
+
+  del = get_deleted( deleted, &ndel );
+  n = segments->size;
+  segs = xalloc( (n+1) * (sizeof(struct wf_segment *)+sizeof(unsigned int)) );
+  pos = (unsigned int *)(segs + n+1);
+  for( i = 0; i<n; i++ )
+  {
+    segs[i] = ((struct segment_storage *)
+	       get_storage( segments->item[i].u.object, segment_program ))->seg;
+    segs[i]->refs++;
+    pos[i] = 0;
+  }
+
+  THREADS_ALLOW();
+  writer_init( &w, path, del, ndel );
+  while( !w.err )
+  {
+    const unsigned char *word = NULL, *ew;
+    size_t len = 0, el;
+    UINT64 postings, ndocs;
+
+    /* Find the smallest word not yet written... */
+    for( i = 0; i<n; i++ )
+      if( pos[i] < segs[i]->nwords )
+      {
+	segment_entry( segs[i], pos[i], &ew, &el, &postings, &ndocs );
+	if( !word || word_cmp( ew, el, word, len ) < 0 )
+	{
+	  word = ew;
+	  len = el;
+	}
+      }
+    if( !word )
+      break;
+
+    /* ...and add its documents from all segments. */
+    for( i = 0; i<n; i++ )
+      if( pos[i] < segs[i]->nwords )
+      {
+	struct wf_segment_cursor c;
+	segment_entry( segs[i], pos[i], &ew, &el, &postings, &ndocs );
+	if( word_cmp( ew, el, word, len ) )
+	  continue;
+	pos[i]++;
+	if( cursor_init( &c, segs[i], postings ) )
+	  writer_add_postings( &w, &c );
+      }
+    writer_end_word( &w, word, len );
+  }
+  writer_finish( &w, path );
+  THREADS_DISALLOW();
+
+  for( i = 0; i<n; i++ )
+    segment_unref( segs[i] );
+  free( segs );
+  free( del );
+
+  if( w.err )
+    Pike_error("Failed to write segment %s: %s\n", path, strerror( w.err ));
+  pop_n_elems( args );
+}
+
+/*! @class Segment
+ *!
+ *! A read only, memory mapped, segment file as written by
+ *! @[write_segment] or @[merge_segments].
+ *!
+ *! An array of segments can be given to @[do_query_and],
+ *! @[do_query_or] and @[do_query_phrase] instead of a blob feeder
+ *! function. The posting lists are then read directly from the
+ *! segments, using the skip lists to avoid decoding documents that
+ *! cannot match.
+ */
+
+/*! @decl void create(string path)
+ *!
+ *! Open the segment file @[path]. Throws an error if the file is not
+ *! a valid segment.
+ */
+static void f_segment_create( INT32 args )
+{
+  struct wf_segment *s;
+  const char *err;
+  char *path;
+
+  get_all_args( NULL, args, "%s", &path );
+  if( !(s = segment_open( path, &err )) )
+    Pike_error("Failed to open segment %s: %s\n", path, err);
+  if( THIS->seg )
+    segment_unref( THIS->seg );
+  THIS->seg = s;
+  pop_n_elems( args );
+}
+
+static struct wf_segment *this_segment( void )
+{
+  if( !THIS->seg )
+    Pike_error("Segment not open.\n");
+  return THIS->seg;
+}
+
+/*! @decl int _sizeof()
+ *!
+ *! Returns the number of words in the segment.
+ */
+static void f_segment__sizeof( INT32 args )
+{
+  struct wf_segment *s = this_segment();
+  pop_n_elems( args );
+  push_int( s->nwords );
+}
+
+/*! @decl int max_docid()
+ *!
+ *! Returns the highest document id in the segment.
+ */
+static void f_segment_max_docid( INT32 args )
+{
+  struct wf_segment *s = this_segment();
+  pop_n_elems( args );
+  push_int64( s->max_docid );
+}
+
+/*! @decl array(string) words(void|string prefix)
+ *!
+ *! Returns the words in the segment, in octet order. If @[prefix] is
+ *! given, only the words starting with it are returned.
+ */
+static void f_segment_words( INT32 args )
+{
+  struct wf_segment *s = this_segment();
+  struct pike_string *prefix = NULL;
+  unsigned int i, n = 0;
+
+  get_all_args( NULL, args, ".%S", &prefix );
+
+  i = prefix ? segment_lower_bound( s, STR0(prefix), prefix->len ) : 0;
+  for( ; i<s->nwords; i++, n++ )
+  {
+    const unsigned char *w;
+    size_t wl;
+    UINT64 postings, ndocs;
+    segment_entry( s, i, &w, &wl, &postings, &ndocs );
+    if( prefix &&
+	(wl < (size_t)prefix->len || memcmp( w, STR0(prefix), prefix->len )) )
+      break;
+    push_string( make_shared_binary_string( (const char *)w, wl ) );
+  }
+  f_aggregate( n );
+  stack_pop_n_elems_keep_top( args );
+}
+
+/*! @decl int doc_count(string word)
+ *!
+ *! Returns the number of documents containing @[word].
+ */
+static void f_segment_doc_count( INT32 args )
+{
+  struct wf_segment *s = this_segment();
+  struct pike_string *word;
+  UINT64 postings, ndocs;
+
+  get_all_args( NULL, args, "%S", &word );
+  if( !segment_find( s, STR0(word), word->len, &postings, &ndocs ) )
+    ndocs = 0;
+  pop_n_elems( args );
+  push_int64( ndocs );
+}
+
+/*! @decl string get_blob(string word)
+ *!
+ *! Returns all hits for @[word] in the format used by @[Blob], or
+ *! @expr{0@} if the word is not present in the segment.
+ */
+static void f_segment_get_blob( INT32 args )
+{
+  struct wf_segment *s = this_segment();
+  struct wf_segment_cursor c;
+  struct pike_string *word;
+  struct buffer *b;
+  unsigned short hits[255];
+  UINT64 postings, ndocs;
+  unsigned int i, n;
+  ONERROR e;
+
+  get_all_args( NULL, args, "%S", &word );
+  if( !segment_find( s, STR0(word), word->len, &postings, &ndocs ) ||
+      !cursor_init( &c, s, postings ) )
+  {
+    pop_n_elems( args );
+    push_int( 0 );
+    return;
+  }
+
+  b = wf_buffer_new();
+  SET_ONERROR( e, wf_buffer_free, b );
+  wf_buffer_set_empty( b );
+  while( cursor_next( &c ) )
+  {
+    n = cursor_hits( &c, hits );
+    wf_buffer_wint( b, c.docid );
+    wf_buffer_wbyte( b, n );
+    for( i = 0; i<n; i++ )
+      wf_buffer_wshort( b, hits[i] );
+  }
+  pop_n_elems( args );
+  push_string( make_shared_binary_string( (char *)b->data, b->size ) );
+  CALL_AND_UNSET_ONERROR( e );
+}
+
+/*! @endclass
+ */
+
+/*! @endmodule
+ */
+
+static void exit_segment_struct( struct object *UNUSED(o) )
+{
+  if( THIS->seg )
+    segment_unref( THIS->seg );
+  THIS->seg = NULL;
+}
+
+void init_segment_program(void)
+{
+  start_new_program();
+  ADD_STORAGE( struct segment_storage );
+  ADD_FUNCTION( "create", f_segment_create, tFunc(tStr,tVoid), 0 );
+  ADD_FUNCTION( "_sizeof", f_segment__sizeof, tFunc(tVoid,tInt), 0 );
+  ADD_FUNCTION( "max_docid", f_segment_max_docid, tFunc(tVoid,tInt), 0 );
+  ADD_FUNCTION( "words", f_segment_words,
+		tFunc(tOr(tStr,tVoid),tArr(tStr)), 0 );
+  ADD_FUNCTION( "doc_count", f_segment_doc_count, tFunc(tStr,tInt), 0 );
+  ADD_FUNCTION( "get_blob", f_segment_get_blob, tFunc(tStr,tOr(tStr,tZero)), 0 );
+  set_exit_callback( exit_segment_struct );
+  segment_program = end_program( );
+  add_program_constant( "Segment", segment_program, 0 );
+
+  ADD_FUNCTION( "write_segment", f_write_segment,
+		tFunc(tStr tArr(tArr(tStr)) tOr(tArr(tInt),tVoid),tVoid), 0 );
+  ADD_FUNCTION( "merge_segments", f_merge_segments,
+		tFunc(tStr tArr(tObj) tOr(tArr(tInt),tVoid),tVoid), 0 );
+}
+
+void exit_segment_program(void)
+{
+  free_program( segment_program );
+}
@@ -0,0 +1,50 @@
+struct wf_segment;
+
+struct wf_segment_cursor
+{
+  struct wf_segment *seg;
+
+  const unsigned char *p;
+  /* The next document to decode */
+
+  const unsigned char *end;
+  /* End of the postings area of the segment */
+
+  const unsigned char *docs;
+  /* The first document in the posting list */
+
+  const unsigned char *skips;
+  unsigned int nskips;
+
+  unsigned int ndocs;
+  unsigned int n;
+  /* The number of documents decoded so far */
+
+  unsigned int docid;
+  unsigned int nhits;
+  const unsigned char *hits;
+  /* The current document */
+
+  int eof;
+};
+
+Blob *wf_blob_new_segments( struct array *segments, struct pike_string *word );
+/* Create a new blob object reading the hits for 'word' directly from
+ * the given array of Segment objects. If a document is present in
+ * more than one segment the hits are combined.
+ */
+
+void wf_segment_check_array( struct array *segments );
+/* Throw an error if the array contains anything but opened Segment
+ * objects.
+ */
+
+int wf_segment_blob_next( Blob *b );
+int wf_segment_blob_seek( Blob *b, unsigned int docid );
+void wf_segment_blob_free( Blob *b );
+/* Implementations of wf_blob_next, wf_blob_seek and wf_blob_free for
+ * blobs created with wf_blob_new_segments.
+ */
+
+void init_segment_program(void);
+void exit_segment_program(void);
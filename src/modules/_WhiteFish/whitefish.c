@@ -18,6 +18,7 @@
 #include "blob.h"
 #include "blobs.h"
 #include "linkfarm.h"
+#include "segment.h"
 
 struct  tofree
 {
@@ -188,6 +189,42 @@ static struct object *low_do_query_or( Blob **blobs,
   return res;
 }
 
+/* Skip all blobs forward to the largest current document id, until
+ * they all agree on one. Blobs reading from segments use the skip
+ * lists for this, which makes the intersection galloping. Returns 0
+ * when one of the blobs has no more documents.
+ */
+static int skip_to_max( Blob **blobs, int nblobs, unsigned int *docid )
+{
+  unsigned int max = 0;
+  int i, agree = 0;
+
+  for( i = 0; i<nblobs; i++ )
+    if( blobs[i]->eof )
+      return 0;
+    else if( blobs[i]->docid > max )
+      max = blobs[i]->docid;
+
+  while( !agree )
+  {
+    agree = 1;
+    for( i = 0; i<nblobs; i++ )
+      if( blobs[i]->docid != max )
+      {
+	wf_blob_seek( blobs[i], max );
+	if( blobs[i]->eof )
+	  return 0;
+	if( blobs[i]->docid != max )
+	{
+	  max = blobs[i]->docid;
+	  agree = 0;
+	}
+      }
+  }
+  *docid = max;
+  return 1;
+}
+
 static void handle_phrase_hit( Blob **blobs,
 			       int nblobs,
 			       struct object *res,
@@ -250,7 +287,7 @@ static struct object *low_do_query_phrase( Blob **blobs, int nblobs,
   struct tofree *__f = malloc( sizeof( struct tofree ) );
   double max_c=0.0;
   ONERROR e;
-  int i, j;
+  int i;
   __f->blobs = blobs;
   __f->nblobs = nblobs;
   __f->res = res;
@@ -268,30 +305,20 @@ static struct object *low_do_query_phrase( Blob **blobs, int nblobs,
     for( i = 0; i<nblobs; i++ ) /* Forward to first element */
       wf_blob_next( blobs[i] );
 
-    /* Main loop: Find the smallest element in the blob array. */
+    /* Main loop: Skip all blobs to the largest element in the blob
+     * array until they agree.
+     */
     while( 1 )
     {
-      unsigned int min = 0x7fffffff;
-
-      for( i = 0; i<nblobs; i++ )
-	if( blobs[i]->eof )
-	  goto end;
-	else if( ((unsigned int)blobs[i]->docid) < min )
-	  min = blobs[i]->docid;
+      unsigned int max;
 
-      if( min == 0x7fffffff )
+      if( !skip_to_max( blobs, nblobs, &max ) )
 	goto end;
 
-      for( j = 0, i = 0; i < nblobs; i++ )
-	if( blobs[i]->docid != min )
-	  goto next;
-
-      handle_phrase_hit( blobs, nblobs, res, min, &field_c, max_c );
+      handle_phrase_hit( blobs, nblobs, res, max, &field_c, max_c );
 
-    next:
       for( i = 0; i<nblobs; i++ )
-	if( blobs[i]->docid == min )
-	  wf_blob_next( blobs[i] );
+	wf_blob_next( blobs[i] );
     }
   }
 end:
@@ -312,7 +339,7 @@ static struct object *low_do_query_and( Blob **blobs, int nblobs,
   struct tofree *__f = malloc( sizeof( struct tofree ) );
   double max_c=0.0, max_p=0.0;
   ONERROR e;
-  int i, j;
+  int i;
   __f->blobs = blobs;
   __f->nblobs = nblobs;
   __f->res = res;
@@ -334,31 +361,21 @@ static struct object *low_do_query_and( Blob **blobs, int nblobs,
     for( i = 0; i<nblobs; i++ ) /* Forward to first element */
       wf_blob_next( blobs[i] );
 
-    /* Main loop: Find the smallest element in the blob array. */
+    /* Main loop: Skip all blobs to the largest element in the blob
+     * array until they agree.
+     */
     while( 1 )
     {
-      unsigned int min = 0x7fffffff;
-
-      for( i = 0; i<nblobs; i++ )
-	if( blobs[i]->eof )
-	  goto end;
-	else if( ((unsigned int)blobs[i]->docid) < min )
-	  min = blobs[i]->docid;
+      unsigned int max;
 
-      if( min == 0x7fffffff )
+      if( !skip_to_max( blobs, nblobs, &max ) )
 	goto end;
 
-      for( j = 0, i = 0; i < nblobs; i++ )
-	if( blobs[i]->docid != min )
-	  goto next;
-
-      handle_hit( blobs, nblobs, res, min, &field_c,&prox_c, max_c,max_p,
+      handle_hit( blobs, nblobs, res, max, &field_c,&prox_c, max_c,max_p,
 		  cutoff );
 
-    next:
       for( i = 0; i<nblobs; i++ )
-	if( blobs[i]->docid == min )
-	  wf_blob_next( blobs[i] );
+	wf_blob_next( blobs[i] );
     }
   }
 end:
@@ -370,13 +387,38 @@ end:
   return res;
 }
 
+/* The blob source is either a blob feeder function or an array of
+ * Segment objects.
+ */
+static Blob **new_blobs( struct array *words, struct svalue *source )
+{
+  Blob **blobs;
+  int i;
+
+  for( i = 0; i<words->size; i++ )
+    if( TYPEOF(words->item[i]) != T_STRING )
+      Pike_error("Expected an array of strings.\n");
+  if( TYPEOF(*source) == T_ARRAY )
+    wf_segment_check_array( source->u.array );
+
+  blobs = calloc( words->size, sizeof(Blob *) );
+  for( i = 0; i<words->size; i++ )
+    if( TYPEOF(*source) == T_ARRAY )
+      blobs[i] = wf_blob_new_segments( source->u.array,
+				       words->item[i].u.string );
+    else
+      blobs[i] = wf_blob_new( source, words->item[i].u.string );
+  return blobs;
+}
+
 /*! @module Search
  */
 
 static void f_do_query_phrase( INT32 args )
 /*! @decl ResultSet do_query_phrase( array(string) words,          @
  *!                          array(int) field_coefficients,       @
- *!                          function(string,int,int:string) blobfeeder)
+ *!                          function(string,int,int:string)|@
+ *!                            array(Segment) blobfeeder)
  *! @param words
  *!
  *! Arrays of word ids. Note that the order is significant for the
@@ -398,6 +440,10 @@ static void f_do_query_phrase( INT32 args )
  *!
  *! This function returns a Pike string containing the word hits for a
  *! certain word. Call repeatedly until it returns @expr{0@}.
+ *!
+ *! Alternatively an array of @[Segment] objects, in which case the
+ *! words should be UTF-8 encoded and the hits are read directly from
+ *! the segments.
  */
 {
   double proximity_coefficients[8];
@@ -425,10 +471,7 @@ static void f_do_query_phrase( INT32 args )
     return;
   }
 
-  blobs = calloc( numblobs, sizeof(Blob *) );
-
-  for( i = 0; i<numblobs; i++ )
-    blobs[i] = wf_blob_new( cb, _words->item[i].u.string );
+  blobs = new_blobs( _words, cb );
 
   for( i = 0; i<65; i++ )
     field_coefficients[i] = (double)_field->item[i].u.integer;
@@ -443,7 +486,8 @@ static void f_do_query_and( INT32 args )
  *!                               array(int) field_coefficients,       @
  *!                               array(int) proximity_coefficients,   @
  *!                               int cutoff,			       @
- *!                               function(string,int,int:string) blobfeeder)
+ *!                               function(string,int,int:string)|@
+ *!                                 array(Segment) blobfeeder)
  *! @param words
  *!
  *! Arrays of word ids. Note that the order is significant for the
@@ -490,6 +534,10 @@ static void f_do_query_and( INT32 args )
  *!
  *! This function returns a Pike string containing the word hits for a
  *! certain word. Call repeatedly until it returns @expr{0@}.
+ *!
+ *! Alternatively an array of @[Segment] objects, in which case the
+ *! words should be UTF-8 encoded and the hits are read directly from
+ *! the segments.
  */
 {
   double proximity_coefficients[8];
@@ -519,10 +567,7 @@ static void f_do_query_and( INT32 args )
     return;
   }
 
-  blobs = calloc( numblobs, sizeof(Blob *) );
-
-  for( i = 0; i<numblobs; i++ )
-    blobs[i] = wf_blob_new( cb, _words->item[i].u.string );
+  blobs = new_blobs( _words, cb );
 
   for( i = 0; i<8; i++ )
     proximity_coefficients[i] = (double)_prox->item[i].u.integer;
@@ -544,7 +589,8 @@ static void f_do_query_or( INT32 args )
  *!                              array(int) field_coefficients,       @
  *!                              array(int) proximity_coefficients,   @
  *!                              int cutoff,			      @
- *!                              function(string,int,int:string) blobfeeder)
+ *!                              function(string,int,int:string)|@
+ *!                                array(Segment) blobfeeder)
  *! @param words
  *!
  *! Arrays of word ids. Note that the order is significant for the
@@ -591,6 +637,10 @@ static void f_do_query_or( INT32 args )
  *!
  *! This function returns a Pike string containing the word hits for a
  *! certain word. Call repeatedly until it returns @expr{0@}.
+ *!
+ *! Alternatively an array of @[Segment] objects, in which case the
+ *! words should be UTF-8 encoded and the hits are read directly from
+ *! the segments.
  */
 {
   double proximity_coefficients[8];
@@ -620,10 +670,7 @@ static void f_do_query_or( INT32 args )
     return;
   }
 
-  blobs = calloc( numblobs, sizeof(Blob *) );
-
-  for( i = 0; i<numblobs; i++ )
-    blobs[i] = wf_blob_new( cb, _words->item[i].u.string );
+  blobs = new_blobs( _words, cb );
 
   for( i = 0; i<8; i++ )
     proximity_coefficients[i] = (double)_prox->item[i].u.integer;
@@ -649,17 +696,21 @@ PIKE_MODULE_INIT
   init_blob_program();
   init_blobs_program();
   init_linkfarm_program();
+  init_segment_program();
 
   ADD_FUNCTION( "do_query_or", f_do_query_or,
                 tFunc( tArr(tStr) tArr(tInt) tArr(tInt) tInt
-                       tFunc(tStr tInt tInt, tStr), tObj), 0 );
+                       tOr(tFunc(tStr tInt tInt, tStr), tArr(tObj)),
+                       tObj), 0 );
 
   ADD_FUNCTION( "do_query_and", f_do_query_and,
                 tFunc( tArr(tStr) tArr(tInt) tArr(tInt) tInt
-                       tFunc(tStr tInt tInt, tStr), tObj), 0 );
+                       tOr(tFunc(tStr tInt tInt, tStr), tArr(tObj)),
+                       tObj), 0 );
 
   ADD_FUNCTION( "do_query_phrase", f_do_query_phrase,
-                tFunc( tArr(tStr) tArr(tInt) tFunc(tStr tInt tInt, tStr),
+                tFunc( tArr(tStr) tArr(tInt)
+                       tOr(tFunc(tStr tInt tInt, tStr), tArr(tObj)),
                        tObj ), 0 );
 }
 
@@ -669,4 +720,5 @@ PIKE_MODULE_EXIT
   exit_blob_program();
   exit_blobs_program();
   exit_linkfarm_program();
+  exit_segment_program();
 }
@@ -899,6 +899,199 @@ static void memory_index_write(INT32 args)
 /*! @endclass
  */
 
+#ifdef HAVE_MMAP
+
+#ifndef MAP_ANONYMOUS
+#ifdef MAP_ANON
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#ifdef MAP_ANONYMOUS
+/*! @decl string(8bit) mmap_string(string|Stdio.File file, @
+ *!                                int(0..)|void offset, int(0..)|void size)
+ *!
+ *!	Map (part of) a file read-only into memory, and return it as
+ *!	a string that uses the mapping as storage.
+ *!
+ *!	The file is neither read nor copied when the string is
+ *!	created; only the first few bytes are hashed, and pages are
+ *!	paged in on demand when the string is searched, indexed,
+ *!	@[sscanf()]'d and so on. The mapping is shared, so all
+ *!	processes that map the same file share the same pages in the
+ *!	page cache. The mapping is removed when the string is freed.
+ *!
+ *!	Wrapping the string in a @[Stdio.Buffer] doesn't copy it
+ *!	either, so @expr{Stdio.Buffer(System.mmap_string(file))@}
+ *!	gives a zero-copy buffer for reading the file.
+ *!
+ *! @param file
+ *!	The file to map, either as a filename or as an open file.
+ *!
+ *! @param offset
+ *!	Offset in the file to start at. Must be a multiple of the
+ *!	page size.
+ *!
+ *! @param size
+ *!	Number of bytes to map. Defaults to the rest of the file.
+ *!
+ *! @note
+ *!	Pike strings are immutable, so the file must not be modified
+ *!	or truncated as long as the string is in use. Writes to the
+ *!	file will show up in the string, and accessing pages past the
+ *!	end of a truncated file typically causes a @tt{SIGBUS@}.
+ *!
+ *! @note
+ *!	If @[size] ends the string in the middle of a page before the
+ *!	end of the file, the last page is a private copy, since the
+ *!	string must be followed by a NUL.
+ *!
+ *! @seealso
+ *!	@[Memory()->mmap()], @[Stdio.read_file()]
+ */
+static void f_mmap_string(INT32 args)
+{
+   int fd = -1;
+   int doclose = 0;
+   off_t osize;
+   size_t offset = 0, size = 0, mapsize, pagesize, head;
+   int has_size = 0;
+   char *mem;
+   int e;
+
+   if (args < 1)
+      SIMPLE_WRONG_NUM_ARGS_ERROR("mmap_string", 1);
+
+   if (args >= 2) {
+      if (TYPEOF(sp[1-args]) != T_INT || sp[1-args].u.integer < 0)
+	 SIMPLE_ARG_TYPE_ERROR("mmap_string", 2, "int(0..)");
+      offset = sp[1-args].u.integer;
+   }
+
+   if (args >= 3) {
+      if (TYPEOF(sp[2-args]) != T_INT || sp[2-args].u.integer < 0)
+	 SIMPLE_ARG_TYPE_ERROR("mmap_string", 3, "int(0..)");
+      size = sp[2-args].u.integer;
+      has_size = 1;
+   }
+
+   if (TYPEOF(sp[-args]) == T_OBJECT)
+   {
+      apply(sp[-args].u.object, "query_fd", 0);
+      if (TYPEOF(sp[-1]) != T_INT || sp[-1].u.integer < 0)
+	 SIMPLE_ARG_TYPE_ERROR("mmap_string", 1,
+			       "string|Stdio.File (file not open)");
+      fd = sp[-1].u.integer;
+      pop_stack();
+   }
+   else if (TYPEOF(sp[-args]) == T_STRING)
+   {
+      struct pike_string *filename = sp[-args].u.string;
+      if (filename->size_shift || string_has_null(filename))
+	 SIMPLE_ARG_TYPE_ERROR("mmap_string", 1, "string(1..255)|Stdio.File");
+
+      THREADS_ALLOW();
+      fd = fd_open(filename->str, fd_RDONLY, 0);
+      THREADS_DISALLOW();
+
+      if (fd < 0)
+	 Pike_error("Failed to open file: %s.\n", strerror(errno));
+      doclose = 1;
+   }
+   else
+      SIMPLE_ARG_TYPE_ERROR("mmap_string", 1, "string|Stdio.File");
+
+   THREADS_ALLOW();
+   osize = file_size(fd);
+   THREADS_DISALLOW();
+
+#ifdef _SC_PAGESIZE
+   pagesize = sysconf(_SC_PAGESIZE);
+#else
+   pagesize = getpagesize();
+#endif
+
+   if (osize < 0 || offset > (size_t)osize ||
+       (has_size && offset + size > (size_t)osize) ||
+       (offset % pagesize))
+   {
+      if (doclose) fd_close(fd);
+      if (osize < 0)
+	 Pike_error("Not a regular file.\n");
+      if (offset % pagesize)
+	 Pike_error("Mapped offset not aligned to the page size.\n");
+      Pike_error("Mapped area outside file.\n");
+   }
+
+   if (!has_size) size = ((size_t)osize) - offset;
+
+   if (!size)
+   {
+      if (doclose) fd_close(fd);
+      pop_n_elems(args);
+      push_empty_string();
+      return;
+   }
+
+   /* Reserve room for the terminating NUL, which is needed when the
+    * size is a multiple of the page size. The rest of the last page
+    * of the file is always zero filled by mmap.
+    */
+   mapsize = (size + pagesize) & ~(pagesize - 1);
+   head = size & ~(pagesize - 1);
+
+   THREADS_ALLOW();
+   mem = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   if (mem != (void *)MAP_FAILED)
+   {
+      int ok = 1;
+      if (head)
+	 ok = mmap(mem, head, PROT_READ, MAP_SHARED|MAP_FIXED,
+		   fd, offset) != (void *)MAP_FAILED;
+      if (ok && (head < size))
+      {
+	 if (offset + size == (size_t)osize)
+	    ok = mmap(mem + head, size - head, PROT_READ,
+		      MAP_SHARED|MAP_FIXED, fd, offset + head) !=
+	       (void *)MAP_FAILED;
+	 else
+	 {
+	    /* The area ends in the middle of a page before the end of
+	     * the file, so the byte after it is file data. Map that
+	     * page privately and store the NUL in the copy.
+	     */
+	    ok = mmap(mem + head, pagesize, PROT_READ|PROT_WRITE,
+		      MAP_PRIVATE|MAP_FIXED, fd, offset + head) !=
+	       (void *)MAP_FAILED;
+	    if (ok)
+	    {
+	       mem[size] = 0;
+	       ok = !mprotect(mem + head, pagesize, PROT_READ);
+	    }
+	 }
+      }
+      if (!ok)
+      {
+	 e = errno;
+	 munmap(mem, mapsize);
+	 mem = (void *)MAP_FAILED;
+	 errno = e;
+      }
+   }
+   e = errno;
+   if (doclose) fd_close(fd);
+   THREADS_DISALLOW();
+
+   if (mem == (void *)MAP_FAILED)
+      Pike_error("Failed to map file: %s.\n", strerror(e));
+
+   pop_n_elems(args);
+   push_string(make_shared_mmap_string(mem, size));
+}
+#endif /* MAP_ANONYMOUS */
+
+#endif /* HAVE_MMAP */
+
 /*! @endmodule
  */
 
@@ -979,6 +1172,12 @@ void init_system_memory(void)
    set_exit_callback(exit_memory);
    end_class("Memory",0);
 
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+   ADD_FUNCTION("mmap_string", f_mmap_string,
+		tFunc(tOr(tStr,tObj) tOr(tIntPos,tVoid) tOr(tIntPos,tVoid),
+		      tStr8), 0);
+#endif
+
 #ifdef PAGE_SIZE
    ADD_INT_CONSTANT("PAGE_SIZE",PAGE_SIZE,0);
 #endif
@@ -106,6 +106,44 @@ static const struct SearchMojtVtable nil_search_vtable = {
 #define NEEDLE ((NCHAR *)(s->needle))
 #define NEEDLELEN s->needlelen
 
+/* The SIMD searcher compares the first and the last character of the
+ * needle with a vector of haystack positions at a time, and only
+ * verifies the positions where both match. SSE2 is used when the
+ * compiler targets it, and AVX2 is selected at runtime.
+ */
+#if defined(__GNUC__) && defined(__SSE2__) && defined(HAVE_EMMINTRIN_H)
+#include <emmintrin.h>
+#include "bitvector.h"
+#define SEARCH_SSE2
+#if defined(HAVE_IMMINTRIN_H) && \
+  (defined(__clang__) || (__GNUC__ > 4) || \
+   ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#include <immintrin.h>
+#define SEARCH_AVX2
+static int search_use_avx2;
+#endif
+
+/* Broadcasts and comparisons for the haystack widths. The movemask
+ * of a comparison has 1 << HSHIFT bits per character, and the
+ * SIMD_MASK keeps one of them.
+ */
+#define SSE2_SET1_0(C)	_mm_set1_epi8((char)(C))
+#define SSE2_SET1_1(C)	_mm_set1_epi16((short)(C))
+#define SSE2_SET1_2(C)	_mm_set1_epi32((int)(C))
+#define SSE2_CMPEQ_0	_mm_cmpeq_epi8
+#define SSE2_CMPEQ_1	_mm_cmpeq_epi16
+#define SSE2_CMPEQ_2	_mm_cmpeq_epi32
+#define AVX2_SET1_0(C)	_mm256_set1_epi8((char)(C))
+#define AVX2_SET1_1(C)	_mm256_set1_epi16((short)(C))
+#define AVX2_SET1_2(C)	_mm256_set1_epi32((int)(C))
+#define AVX2_CMPEQ_0	_mm256_cmpeq_epi8
+#define AVX2_CMPEQ_1	_mm256_cmpeq_epi16
+#define AVX2_CMPEQ_2	_mm256_cmpeq_epi32
+#define SIMD_MASK_0	0xffffffffU
+#define SIMD_MASK_1	0x55555555U
+#define SIMD_MASK_2	0x11111111U
+#endif /* __SSE2__ */
+
 #define NSHIFT 0
 #include "pike_search_engine.c"
 #undef NSHIFT
@@ -193,6 +231,10 @@ void init_pike_searching(void)
   pike_search_program=end_program();
   add_program_constant("Search",pike_search_program,ID_PROTECTED);
 
+#ifdef SEARCH_AVX2
+  search_use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
   memsearch_cache=allocate_mapping(10);
   memsearch_cache->data->flags |= MAPPING_FLAG_WEAK;
 }
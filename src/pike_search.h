@@ -39,6 +39,12 @@ struct boyer_moore_hubbe_searcher
   ptrdiff_t d2[BMLEN];
 };
 
+struct simd_searcher
+{
+  void *needle;
+  ptrdiff_t needlelen;
+};
+
 struct SearchMojtS;
 
 #define FNORD(N,C) \
@@ -73,6 +79,7 @@ struct pike_mem_searcher
   {
     struct hubbe_searcher hubbe;
     struct boyer_moore_hubbe_searcher bm;
+    struct simd_searcher simd;
   } data;
 };
 
@@ -51,11 +51,20 @@ static const struct SearchMojtVtable PxC3(NAME,NSHIFT,_vtable) = {	\
 
 
 INTERMEDIATE(memchr_search)
+#ifdef SEARCH_SSE2
+INTERMEDIATE(simd_search)
+INTERMEDIATE(simd_search2)
+INTERMEDIATE(simd_search3)
+INTERMEDIATE(simd_search4)
+INTERMEDIATE(simd_search5)
+INTERMEDIATE(simd_search6)
+#else
 INTERMEDIATE(memchr_memcmp2)
 INTERMEDIATE(memchr_memcmp3)
 INTERMEDIATE(memchr_memcmp4)
 INTERMEDIATE(memchr_memcmp5)
 INTERMEDIATE(memchr_memcmp6)
+#endif
 INTERMEDIATE(boyer_moore_hubbe)
 INTERMEDIATE(hubbe_search)
 
@@ -228,11 +237,19 @@ void NameN(init_memsearch)(
       s->mojt.vtab=& PxC3(memchr_search,NSHIFT,_vtable);
       return;
 
+#ifdef SEARCH_SSE2
+#define MMCASE(X)						\
+    case X:							\
+      s->mojt.data=(void *) needle;				\
+      s->mojt.vtab=& PxC4(simd_search,X,NSHIFT,_vtable);	\
+      return
+#else
 #define MMCASE(X)						\
     case X:							\
       s->mojt.data=(void *) needle;				\
       s->mojt.vtab=& PxC4(memchr_memcmp,X,NSHIFT,_vtable);	\
       return
+#endif
 
       MMCASE(2);
       MMCASE(3);
@@ -248,7 +265,15 @@ void NameN(init_memsearch)(
     case 20: case 21: case 22: case 23: case 24:
     case 25: case 26: case 27: case 28: case 29:
     case 30: case 31: case 32: case 33: case 34:
+#ifdef SEARCH_SSE2
+      s->data.simd.needle=needle;
+      s->data.simd.needlelen=needlelen;
+      s->mojt.vtab=& PxC3(simd_search,NSHIFT,_vtable);
+      s->mojt.data=(void *)& s->data.simd;
+      return;
+#else
       break;
+#endif
 
   default:
     if(max_haystacklen > needlelen + 64)
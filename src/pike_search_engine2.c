@@ -203,3 +203,114 @@ HCHAR *NameNH(hubbe_search)(struct hubbe_searcher *s,
   }
   return 0;
 }
+
+
+#ifdef SEARCH_SSE2
+
+/* Scans the candidate positions from *pos up to end one vector at a
+ * time, and returns the first match. Otherwise *pos is left at the
+ * first position that hasn't been scanned.
+ */
+#define SIMD_FILTER(VEC, LOAD, AND, MOVEMASK, SET1, CMPEQ) {		\
+    const ptrdiff_t last = nlen - 1;					\
+    const ptrdiff_t step = sizeof(VEC) >> HSHIFT;			\
+    const VEC f = PxC(SET1,HSHIFT)(needle[0]);				\
+    const VEC l = PxC(SET1,HSHIFT)(needle[last]);			\
+    ptrdiff_t i;							\
+    for (i = *pos; i + step <= end; i += step) {			\
+      VEC a = LOAD((const VEC *)(haystack + i));			\
+      VEC b = LOAD((const VEC *)(haystack + i + last));			\
+      unsigned INT32 m =						\
+	MOVEMASK(AND(PxC(CMPEQ,HSHIFT)(a, f), PxC(CMPEQ,HSHIFT)(b, l))) & \
+	PxC(SIMD_MASK_,HSHIFT);						\
+      while (m) {							\
+	HCHAR *where = haystack + i + (ctz32(m) >> HSHIFT);		\
+	if (!NameNH(MEMCMP)(needle + 1, where + 1, nlen - 2))		\
+	  return where;							\
+	m &= m - 1;							\
+      }									\
+    }									\
+    *pos = i;								\
+    return 0;								\
+  }
+
+static HCHAR *NameNH(simd_filter_sse2)(NCHAR *needle, ptrdiff_t nlen,
+				       HCHAR *haystack,
+				       ptrdiff_t *pos, ptrdiff_t end)
+  SIMD_FILTER(__m128i, _mm_loadu_si128, _mm_and_si128, _mm_movemask_epi8,
+	      SSE2_SET1_, SSE2_CMPEQ_)
+
+#ifdef SEARCH_AVX2
+ATTRIBUTE((target("avx2")))
+static HCHAR *NameNH(simd_filter_avx2)(NCHAR *needle, ptrdiff_t nlen,
+				       HCHAR *haystack,
+				       ptrdiff_t *pos, ptrdiff_t end)
+  SIMD_FILTER(__m256i, _mm256_loadu_si256, _mm256_and_si256,
+	      _mm256_movemask_epi8, AVX2_SET1_, AVX2_CMPEQ_)
+#endif
+
+#undef SIMD_FILTER
+
+static HCHAR *NameNH(simd_search_low)(NCHAR *needle,
+				      ptrdiff_t nlen,
+				      HCHAR *haystack,
+				      ptrdiff_t haystacklen)
+{
+  ptrdiff_t i = 0, end, last = nlen - 1;
+  HCHAR *res;
+
+  if(nlen > haystacklen) return 0;
+
+#if NSHIFT > HSHIFT
+  if(((unsigned INT32)needle[0] >= (1U << (8 << HSHIFT))) ||
+     ((unsigned INT32)needle[last] >= (1U << (8 << HSHIFT))))
+    return 0;
+#endif
+
+  /* Number of positions where the needle might start. */
+  end = haystacklen - last;
+
+#ifdef SEARCH_AVX2
+  if(search_use_avx2 &&
+     (res = NameNH(simd_filter_avx2)(needle, nlen, haystack, &i, end)))
+    return res;
+#endif
+  if((res = NameNH(simd_filter_sse2)(needle, nlen, haystack, &i, end)))
+    return res;
+
+  for(; i < end; i++)
+  {
+    if((haystack[i] == needle[0]) && (haystack[i + last] == needle[last]) &&
+       !NameNH(MEMCMP)(needle + 1, haystack + i + 1, nlen - 2))
+      return haystack + i;
+  }
+  return 0;
+}
+
+HCHAR *NameNH(simd_search)(struct simd_searcher *s,
+			   HCHAR *haystack,
+			   ptrdiff_t haystacklen)
+{
+  return NameNH(simd_search_low)(NEEDLE, NEEDLELEN, haystack, haystacklen);
+}
+
+#define make_simd_searchX(X)					\
+HCHAR *PxC4(simd_search,X,NSHIFT,HSHIFT)(void *n,		\
+					 HCHAR *haystack,	\
+					 ptrdiff_t haystacklen)	\
+{								\
+  return NameNH(simd_search_low)((NCHAR *)n,			\
+				 X,				\
+				 haystack,			\
+				 haystacklen);			\
+}
+
+make_simd_searchX(2)
+make_simd_searchX(3)
+make_simd_searchX(4)
+make_simd_searchX(5)
+make_simd_searchX(6)
+
+#undef make_simd_searchX
+
+#endif /* SEARCH_SSE2 */
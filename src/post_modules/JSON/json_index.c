@@ -0,0 +1,986 @@
+/* -*- c -*-
+|| This file is part of Pike. For copyright information see COPYRIGHT.
+|| Pike is distributed under GPL, LGPL and MPL. See the file COPYING
+|| for more information.
+*/
+
+/* Two-stage decoder for 8-bit strings.
+ *
+ * Stage 1 (json_build_index) classifies the input 64 bytes at a time,
+ * using SSE2 or AVX2 where available, and records the positions of
+ * all structural characters ({}[]:,), all opening quotes and the
+ * first character of all other values in the structural index.
+ *
+ * Stage 2 (json_walk_value) walks the index and creates the Pike
+ * values.
+ *
+ * Only the strict RFC 4627 syntax is handled here. For anything
+ * else, including all errors, the decoder gives up and the caller
+ * falls back to the state machine decoder, which also generates
+ * the error messages. The decoder must thus never accept input
+ * that the state machine decoder rejects, and must produce the
+ * same values.
+ *
+ * The block classification and the handling of escaped quotes
+ * follow the simdjson paper by Langdale and Lemire.
+ */
+
+#include "array.h"
+#include "mapping.h"
+#include "bignum.h"
+#include "bitvector.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && defined(HAVE_EMMINTRIN_H)
+#include <emmintrin.h>
+#define JSON_SSE2
+#if defined(HAVE_IMMINTRIN_H) && \
+  (defined(__clang__) || (__GNUC__ > 4) || \
+   ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#include <immintrin.h>
+#define JSON_AVX2
+#endif
+#endif
+
+/* Character class bits for a block of 64 bytes. */
+struct json_block
+{
+  UINT64 quote;
+  UINT64 backslash;
+  UINT64 op;			/* {}[]:, */
+  UINT64 ws;			/* SPC, HT, LF and CR. */
+};
+
+/* Carry state between blocks. */
+struct json_index_state
+{
+  UINT64 prev_odd_backslash;	/* 1 if the block ended with an odd
+				 * number of backslashes. */
+  UINT64 prev_in_string;	/* ~0 if the block ended in a string. */
+  UINT64 prev_pseudo_pred;	/* 1 if the last char in the block was
+				 * whitespace or structural. */
+};
+
+struct json_index
+{
+  UINT32 *pos;
+  size_t num;
+  size_t size;
+};
+
+#define JSON_CLASS_QUOTE	1
+#define JSON_CLASS_BACKSLASH	2
+#define JSON_CLASS_OP		4
+#define JSON_CLASS_WS		8
+
+static unsigned char json_char_class[256];
+
+static void (*json_classify)(const p_wchar0 *s, struct json_block *b);
+
+static void json_classify_scalar(const p_wchar0 *s, struct json_block *b)
+{
+  UINT64 q = 0, bs = 0, op = 0, ws = 0;
+  int i;
+  for (i = 0; i < 64; i++) {
+    int c = json_char_class[s[i]];
+    if (!c) continue;
+    if (c & JSON_CLASS_QUOTE) q |= ((UINT64)1) << i;
+    else if (c & JSON_CLASS_BACKSLASH) bs |= ((UINT64)1) << i;
+    else if (c & JSON_CLASS_OP) op |= ((UINT64)1) << i;
+    else ws |= ((UINT64)1) << i;
+  }
+  b->quote = q;
+  b->backslash = bs;
+  b->op = op;
+  b->ws = ws;
+}
+
+#ifdef JSON_SSE2
+static void json_classify_sse2(const p_wchar0 *s, struct json_block *b)
+{
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i lower = _mm_set1_epi8(0x20);
+  const __m128i lbrace = _mm_set1_epi8('{');
+  const __m128i rbrace = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  UINT64 q = 0, bs = 0, op = 0, ws = 0;
+  int i;
+
+  for (i = 0; i < 64; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    /* NB: '[' | 0x20 == '{' and ']' | 0x20 == '}'. */
+    __m128i l = _mm_or_si128(v, lower);
+    __m128i o = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l, lbrace),
+					  _mm_cmpeq_epi8(l, rbrace)),
+			     _mm_or_si128(_mm_cmpeq_epi8(v, colon),
+					  _mm_cmpeq_epi8(v, comma)));
+    __m128i w = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space),
+					  _mm_cmpeq_epi8(v, tab)),
+			     _mm_or_si128(_mm_cmpeq_epi8(v, lf),
+					  _mm_cmpeq_epi8(v, cr)));
+    q |= ((UINT64)(UINT32)
+	  _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote))) << i;
+    bs |= ((UINT64)(UINT32)
+	   _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash))) << i;
+    op |= ((UINT64)(UINT32)_mm_movemask_epi8(o)) << i;
+    ws |= ((UINT64)(UINT32)_mm_movemask_epi8(w)) << i;
+  }
+  b->quote = q;
+  b->backslash = bs;
+  b->op = op;
+  b->ws = ws;
+}
+#endif /* JSON_SSE2 */
+
+#ifdef JSON_AVX2
+ATTRIBUTE((target("avx2")))
+static void json_classify_avx2(const p_wchar0 *s, struct json_block *b)
+{
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i lower = _mm256_set1_epi8(0x20);
+  const __m256i lbrace = _mm256_set1_epi8('{');
+  const __m256i rbrace = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  UINT64 q = 0, bs = 0, op = 0, ws = 0;
+  int i;
+
+  for (i = 0; i < 64; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    __m256i l = _mm256_or_si256(v, lower);
+    __m256i o = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(l, lbrace),
+						_mm256_cmpeq_epi8(l, rbrace)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+						_mm256_cmpeq_epi8(v, comma)));
+    __m256i w = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+						_mm256_cmpeq_epi8(v, tab)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+						_mm256_cmpeq_epi8(v, cr)));
+    q |= ((UINT64)(UINT32)
+	  _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote))) << i;
+    bs |= ((UINT64)(UINT32)
+	   _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash))) << i;
+    op |= ((UINT64)(UINT32)_mm256_movemask_epi8(o)) << i;
+    ws |= ((UINT64)(UINT32)_mm256_movemask_epi8(w)) << i;
+  }
+  b->quote = q;
+  b->backslash = bs;
+  b->op = op;
+  b->ws = ws;
+}
+#endif /* JSON_AVX2 */
+
+static inline UINT64 json_prefix_xor(UINT64 x)
+{
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/* Returns the mask of characters that are escaped by an odd-length
+ * sequence of backslashes.
+ */
+static inline UINT64 json_odd_backslash_ends(UINT64 bs,
+					     struct json_index_state *st)
+{
+  const UINT64 even_bits = 0x5555555555555555ULL;
+  const UINT64 odd_bits = ~even_bits;
+  UINT64 start_edges = bs & ~(bs << 1);
+  UINT64 even_start_mask = even_bits ^ st->prev_odd_backslash;
+  UINT64 even_starts = start_edges & even_start_mask;
+  UINT64 odd_starts = start_edges & ~even_start_mask;
+  UINT64 even_carries = bs + even_starts;
+  UINT64 odd_carries = bs + odd_starts;
+  UINT64 ends_odd = odd_carries < bs;	/* Overflow. */
+  UINT64 even_carry_ends, odd_carry_ends;
+
+  odd_carries |= st->prev_odd_backslash;
+  st->prev_odd_backslash = ends_odd;
+  even_carry_ends = even_carries & ~bs;
+  odd_carry_ends = odd_carries & ~bs;
+  return (even_carry_ends & odd_bits) | (odd_carry_ends & even_bits);
+}
+
+/* Add the structural positions in the block at offset base. */
+static void json_index_block(struct json_index *ix,
+			     struct json_index_state *st,
+			     const struct json_block *b, UINT32 base)
+{
+  UINT64 quote_bits = b->quote & ~json_odd_backslash_ends(b->backslash, st);
+  UINT64 in_string = json_prefix_xor(quote_bits) ^ st->prev_in_string;
+  UINT64 structurals = (b->op & ~in_string) | quote_bits;
+  UINT64 pseudo_pred = structurals | b->ws;
+  UINT64 shifted_pseudo_pred = (pseudo_pred << 1) | st->prev_pseudo_pred;
+  UINT32 *out;
+
+  st->prev_in_string = (UINT64)(((INT64)in_string) >> 63);
+  st->prev_pseudo_pred = pseudo_pred >> 63;
+
+  /* Starts of scalars. */
+  structurals |= shifted_pseudo_pred & ~b->ws & ~in_string;
+  /* Closing quotes aren't needed in stage 2. */
+  structurals &= ~(quote_bits & ~in_string);
+
+  if (ix->num + 64 > ix->size) {
+    ix->size *= 2;
+    ix->pos = xrealloc(ix->pos, ix->size * sizeof(UINT32));
+  }
+  out = ix->pos + ix->num;
+  while (structurals) {
+    *(out++) = base + ctz64(structurals);
+    structurals &= structurals - 1;
+  }
+  ix->num = out - ix->pos;
+}
+
+/* Stage 1. Returns 0 if the input ends inside a string. */
+static int json_build_index(const p_wchar0 *s, size_t len,
+			    struct json_index *ix)
+{
+  struct json_index_state st = { 0, 0, 1 };
+  struct json_block b;
+  size_t p;
+
+  for (p = 0; p + 64 <= len; p += 64) {
+    json_classify(s + p, &b);
+    json_index_block(ix, &st, &b, (UINT32)p);
+  }
+  if (p < len) {
+    p_wchar0 tail[64];
+    memset(tail, ' ', sizeof(tail));
+    memcpy(tail, s + p, len - p);
+    json_classify(tail, &b);
+    json_index_block(ix, &st, &b, (UINT32)p);
+  }
+  return !st.prev_in_string;
+}
+
+struct json_walk
+{
+  const p_wchar0 *s;
+  size_t len;
+  const UINT32 *pos;
+  size_t num;
+  size_t k;			/* Next index entry. */
+  int flags;
+};
+
+/* Returns the position of the first character at or after p that
+ * terminates the plain part of a string, ie a quote, a backslash, a
+ * control character or (in UTF-8 mode) a non-ASCII character.
+ */
+static size_t json_scan_plain(const p_wchar0 *s, size_t p, size_t len,
+			      int utf8)
+{
+#ifdef JSON_SSE2
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i ctrl = _mm_set1_epi8(0x1f);
+  while (p + 16 <= len) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + p));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+			     _mm_cmpeq_epi8(v, backslash));
+    int bits;
+    /* Unsigned v <= 0x1f. */
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+    /* NB: Non-ASCII characters have the top bit set. */
+    if (utf8) m = _mm_or_si128(m, v);
+    if ((bits = _mm_movemask_epi8(m))) return p + ctz32(bits);
+    p += 16;
+  }
+#endif
+  for (; p < len; p++) {
+    p_wchar0 c = s[p];
+    if ((c == '"') || (c == '\\') || (c < 0x20) || (utf8 && (c & 0x80)))
+      break;
+  }
+  return p;
+}
+
+static inline int json_hex4(const p_wchar0 *s)
+{
+  int i, res = 0;
+  for (i = 0; i < 4; i++) {
+    int c = s[i];
+    res <<= 4;
+    if ((c >= '0') && (c <= '9')) res |= c - '0';
+    else if ((c >= 'a') && (c <= 'f')) res |= c - 'a' + 10;
+    else if ((c >= 'A') && (c <= 'F')) res |= c - 'A' + 10;
+    else return -1;
+  }
+  return res;
+}
+
+/* Decode one UTF-8 encoded character at p, and advance p.
+ * Returns -1 on invalid or non-shortest encodings and surrogates.
+ */
+static inline INT32 json_utf8_char(const p_wchar0 *s, size_t *p, size_t len)
+{
+  size_t i = *p;
+  INT32 c = s[i];
+  int cont, j;
+  INT32 min;
+
+  if (c < 0xc2) return -1;
+  if (c < 0xe0) { c &= 0x1f; cont = 1; min = 0x80; }
+  else if (c < 0xf0) { c &= 0x0f; cont = 2; min = 0x800; }
+  else if (c < 0xf5) { c &= 0x07; cont = 3; min = 0x10000; }
+  else return -1;
+
+  if (i + cont >= len) return -1;
+  for (j = 1; j <= cont; j++) {
+    int cc = s[i + j];
+    if ((cc & 0xc0) != 0x80) return -1;
+    c = (c << 6) | (cc & 0x3f);
+  }
+  if ((c < min) || (c > 0x10ffff) || IS_SURROGATE(c)) return -1;
+  *p = i + cont + 1;
+  return c;
+}
+
+/* Push the string that starts with the quote at pos.
+ * Returns the position after the closing quote, or 0 to give up.
+ */
+static size_t json_walk_string(struct json_walk *w, size_t pos)
+{
+  const p_wchar0 *s = w->s;
+  size_t len = w->len;
+  int utf8 = w->flags & JSON_UTF8;
+  size_t start = pos + 1;
+  size_t p = json_scan_plain(s, start, len, utf8);
+  struct string_builder b;
+  ONERROR uwp;
+
+  if (p >= len) return 0;
+  if (s[p] == '"') {
+    /* Fast path: No escapes, and (in UTF-8 mode) only ASCII. */
+    push_string(make_shared_binary_string((const char *)s + start,
+					  p - start));
+    return p + 1;
+  }
+
+  init_string_builder(&b, 0);
+  SET_ONERROR(uwp, free_string_builder, &b);
+  while (1) {
+    p_wchar0 c;
+    if (p > start)
+      string_builder_binary_strcat(&b, (const char *)s + start, p - start);
+    if (p >= len) goto fail;
+    c = s[p];
+    if (c == '"') break;
+    if (c == '\\') {
+      if (p + 1 >= len) goto fail;
+      switch(s[p + 1]) {
+      case '"': case '\\': case '/':
+	string_builder_putchar(&b, s[p + 1]); break;
+      case 'b': string_builder_putchar(&b, '\b'); break;
+      case 'f': string_builder_putchar(&b, '\f'); break;
+      case 'n': string_builder_putchar(&b, '\n'); break;
+      case 'r': string_builder_putchar(&b, '\r'); break;
+      case 't': string_builder_putchar(&b, '\t'); break;
+      case 'u':
+	{
+	  int hex0, hex1;
+	  if ((p + 6 > len) || ((hex0 = json_hex4(s + p + 2)) < 0))
+	    goto fail;
+	  if (IS_HIGH_SURROGATE(hex0)) {
+	    if ((p + 12 > len) || (s[p + 6] != '\\') || (s[p + 7] != 'u') ||
+		((hex1 = json_hex4(s + p + 8)) < 0) ||
+		!IS_LOW_SURROGATE(hex1))
+	      goto fail;
+	    string_builder_putchar(&b, (((hex0 - 0xd800) << 10) |
+					(hex1 - 0xdc00)) + 0x10000);
+	    p += 6;
+	  } else if (IS_SURROGATE(hex0)) {
+	    goto fail;
+	  } else {
+	    string_builder_putchar(&b, hex0);
+	  }
+	  p += 4;
+	}
+	break;
+      default:
+	goto fail;
+      }
+      p += 2;
+    } else if (c < 0x20) {
+      goto fail;
+    } else {
+      /* Non-ASCII in UTF-8 mode. */
+      INT32 ch = json_utf8_char(s, &p, len);
+      if (ch < 0) goto fail;
+      string_builder_putchar(&b, ch);
+    }
+    start = p;
+    p = json_scan_plain(s, p, len, utf8);
+  }
+  UNSET_ONERROR(uwp);
+  push_string(finish_string_builder(&b));
+  return p + 1;
+
+ fail:
+  CALL_AND_UNSET_ONERROR(uwp);
+  return 0;
+}
+
+static inline int json_is_delimiter(const struct json_walk *w, size_t p)
+{
+  if (p >= w->len) return 1;
+  return !!(json_char_class[w->s[p]] & (JSON_CLASS_OP|JSON_CLASS_WS));
+}
+
+/* Push the number that starts at pos.
+ * Returns the position after the number, or 0 to give up.
+ */
+static size_t json_walk_number(struct json_walk *w, size_t pos)
+{
+  const p_wchar0 *s = w->s;
+  size_t len = w->len;
+  size_t p = pos;
+  size_t digits;
+  int is_float = 0;
+
+  if (s[p] == '-') p++;
+  if ((p >= len) || (s[p] < '0') || (s[p] > '9')) return 0;
+  if ((s[p] == '0') && (p + 1 < len) && (s[p + 1] >= '0') && (s[p + 1] <= '9'))
+    return 0;
+  for (digits = p; (p < len) && (s[p] >= '0') && (s[p] <= '9'); p++)
+    ;
+  digits = p - digits;
+  if ((p < len) && (s[p] == '.')) {
+    is_float = 1;
+    p++;
+    if ((p >= len) || (s[p] < '0') || (s[p] > '9')) return 0;
+    while ((p < len) && (s[p] >= '0') && (s[p] <= '9')) p++;
+  }
+  if ((p < len) && ((s[p] == 'e') || (s[p] == 'E'))) {
+    is_float = 1;
+    p++;
+    if ((p < len) && ((s[p] == '+') || (s[p] == '-'))) p++;
+    if ((p >= len) || (s[p] < '0') || (s[p] > '9')) return 0;
+    while ((p < len) && (s[p] >= '0') && (s[p] <= '9')) p++;
+  }
+  if (!json_is_delimiter(w, p)) return 0;
+
+  if (is_float) {
+#if SIZEOF_FLOAT_TYPE > SIZEOF_DOUBLE
+    push_float((FLOAT_TYPE)STRTOLD_PCHARP(MKPCHARP(s + pos, 0), NULL));
+#else
+    push_float((FLOAT_TYPE)STRTOD_PCHARP(MKPCHARP(s + pos, 0), NULL));
+#endif
+  } else if (digits <= 18) {
+    INT64 val = 0;
+    size_t i = pos + (s[pos] == '-');
+    for (; i < p; i++) val = val * 10 + (s[i] - '0');
+    push_int64((s[pos] == '-')? -val : val);
+  } else {
+    pcharp_to_svalue_inumber(Pike_sp++, MKPCHARP(s + pos, 0), NULL, 10,
+			     p - pos);
+  }
+  return p;
+}
+
+static int json_walk_value(struct json_walk *w);
+
+/* Returns the character at the next index entry, or 0 at the end. */
+static inline p_wchar0 json_next_token(struct json_walk *w)
+{
+  if (w->k >= w->num) return 0;
+  return w->s[w->pos[w->k]];
+}
+
+/* Stage 2. Push the value at the next index entry.
+ * Returns 0 on success and -1 to give up, in which case the caller
+ * must restore the stack.
+ */
+static int json_walk_value(struct json_walk *w)
+{
+  size_t pos, end;
+
+  if (w->k >= w->num) return -1;
+  pos = w->pos[w->k++];
+
+  switch(w->s[pos]) {
+  case '{':
+    {
+      struct mapping *m;
+
+      /* Check stacks since we have uncontrolled recursion here. */
+      check_stack(10);
+      check_c_stack(1024);
+
+      push_mapping(m = allocate_mapping(5));
+      if (json_next_token(w) == '}') {
+	w->k++;
+	return 0;
+      }
+      while (1) {
+	if (json_next_token(w) != '"') return -1;
+	if (!(end = json_walk_string(w, w->pos[w->k++]))) return -1;
+	if ((json_next_token(w) != ':') || (w->pos[w->k] < end)) return -1;
+	w->k++;
+	if (json_walk_value(w)) return -1;
+	mapping_insert(m, Pike_sp - 2, Pike_sp - 1);
+	pop_2_elems();
+	switch(json_next_token(w)) {
+	case ',':
+	  w->k++;
+	  continue;
+	case '}':
+	  w->k++;
+	  return 0;
+	}
+	return -1;
+      }
+    }
+
+  case '[':
+    check_stack(10);
+    check_c_stack(1024);
+
+    if (json_next_token(w) == ']') {
+      w->k++;
+      push_array(allocate_array(0));
+      return 0;
+    }
+    BEGIN_AGGREGATE_ARRAY(16) {
+      while (1) {
+	if (json_walk_value(w)) return -1;
+	DO_AGGREGATE_ARRAY(120);
+	if (json_next_token(w) == ',') {
+	  w->k++;
+	  continue;
+	}
+	if (json_next_token(w) == ']') {
+	  w->k++;
+	  break;
+	}
+	return -1;
+      }
+    } END_AGGREGATE_ARRAY;
+    return 0;
+
+  case '"':
+    if (!(end = json_walk_string(w, pos))) return -1;
+    if ((w->k < w->num) && (w->pos[w->k] < end)) return -1;
+    return 0;
+
+  case 't':
+    if ((pos + 4 > w->len) || memcmp(w->s + pos, "true", 4) ||
+	!json_is_delimiter(w, pos + 4))
+      return -1;
+    if (w->flags & JSON_NO_OBJ) push_int(1);
+    else push_object(get_val_true());
+    return 0;
+
+  case 'f':
+    if ((pos + 5 > w->len) || memcmp(w->s + pos, "false", 5) ||
+	!json_is_delimiter(w, pos + 5))
+      return -1;
+    if (w->flags & JSON_NO_OBJ) push_int(0);
+    else push_object(get_val_false());
+    return 0;
+
+  case 'n':
+    if ((pos + 4 > w->len) || memcmp(w->s + pos, "null", 4) ||
+	!json_is_delimiter(w, pos + 4))
+      return -1;
+    if (w->flags & JSON_NO_OBJ) push_undefined();
+    else push_object(get_val_null());
+    return 0;
+
+  case '-':
+  case '0': case '1': case '2': case '3': case '4':
+  case '5': case '6': case '7': case '8': case '9':
+    return json_walk_number(w, pos)? 0 : -1;
+  }
+  return -1;
+}
+
+static void free_json_index(struct json_index *ix)
+{
+  free(ix->pos);
+}
+
+/* Decode the 8-bit string data with the structural index decoder.
+ *
+ * Returns 1 with the value pushed on the stack on success, and 0 if
+ * the caller should use the state machine decoder instead.
+ */
+static int json_index_decode(struct pike_string *data, int flags)
+{
+  struct json_index ix;
+  struct json_walk w;
+  struct svalue *save_sp = Pike_sp;
+  ONERROR uwp;
+  int ok;
+
+  if (data->size_shift || (data->len >= 0xffffffff)) return 0;
+
+  ix.num = 0;
+  ix.size = data->len/8 + 64;
+  ix.pos = xalloc(ix.size * sizeof(UINT32));
+  SET_ONERROR(uwp, free_json_index, &ix);
+
+  if (!json_build_index(STR0(data), data->len, &ix)) {
+    CALL_AND_UNSET_ONERROR(uwp);
+    return 0;
+  }
+
+  w.s = STR0(data);
+  w.len = data->len;
+  w.pos = ix.pos;
+  w.num = ix.num;
+  w.k = 0;
+  w.flags = flags;
+
+  ok = !json_walk_value(&w) && (w.k == w.num);
+
+  CALL_AND_UNSET_ONERROR(uwp);
+
+  if (!ok) {
+    pop_n_elems(Pike_sp - save_sp);
+    return 0;
+  }
+  return 1;
+}
+
+/* Lazy documents.
+ *
+ * A lazy document keeps the structural index of a strict JSON
+ * document together with the index of the matching end for every
+ * array and object, so that values can be skipped without looking
+ * at their contents. Values are only validated and decoded when they
+ * are accessed.
+ */
+
+struct json_lazy_doc
+{
+  INT32 refs;
+  int flags;
+  struct pike_string *data;
+  struct object *module;	/* For decode_error(). */
+  UINT32 *pos;			/* The structural index. */
+  UINT32 *match;		/* Index entry of the matching ] or }. */
+  size_t num;
+};
+
+static void free_json_lazy_doc(struct json_lazy_doc *doc)
+{
+  if (--doc->refs) return;
+  free(doc->pos);
+  free(doc->match);
+  free_string(doc->data);
+  if (doc->module) free_object(doc->module);
+  free(doc);
+}
+
+static inline p_wchar0 json_lazy_char(const struct json_lazy_doc *doc,
+				      size_t k)
+{
+  return STR0(doc->data)[doc->pos[k]];
+}
+
+/* Returns the index entry after the value at entry k. */
+static inline size_t json_lazy_next(const struct json_lazy_doc *doc,
+				    size_t k)
+{
+  p_wchar0 c = json_lazy_char(doc, k);
+  if ((c == '{') || (c == '[')) return doc->match[k] + 1;
+  return k + 1;
+}
+
+/* Index the 8-bit string data.
+ *
+ * Returns NULL if data isn't a strict JSON document with balanced
+ * brackets, in which case it has to be decoded in full.
+ */
+static struct json_lazy_doc *json_lazy_build(struct pike_string *data,
+					     int flags)
+{
+  struct json_lazy_doc *doc;
+  struct json_index ix;
+  UINT32 *match, *stack;
+  size_t k, depth = 0;
+  const p_wchar0 *s = STR0(data);
+
+  if (data->size_shift || (data->len >= 0xffffffff)) return NULL;
+
+  ix.num = 0;
+  ix.size = data->len/8 + 64;
+  ix.pos = xalloc(ix.size * sizeof(UINT32));
+  if (!json_build_index(s, data->len, &ix) || !ix.num) {
+    free(ix.pos);
+    return NULL;
+  }
+
+  match = malloc(ix.num * sizeof(UINT32));
+  stack = malloc(ix.num * sizeof(UINT32));
+  if (!match || !stack) {
+    free(match);
+    free(stack);
+    free(ix.pos);
+    Pike_error("Out of memory.\n");
+  }
+
+  for (k = 0; k < ix.num; k++) {
+    p_wchar0 c = s[ix.pos[k]];
+    switch(c) {
+    case '{': case '[':
+      stack[depth++] = k;
+      break;
+    case '}': case ']':
+      /* NB: '[' + 2 == ']' and '{' + 2 == '}'. */
+      if (!depth || (s[ix.pos[stack[depth - 1]]] + 2 != c)) goto fail;
+      match[stack[--depth]] = k;
+      break;
+    case ':': case ',': case '"': case '-': case 't': case 'f': case 'n':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      break;
+    default:
+      /* Comments and other extensions. */
+      goto fail;
+    }
+  }
+  if (depth) goto fail;
+  if ((s[ix.pos[0]] == '{') || (s[ix.pos[0]] == '[')) {
+    if (match[0] != ix.num - 1) goto fail;
+  } else if (ix.num != 1) goto fail;
+
+  free(stack);
+  doc = ALLOC_STRUCT(json_lazy_doc);
+  doc->refs = 0;
+  doc->flags = flags;
+  add_ref(doc->data = data);
+  doc->module = NULL;
+  doc->pos = ix.pos;
+  doc->match = match;
+  doc->num = ix.num;
+  return doc;
+
+ fail:
+  free(stack);
+  free(match);
+  free(ix.pos);
+  return NULL;
+}
+
+/* Push the value at entry k decoded with the state machine decoder,
+ * or throw the decode error.
+ */
+static void json_lazy_parse(struct json_lazy_doc *doc, size_t k)
+{
+  struct parser_state state;
+  ptrdiff_t stop;
+
+  err_msg = NULL;
+  state.level = 0;
+  state.flags = doc->flags | JSON_FIRST_VALUE;
+
+  stop = _parse_JSON(MKPCHARP_STR(doc->data), doc->pos[k], doc->data->len,
+		     &state);
+  if (!(state.flags & JSON_ERROR)) return;
+
+  ref_push_string(doc->data);
+  push_int((INT_TYPE)stop);
+  if (err_msg) {
+    push_text(err_msg);
+    apply(doc->module, "decode_error", 3);
+  } else
+    apply(doc->module, "decode_error", 2);
+}
+
+/* Throw a decode error for the malformed value at entry k. */
+static void json_lazy_error(struct json_lazy_doc *doc, size_t k)
+{
+  json_lazy_parse(doc, k);
+  /* The state machine decoder didn't find the error. */
+  pop_stack();
+  ref_push_string(doc->data);
+  push_int(doc->pos[k]);
+  apply(doc->module, "decode_error", 2);
+}
+
+/* Push the fully decoded value at entry k. */
+static void json_lazy_decode(struct json_lazy_doc *doc, size_t k)
+{
+  struct json_walk w;
+  struct svalue *save_sp = Pike_sp;
+
+  w.s = STR0(doc->data);
+  w.len = doc->data->len;
+  w.pos = doc->pos;
+  w.num = doc->num;
+  w.k = k;
+  w.flags = doc->flags;
+
+  if (!json_walk_value(&w) && (w.k == json_lazy_next(doc, k))) return;
+
+  pop_n_elems(Pike_sp - save_sp);
+  json_lazy_parse(doc, k);
+}
+
+/* Iteration over the members of an object or the elements of an
+ * array. */
+struct json_lazy_iter
+{
+  size_t container;
+  size_t end;			/* Entry of the closing bracket. */
+  size_t key;			/* Entry of the current key. */
+  size_t val;			/* Entry of the current value. */
+};
+
+static int json_lazy_iter_step(struct json_lazy_doc *doc,
+			       struct json_lazy_iter *it, size_t kk)
+{
+  if (json_lazy_char(doc, it->container) == '{') {
+    if ((kk + 2 >= it->end) || (json_lazy_char(doc, kk) != '"') ||
+	(json_lazy_char(doc, kk + 1) != ':'))
+      json_lazy_error(doc, it->container);
+    it->key = kk;
+    kk += 2;
+  }
+  if (kk >= it->end) json_lazy_error(doc, it->container);
+  switch(json_lazy_char(doc, kk)) {
+  case ']': case '}': case ':': case ',':
+    json_lazy_error(doc, it->container);
+  }
+  it->val = kk;
+  return 1;
+}
+
+/* Returns 0 if the container at entry k is empty. */
+static int json_lazy_iter_first(struct json_lazy_doc *doc,
+				struct json_lazy_iter *it, size_t k)
+{
+  it->container = k;
+  it->end = doc->match[k];
+  if (k + 1 == it->end) return 0;
+  return json_lazy_iter_step(doc, it, k + 1);
+}
+
+/* Returns 0 at the end of the container. */
+static int json_lazy_iter_next(struct json_lazy_doc *doc,
+			       struct json_lazy_iter *it)
+{
+  size_t n = json_lazy_next(doc, it->val);
+  if (n == it->end) return 0;
+  if (json_lazy_char(doc, n) != ',') json_lazy_error(doc, it->container);
+  return json_lazy_iter_step(doc, it, n + 1);
+}
+
+/* Push the key at the current position of the iterator. */
+static void json_lazy_push_key(struct json_lazy_doc *doc,
+			       struct json_lazy_iter *it)
+{
+  struct json_walk w;
+
+  w.s = STR0(doc->data);
+  w.len = doc->data->len;
+  w.pos = doc->pos;
+  w.num = doc->num;
+  w.k = it->key;
+  w.flags = doc->flags;
+
+  if (!json_walk_string(&w, doc->pos[it->key]))
+    json_lazy_error(doc, it->container);
+}
+
+/* Returns the value entry of the member key in the object at entry k,
+ * or -1 if there is none. raw is the key as it is stored in the
+ * document if it doesn't need any escapes, ie the key itself or the
+ * UTF-8 encoded key, or NULL.
+ *
+ * Like decode(), the last member wins if a key occurs more than once.
+ */
+static ptrdiff_t json_lazy_lookup(struct json_lazy_doc *doc, size_t k,
+				  struct pike_string *key,
+				  struct pike_string *raw)
+{
+  struct json_lazy_iter it;
+  const p_wchar0 *s = STR0(doc->data);
+  size_t len = doc->data->len;
+  ptrdiff_t res = -1;
+
+  if (!json_lazy_iter_first(doc, &it, k)) return -1;
+  do {
+    size_t start = doc->pos[it.key] + 1;
+    size_t p = json_scan_plain(s, start, len, 0);
+    if ((p < len) && (s[p] == '"')) {
+      if (raw && (raw->len == (ptrdiff_t)(p - start)) &&
+	  !memcmp(raw->str, s + start, p - start))
+	res = it.val;
+    } else {
+      /* Escaped key. */
+      json_lazy_push_key(doc, &it);
+      if (Pike_sp[-1].u.string == key) res = it.val;
+      pop_stack();
+    }
+  } while (json_lazy_iter_next(doc, &it));
+
+  return res;
+}
+
+/* Returns the number of members or elements in the container at
+ * entry k. */
+static size_t json_lazy_size(struct json_lazy_doc *doc, size_t k)
+{
+  struct json_lazy_iter it;
+  size_t res = 0;
+
+  if (!json_lazy_iter_first(doc, &it, k)) return 0;
+  do {
+    res++;
+  } while (json_lazy_iter_next(doc, &it));
+  return res;
+}
+
+/* Returns the entry of element i in the array at entry k, or -1 if
+ * it is out of range. */
+static ptrdiff_t json_lazy_element(struct json_lazy_doc *doc, size_t k,
+				   INT_TYPE i)
+{
+  struct json_lazy_iter it;
+
+  if (i < 0) i += json_lazy_size(doc, k);
+  if ((i < 0) || !json_lazy_iter_first(doc, &it, k)) return -1;
+  while (i--) {
+    if (!json_lazy_iter_next(doc, &it)) return -1;
+  }
+  return it.val;
+}
+
+static void init_json_index(void)
+{
+  json_char_class['"'] = JSON_CLASS_QUOTE;
+  json_char_class['\\'] = JSON_CLASS_BACKSLASH;
+  json_char_class['{'] = json_char_class['}'] = JSON_CLASS_OP;
+  json_char_class['['] = json_char_class[']'] = JSON_CLASS_OP;
+  json_char_class[':'] = json_char_class[','] = JSON_CLASS_OP;
+  json_char_class[' '] = json_char_class['\t'] = JSON_CLASS_WS;
+  json_char_class['\n'] = json_char_class['\r'] = JSON_CLASS_WS;
+
+  json_classify = json_classify_scalar;
+#ifdef JSON_SSE2
+  json_classify = json_classify_sse2;
+#endif
+#ifdef JSON_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    json_classify = json_classify_avx2;
+#endif
+}
@@ -9,4 +9,7 @@
 /* Define this if you have -lpcre */
 #undef HAVE_LIBPCRE
 
+/* Define this if you have -lpcre2-8 */
+#undef HAVE_LIBPCRE2
+
 @BOTTOM@
@@ -19,9 +19,14 @@
 #include "block_allocator.h"
 #include "whitespace.h"
 #include "pike_search.h"
+#include "bitvector.h"
 
 #include <errno.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #ifdef PIKE_DEBUG
 /* Needed for isprint(). */
 #include <ctype.h>
@@ -256,6 +261,113 @@ CONVERT(1,2)
 CONVERT(2,0)
 CONVERT(2,1)
 
+/* Scanning for non-ASCII characters in 8-bit strings.
+ *
+ * These are used by the UTF-8 conversion functions to handle runs
+ * of 7-bit characters in bulk. The SSE2 versions are used when the
+ * compiler targets SSE2, and the AVX2 versions are selected at
+ * runtime if the CPU supports them.
+ */
+
+#if defined(__GNUC__) && defined(__SSE2__) && defined(HAVE_EMMINTRIN_H)
+#include <emmintrin.h>
+#define STRING_SSE2
+#if defined(HAVE_IMMINTRIN_H) && \
+  (defined(__clang__) || (__GNUC__ > 4) || \
+   ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#include <immintrin.h>
+#define STRING_AVX2
+#endif
+#endif
+
+static ptrdiff_t find_non_ascii_scalar(const p_wchar0 *s, ptrdiff_t len)
+{
+  ptrdiff_t i;
+  for (i = 0; i + 8 <= len; i += 8) {
+    UINT64 w;
+    memcpy(&w, s + i, 8);
+    if (w & 0x8080808080808080ULL) break;
+  }
+  while ((i < len) && !(s[i] & 0x80)) i++;
+  return i;
+}
+
+static ptrdiff_t count_non_ascii_scalar(const p_wchar0 *s, ptrdiff_t len)
+{
+  ptrdiff_t i, res = 0;
+  for (i = 0; i < len; i++) res += s[i] >> 7;
+  return res;
+}
+
+#ifdef STRING_SSE2
+static ptrdiff_t find_non_ascii_sse2(const p_wchar0 *s, ptrdiff_t len)
+{
+  ptrdiff_t i;
+  for (i = 0; i + 16 <= len; i += 16) {
+    int m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+    if (m) return i + ctz32(m);
+  }
+  return i + find_non_ascii_scalar(s + i, len - i);
+}
+
+static ptrdiff_t count_non_ascii_sse2(const p_wchar0 *s, ptrdiff_t len)
+{
+  ptrdiff_t i, res = 0;
+  for (i = 0; i + 16 <= len; i += 16) {
+    res += __builtin_popcount(
+      _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))));
+  }
+  return res + count_non_ascii_scalar(s + i, len - i);
+}
+#endif /* STRING_SSE2 */
+
+#ifdef STRING_AVX2
+ATTRIBUTE((target("avx2")))
+static ptrdiff_t find_non_ascii_avx2(const p_wchar0 *s, ptrdiff_t len)
+{
+  ptrdiff_t i;
+  for (i = 0; i + 32 <= len; i += 32) {
+    unsigned INT32 m =
+      _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(s + i)));
+    if (m) return i + ctz32(m);
+  }
+  return i + find_non_ascii_sse2(s + i, len - i);
+}
+
+ATTRIBUTE((target("avx2")))
+static ptrdiff_t count_non_ascii_avx2(const p_wchar0 *s, ptrdiff_t len)
+{
+  ptrdiff_t i, res = 0;
+  for (i = 0; i + 32 <= len; i += 32) {
+    res += __builtin_popcount(
+      _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(s + i))));
+  }
+  return res + count_non_ascii_sse2(s + i, len - i);
+}
+#endif /* STRING_AVX2 */
+
+/* Returns the index of the first character >= 0x80 in s, or len. */
+PMOD_EXPORT ptrdiff_t (*find_non_ascii)(const p_wchar0 *s, ptrdiff_t len) =
+  find_non_ascii_scalar;
+
+/* Returns the number of characters >= 0x80 in s. */
+PMOD_EXPORT ptrdiff_t (*count_non_ascii)(const p_wchar0 *s, ptrdiff_t len) =
+  count_non_ascii_scalar;
+
+static void init_string_scanners(void)
+{
+#ifdef STRING_SSE2
+  find_non_ascii = find_non_ascii_sse2;
+  count_non_ascii = count_non_ascii_sse2;
+#endif
+#ifdef STRING_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    find_non_ascii = find_non_ascii_avx2;
+    count_non_ascii = count_non_ascii_avx2;
+  }
+#endif
+}
+
 #define TWO_SIZES(X,Y) (((X)<<2)+(Y))
 
 void generic_memcpy(PCHARP to,
@@ -535,6 +647,12 @@ static void free_string_content(struct pike_string * s)
    case STRING_ALLOC_SUBSTRING:
      free_string(((struct substring_pike_string*)s)->parent);
      break;
+#ifdef HAVE_MMAP
+   case STRING_ALLOC_MMAP:
+     /* NB: The mapping includes the page holding the terminating NUL. */
+     munmap(s->str, s->len + 1);
+     break;
+#endif
   }
 }
 
@@ -769,6 +887,46 @@ PMOD_EXPORT struct pike_string * make_shared_malloc_string(char *str, size_t len
   return s;
 }
 
+#ifdef HAVE_MMAP
+/* Creates a shared 8-bit string that uses a read-only memory mapping
+ * as storage. The mapping must be at least len+1 bytes, with a NUL
+ * at str[len], and is unmapped when the string is freed.
+ *
+ * Only the prefix of the string is hashed, so the pages of the
+ * mapping are not touched until the content is actually needed.
+ */
+PMOD_EXPORT struct pike_string * make_shared_mmap_string(char *str, size_t len)
+{
+  struct pike_string *s;
+  ptrdiff_t h = StrHash(str, len);
+
+  s = internal_findstring(str,len,0,h);
+
+  if (!s) {
+    s = ba_alloc(&string_allocator);
+#ifdef PIKE_DEBUG
+    gc_init_marker(s);
+#endif
+
+    s->flags = STRING_NOT_HASHED|STRING_NOT_SHARED;
+    s->size_shift = eightbit;
+    s->alloc_type = STRING_ALLOC_MMAP;
+    s->struct_type = STRING_STRUCT_STRING;
+    s->str = str;
+    s->refs = 0;
+    s->len = len;
+    add_ref(s);
+
+    link_pike_string(s, h);
+  } else {
+    munmap(str, len + 1);
+    add_ref(s);
+  }
+
+  return s;
+}
+#endif
+
 /*
  * This function assumes that the shift size is already the minimum it
  * can be.
@@ -1081,7 +1239,8 @@ PMOD_EXPORT void really_free_string(struct pike_string *s)
 #endif
   if (!(s->flags & STRING_NOT_SHARED))
     unlink_pike_string(s);
-  if (s->flags & STRING_CLEAR_ON_EXIT)
+  if ((s->flags & STRING_CLEAR_ON_EXIT) &&
+      (s->alloc_type != STRING_ALLOC_MMAP))
     secure_zero(s->str, s->len<<s->size_shift);
   free_unlinked_pike_string(s);
   GC_FREE_SIMPLE_BLOCK(s);
@@ -2091,6 +2250,8 @@ PMOD_EXPORT struct pike_string *string_replace(struct pike_string *str,
 /*** init/exit memory ***/
 void init_shared_string_table(void)
 {
+  init_string_scanners();
+
   SET_HSIZE(BEGIN_HASH_SIZE);
   base_table=xcalloc(sizeof(struct pike_string *), htable_size);
 
@@ -2158,6 +2319,7 @@ void cleanup_shared_string_table(void)
 void count_string_types() {
   unsigned INT32 e;
   size_t num_static = 0, num_short = 0, num_substring = 0, num_malloc = 0;
+  size_t num_mmap = 0;
 
   for (e = 0; e < htable_size; e++) {
       struct pike_string * s;
@@ -2176,6 +2338,9 @@ void count_string_types() {
           case STRING_ALLOC_MALLOC:
               num_malloc ++;
               break;
+          case STRING_ALLOC_MMAP:
+              num_mmap ++;
+              break;
           }
   }
 
@@ -2187,6 +2352,8 @@ void count_string_types() {
   push_ulongest(num_substring);
   push_static_text("num_malloced_strings");
   push_ulongest(num_malloc);
+  push_static_text("num_mmapped_strings");
+  push_ulongest(num_mmap);
 }
 
 size_t count_memory_in_string(const struct pike_string * s) {
@@ -2202,6 +2369,8 @@ size_t count_memory_in_string(const struct pike_string * s) {
   case STRING_ALLOC_MALLOC:
       size += PIKE_ALIGNTO(((s->len + 1) << s->size_shift), 4);
       break;
+  case STRING_ALLOC_MMAP:
+      /* Shared with the page cache. */
   case STRING_ALLOC_STATIC:
       break;
   }
@@ -18,6 +18,7 @@ enum string_type {
     STRING_ALLOC_MALLOC   =1,
     STRING_ALLOC_BA       =2,
     STRING_ALLOC_SUBSTRING=3,
+    STRING_ALLOC_MMAP     =4,
 };
 
 
@@ -305,6 +306,9 @@ PMOD_EXPORT struct pike_string * debug_make_shared_binary_string1(const p_wchar1
 PMOD_EXPORT struct pike_string * debug_make_shared_binary_string2(const p_wchar2 *str,size_t len);
 PMOD_EXPORT struct pike_string * make_shared_static_string(const char *str, size_t len, enum size_shift);
 PMOD_EXPORT struct pike_string * make_shared_malloc_string(char *str, size_t len, enum size_shift);
+#ifdef HAVE_MMAP
+PMOD_EXPORT struct pike_string * make_shared_mmap_string(char *str, size_t len);
+#endif
 PMOD_EXPORT struct pike_string *debug_make_shared_string(const char *str);
 PMOD_EXPORT struct pike_string *debug_make_shared_string0(const p_wchar0 *str);
 PMOD_EXPORT struct pike_string *debug_make_shared_string1(const p_wchar1 *str);
@@ -318,6 +322,13 @@ PMOD_EXPORT int string_range_contains_string( struct pike_string *str1,
 /* Returns true if str could contain n. */
 PMOD_EXPORT int string_range_contains( struct pike_string *str, int n );
 
+/* Returns the index of the first character >= 0x80, or len. */
+PMOD_EXPORT extern ptrdiff_t (*find_non_ascii)(const p_wchar0 *s,
+                                               ptrdiff_t len);
+/* Returns the number of characters >= 0x80. */
+PMOD_EXPORT extern ptrdiff_t (*count_non_ascii)(const p_wchar0 *s,
+                                                ptrdiff_t len);
+
 void unlink_pike_string(struct pike_string *s);
 PMOD_EXPORT void do_free_string(struct pike_string *s);
 PMOD_EXPORT void do_free_unlinked_pike_string(struct pike_string *s);
@@ -433,6 +444,10 @@ static inline int PIKE_UNUSED_ATTRIBUTE string_is_substring(const struct pike_st
     return s->alloc_type == STRING_ALLOC_SUBSTRING;
 }
 
+static inline int PIKE_UNUSED_ATTRIBUTE string_is_mmapped(const struct pike_string * s) {
+    return s->alloc_type == STRING_ALLOC_MMAP;
+}
+
 static struct pike_string PIKE_UNUSED_ATTRIBUTE *substring_content_string(const struct pike_string *s)
 {
   return ((struct substring_pike_string*)s)->parent;
@@ -441,12 +456,12 @@ static struct pike_string PIKE_UNUSED_ATTRIBUTE *substring_content_string(const
 static inline int PIKE_UNUSED_ATTRIBUTE string_may_modify(const struct pike_string * s)
 {
     return !string_is_static(s) && !string_is_substring(s)
-      && s->refs == 1;
+      && !string_is_mmapped(s) && s->refs == 1;
 }
 
 static inline int PIKE_UNUSED_ATTRIBUTE string_may_modify_len(const struct pike_string * s)
 {
-    return s->refs == 1;
+    return !string_is_mmapped(s) && s->refs == 1;
 }
 
 static inline int PIKE_UNUSED_ATTRIBUTE find_magnitude1(const p_wchar1 *s, ptrdiff_t len)